@@ -0,0 +1,104 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+#define ARENA_BLOCK_SIZE 4096 * 16 // 每次向系统申请的内存块大小
+
+// 跳表节点的内存池
+// 节点从大块内存中依次切出(bump allocation), 不单独释放, 析构时整块归还给系统
+// 相比每个节点两次 new, 分配只是移动指针, 相邻插入的节点在内存中也更紧凑
+// 内存池本身不加锁, 由调用者保证互斥(跳表的修改操作都在锁内)
+class Arena
+{
+public:
+    Arena();
+    ~Arena();
+
+    // 分配bytes字节, 起始地址按align对齐
+    char *allocate(size_t bytes, size_t align = sizeof(void *));
+
+    // 向系统申请的内存总量
+    size_t memory_usage() const;
+
+private:
+    char *allocate_fallback(size_t bytes);
+    char *allocate_new_block(size_t block_bytes);
+
+private:
+    // 当前块中下一个可分配的位置和剩余字节数
+    char *_alloc_ptr;
+    size_t _alloc_bytes_remaining;
+
+    // 已申请的所有内存块
+    vector<char *> _blocks;
+
+    size_t _memory_usage;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+};
+
+inline Arena::Arena() : _alloc_ptr(NULL), _alloc_bytes_remaining(0), _memory_usage(0) {}
+
+inline Arena::~Arena()
+{
+    for (size_t i = 0; i < _blocks.size(); i++)
+    {
+        delete[] _blocks[i];
+    }
+}
+
+inline char *Arena::allocate(size_t bytes, size_t align)
+{
+    // align 必须是2的幂
+    size_t current_mod = reinterpret_cast<uintptr_t>(_alloc_ptr) & (align - 1);
+    size_t slop = (current_mod == 0 ? 0 : align - current_mod);
+    size_t needed = bytes + slop;
+    if (needed <= _alloc_bytes_remaining)
+    {
+        char *result = _alloc_ptr + slop;
+        _alloc_ptr += needed;
+        _alloc_bytes_remaining -= needed;
+        return result;
+    }
+    return allocate_fallback(bytes);
+}
+
+// 当前块剩余空间不够时调用
+inline char *Arena::allocate_fallback(size_t bytes)
+{
+    // 大对象单独申请一块, 避免浪费当前块的剩余空间
+    if (bytes > ARENA_BLOCK_SIZE / 4)
+    {
+        return allocate_new_block(bytes);
+    }
+
+    _alloc_ptr = allocate_new_block(ARENA_BLOCK_SIZE);
+    _alloc_bytes_remaining = ARENA_BLOCK_SIZE;
+
+    char *result = _alloc_ptr;
+    _alloc_ptr += bytes;
+    _alloc_bytes_remaining -= bytes;
+    return result;
+}
+
+inline char *Arena::allocate_new_block(size_t block_bytes)
+{
+    // new char[] 返回的内存满足任意基本类型的对齐要求, 新块不需要额外对齐
+    char *result = new char[block_bytes];
+    _blocks.push_back(result);
+    _memory_usage += block_bytes + sizeof(char *);
+    return result;
+}
+
+inline size_t Arena::memory_usage() const
+{
+    return _memory_usage;
+}
+
+#endif
@@ -0,0 +1,853 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "logger.h"
+using namespace std;
+
+// 持久化用的异步写入
+// 快照按顺序写出一个大文件, 以前每攒满一个数据块就同步write一次, 编码下一块要等这一次写完;
+// 现在数据先拷进几个对齐的缓冲区, 写满一个就提交给内核(io_uring)或后台线程(pwrite), 调用者接着编码下一块,
+// 只有所有缓冲区都在写时才等待. dump_file() 持有写锁的时间因此缩短, bgsave的子进程也更快结束
+//
+// 后端按顺序选择:
+//   io_uring: 直接用系统调用, 不依赖liburing; 缓冲区注册为固定缓冲区(IORING_REGISTER_BUFFERS),
+//             内核不必每次重新映射用户页; 内核不支持或被seccomp禁用时 io_uring_setup 失败, 退回下一种
+//   pwrite线程池: 每个写入器带两个线程, 各自pwrite到自己的偏移, 彼此不需要同步
+//   同步: 在调用者线程里pwrite, 与改动之前的行为相同, 用于对比和排查问题
+// 编译时定义 SKIPLIST_IO_URING=0 可以去掉io_uring后端; 运行时可以用 set_async_io_mode() 选择
+//
+// 文件以O_DIRECT打开时绕过页缓存, 后台快照不会把热数据挤出页缓存; 文件系统不支持(如tmpfs)时退回普通写
+// O_DIRECT要求缓冲区地址, 偏移和长度都按 ASYNC_IO_ALIGN 对齐: 除最后一块外缓冲区总是写满的,
+// 最后一块补零到对齐长度, 写完后再ftruncate到实际长度
+
+#ifndef SKIPLIST_IO_URING
+#define SKIPLIST_IO_URING 1
+#endif
+
+#if SKIPLIST_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#define ASYNC_IO_ALIGN 4096
+#define ASYNC_IO_BUFFER_SIZE (256 * 1024)
+#define ASYNC_IO_BUFFER_COUNT 4
+#define ASYNC_IO_POOL_THREADS 2
+
+enum AsyncIoMode
+{
+    ASYNC_IO_AUTO, // 优先io_uring, 不可用时用pwrite线程池
+    ASYNC_IO_POOL, // pwrite线程池
+    ASYNC_IO_SYNC  // 在调用者线程里同步写
+};
+
+inline atomic<int> &async_io_mode_ref()
+{
+    static atomic<int> mode(ASYNC_IO_AUTO);
+    return mode;
+}
+
+// 只影响之后打开的文件
+inline void set_async_io_mode(AsyncIoMode mode)
+{
+    async_io_mode_ref().store(mode);
+}
+
+inline AsyncIoMode async_io_mode()
+{
+    return static_cast<AsyncIoMode>(async_io_mode_ref().load());
+}
+
+// 带重试的pwrite, 返回false时errno为失败原因
+// 以O_DIRECT打开的文件遇到EINVAL(文件系统或设备要求更大的对齐)时去掉O_DIRECT重试一次
+inline bool pwrite_all(int fd, const char *data, size_t n, uint64_t offset)
+{
+    bool retried = false;
+    while (n > 0)
+    {
+        ssize_t w = pwrite(fd, data, n, offset);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            int flags = fcntl(fd, F_GETFL);
+            if (errno == EINVAL && !retried && flags >= 0 && (flags & O_DIRECT))
+            {
+                fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+                retried = true;
+                continue;
+            }
+            return false;
+        }
+        data += w;
+        n -= w;
+        offset += w;
+    }
+    return true;
+}
+
+#if SKIPLIST_IO_URING
+
+// 最小的io_uring封装: 一个提交队列一个完成队列, 只在一个线程里使用
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    // entries为提交队列的长度, 失败时返回false, 对象仍可安全析构
+    bool init(unsigned entries);
+    bool is_open() const { return _fd >= 0; }
+    unsigned features() const { return _features; }
+
+    bool register_buffers(const struct iovec *iov, unsigned n);
+
+    // 取一个空闲的提交项, 队列满时返回NULL; 填好后调用submit提交
+    struct io_uring_sqe *get_sqe();
+
+    // 提交所有取出的提交项, 并等待至少wait_nr个完成, 返回提交的个数, 失败返回-errno
+    int submit(unsigned wait_nr);
+
+    // 取出一个完成项, 没有时返回false
+    bool pop_cqe(uint64_t *user_data, int *res);
+
+    // 写入后再fdatasync, 两个请求链在一起用一次系统调用提交; offset为-1时写到文件当前位置(O_APPEND时为末尾)
+    // 返回false时errno为失败原因
+    bool write_and_sync(int fd, const char *data, size_t n, bool sync);
+
+    // 探测内核是否支持io_uring, 结果缓存
+    static bool supported();
+
+private:
+    IoUring(const IoUring &);
+    IoUring &operator=(const IoUring &);
+
+private:
+    int _fd;
+    unsigned _features;
+    void *_sq_ring;
+    size_t _sq_ring_size;
+    void *_cq_ring;
+    size_t _cq_ring_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned _cq_mask;
+    struct io_uring_cqe *_cqes;
+
+    // 已取出但还未提交的提交项
+    unsigned _sqe_tail;
+    unsigned _pending;
+};
+
+#endif
+
+// 顺序写一个文件, 写入在后台进行
+// append只把数据拷进缓冲区, 写满一个缓冲区才提交; finish等所有写入完成后fsync并关闭
+// 只能在一个线程里使用
+class AsyncWriter
+{
+public:
+    AsyncWriter();
+    ~AsyncWriter();
+
+    // flags同open(2), direct为true时尝试O_DIRECT; io_mode为这个文件使用的后端, fork出的子进程里应传ASYNC_IO_SYNC
+    bool open(const string &path, int flags, mode_t mode, bool direct, AsyncIoMode io_mode = async_io_mode());
+    bool is_open() const { return _fd >= 0; }
+
+    bool append(const char *data, size_t n);
+
+    // 写完剩余数据, sync为true时fsync, 然后关闭文件; 任何一次写入失败都返回false
+    bool finish(bool sync);
+
+    // 等待进行中的写入后关闭文件, 不保证数据完整, 用于出错后放弃
+    void abort();
+
+    // 已经append的字节数
+    uint64_t size() const { return _size; }
+    int error() const { return _error.load(); }
+    const char *backend() const;
+
+private:
+    AsyncWriter(const AsyncWriter &);
+    AsyncWriter &operator=(const AsyncWriter &);
+
+    bool setup_buffers();
+    bool submit(int buf, size_t len);
+    int acquire();
+    void complete(int buf, int res);
+    bool drain();
+    void fail(int err);
+    void release();
+    void pool_loop();
+
+private:
+    struct Task
+    {
+        int buf;
+        size_t len;
+        uint64_t offset;
+    };
+
+    int _fd;
+    AsyncIoMode _mode;
+    bool _direct;
+    vector<char *> _bufs;
+    vector<Task> _inflight; // 按缓冲区下标记录进行中的写入
+    vector<int> _free;
+    int _cur;
+    size_t _cur_len;
+    uint64_t _offset; // 下一个缓冲区写入的位置
+    uint64_t _size;
+    atomic<int> _error; // 第一次失败的errno, 线程池中的线程也会设置
+
+#if SKIPLIST_IO_URING
+    IoUring _ring;
+    bool _fixed; // 缓冲区已注册
+#endif
+    int _busy;   // 进行中的写入数
+
+    // pwrite线程池, _mtx保护 _tasks, _free 和 _busy
+    mutex _mtx;
+    condition_variable _work_cv;
+    condition_variable _done_cv;
+    deque<Task> _tasks;
+    vector<thread> _threads;
+    bool _stop;
+};
+
+/*---------------------------------------------------------------------------------*/
+
+#if SKIPLIST_IO_URING
+
+inline IoUring::IoUring()
+    : _fd(-1), _features(0), _sq_ring(MAP_FAILED), _sq_ring_size(0), _cq_ring(MAP_FAILED), _cq_ring_size(0),
+      _sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)), _sqes_size(0), _sqe_tail(0), _pending(0) {}
+
+inline IoUring::~IoUring()
+{
+    if (_sqes != MAP_FAILED)
+    {
+        munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+    {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring != MAP_FAILED)
+    {
+        munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+inline bool IoUring::init(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0)
+    {
+        return false;
+    }
+    _fd = fd;
+    _features = p.features;
+
+    // 5.4之后的内核提交队列和完成队列可以用一次mmap映射
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && _cq_ring_size > _sq_ring_size)
+    {
+        _sq_ring_size = _cq_ring_size;
+    }
+    _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    _cq_ring = single ? _sq_ring
+                      : mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = static_cast<struct io_uring_sqe *>(
+        mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (_sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    char *sq = static_cast<char *>(_sq_ring);
+    _sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    _sq_entries = p.sq_entries;
+    _sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    char *cq = static_cast<char *>(_cq_ring);
+    _cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    _sqe_tail = *_sq_tail;
+    return true;
+}
+
+inline bool IoUring::register_buffers(const struct iovec *iov, unsigned n)
+{
+    return syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, iov, n) == 0;
+}
+
+inline struct io_uring_sqe *IoUring::get_sqe()
+{
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (_sqe_tail - head >= _sq_entries)
+    {
+        return NULL;
+    }
+    unsigned index = _sqe_tail & _sq_mask;
+    _sq_array[index] = index;
+    _sqe_tail++;
+    _pending++;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+inline int IoUring::submit(unsigned wait_nr)
+{
+    // 提交项的内容要先于tail对内核可见
+    __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true)
+    {
+        long r = syscall(__NR_io_uring_enter, _fd, _pending, wait_nr, flags, NULL, 0);
+        if (r >= 0)
+        {
+            _pending -= static_cast<unsigned>(r);
+            return static_cast<int>(r);
+        }
+        if (errno != EINTR)
+        {
+            return -errno;
+        }
+    }
+}
+
+inline bool IoUring::pop_cqe(uint64_t *user_data, int *res)
+{
+    unsigned head = *_cq_head;
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    const struct io_uring_cqe &cqe = _cqes[head & _cq_mask];
+    *user_data = cqe.user_data;
+    *res = cqe.res;
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+inline bool IoUring::write_and_sync(int fd, const char *data, size_t n, bool sync)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    struct io_uring_sqe *fsqe = sync ? get_sqe() : NULL;
+    if (sqe == NULL || (sync && fsqe == NULL))
+    {
+        errno = EBUSY;
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(n);
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = 0;
+    if (sync)
+    {
+        // 写入失败或不完整时链上的fsync被取消, 返回-ECANCELED
+        sqe->flags = IOSQE_IO_LINK;
+        fsqe->opcode = IORING_OP_FSYNC;
+        fsqe->fd = fd;
+        fsqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        fsqe->user_data = 1;
+    }
+    unsigned expect = sync ? 2 : 1;
+    int r = submit(expect);
+    if (r < 0)
+    {
+        errno = -r;
+        return false;
+    }
+
+    int write_res = 0, sync_res = 0;
+    for (unsigned got = 0; got < expect;)
+    {
+        uint64_t which;
+        int res;
+        if (!pop_cqe(&which, &res))
+        {
+            if ((r = submit(expect - got)) < 0)
+            {
+                errno = -r;
+                return false;
+            }
+            continue;
+        }
+        (which == 0 ? write_res : sync_res) = res;
+        got++;
+    }
+    if (write_res < 0)
+    {
+        errno = -write_res;
+        return false;
+    }
+    // 写入不完整时剩下的部分同步补上
+    if (static_cast<size_t>(write_res) < n)
+    {
+        const char *p = data + write_res;
+        size_t left = n - write_res;
+        while (left > 0)
+        {
+            ssize_t w = write(fd, p, left);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0)
+                return false;
+            p += w;
+            left -= w;
+        }
+        return !sync || fdatasync(fd) == 0;
+    }
+    if (sync_res < 0)
+    {
+        errno = -sync_res;
+        return false;
+    }
+    return true;
+}
+
+inline bool IoUring::supported()
+{
+    static const bool ok = []() {
+        IoUring ring;
+        return ring.init(2);
+    }();
+    return ok;
+}
+
+#endif
+
+/*---------------------------------------------------------------------------------*/
+
+inline AsyncWriter::AsyncWriter()
+    : _fd(-1), _mode(ASYNC_IO_SYNC), _direct(false), _cur(-1), _cur_len(0), _offset(0), _size(0), _error(0),
+#if SKIPLIST_IO_URING
+      _fixed(false),
+#endif
+      _busy(0), _stop(false) {}
+
+inline AsyncWriter::~AsyncWriter()
+{
+    abort();
+}
+
+inline bool AsyncWriter::open(const string &path, int flags, mode_t mode, bool direct, AsyncIoMode io_mode)
+{
+    _fd = -1;
+    if (direct)
+    {
+        _fd = ::open(path.c_str(), flags | O_DIRECT, mode);
+    }
+    _direct = _fd >= 0;
+    if (_fd < 0)
+    {
+        _fd = ::open(path.c_str(), flags, mode);
+    }
+    if (_fd < 0)
+    {
+        _error = errno;
+        return false;
+    }
+
+    _mode = io_mode;
+#if SKIPLIST_IO_URING
+    if (_mode == ASYNC_IO_AUTO && !_ring.init(ASYNC_IO_BUFFER_COUNT))
+    {
+        _mode = ASYNC_IO_POOL;
+    }
+#else
+    if (_mode == ASYNC_IO_AUTO)
+    {
+        _mode = ASYNC_IO_POOL;
+    }
+#endif
+    if (!setup_buffers())
+    {
+        _error = ENOMEM;
+        abort();
+        return false;
+    }
+    if (_mode == ASYNC_IO_POOL)
+    {
+        for (int i = 0; i < ASYNC_IO_POOL_THREADS; i++)
+        {
+            _threads.push_back(thread(&AsyncWriter::pool_loop, this));
+        }
+    }
+    return true;
+}
+
+inline bool AsyncWriter::setup_buffers()
+{
+    int count = _mode == ASYNC_IO_SYNC ? 1 : ASYNC_IO_BUFFER_COUNT;
+    vector<struct iovec> iov;
+    for (int i = 0; i < count; i++)
+    {
+        void *p = NULL;
+        if (posix_memalign(&p, ASYNC_IO_ALIGN, ASYNC_IO_BUFFER_SIZE) != 0)
+        {
+            return false;
+        }
+        _bufs.push_back(static_cast<char *>(p));
+        _free.push_back(i);
+        struct iovec v;
+        v.iov_base = p;
+        v.iov_len = ASYNC_IO_BUFFER_SIZE;
+        iov.push_back(v);
+    }
+    _inflight.resize(count);
+#if SKIPLIST_IO_URING
+    // 注册会锁住这些页, 超过 RLIMIT_MEMLOCK 时注册失败, 改用普通的IORING_OP_WRITE
+    if (_mode == ASYNC_IO_AUTO)
+    {
+        _fixed = _ring.register_buffers(&iov[0], count);
+    }
+#endif
+    _cur = _free.back();
+    _free.pop_back();
+    return true;
+}
+
+inline const char *AsyncWriter::backend() const
+{
+    switch (_mode)
+    {
+    case ASYNC_IO_AUTO:
+        return "io_uring";
+    case ASYNC_IO_POOL:
+        return "pwrite_pool";
+    default:
+        return "sync";
+    }
+}
+
+inline bool AsyncWriter::append(const char *data, size_t n)
+{
+    while (n > 0 && _error == 0)
+    {
+        size_t m = ASYNC_IO_BUFFER_SIZE - _cur_len;
+        if (m > n)
+        {
+            m = n;
+        }
+        memcpy(_bufs[_cur] + _cur_len, data, m);
+        _cur_len += m;
+        _size += m;
+        data += m;
+        n -= m;
+        if (_cur_len == ASYNC_IO_BUFFER_SIZE)
+        {
+            submit(_cur, _cur_len);
+            _cur = acquire();
+            _cur_len = 0;
+        }
+    }
+    return _error == 0;
+}
+
+// 把缓冲区buf的前len字节写到 _offset 处, 提交后buf归写入方所有, 写完后回到空闲列表
+inline bool AsyncWriter::submit(int buf, size_t len)
+{
+    Task task;
+    task.buf = buf;
+    task.len = len;
+    task.offset = _offset;
+    _offset += len;
+
+    if (_mode == ASYNC_IO_SYNC)
+    {
+        if (!pwrite_all(_fd, _bufs[buf], len, task.offset))
+        {
+            fail(errno);
+        }
+        _free.push_back(buf);
+        return _error == 0;
+    }
+    if (_mode == ASYNC_IO_POOL)
+    {
+        lock_guard<mutex> lock(_mtx);
+        _tasks.push_back(task);
+        _busy++;
+        _work_cv.notify_one();
+        return _error == 0;
+    }
+#if SKIPLIST_IO_URING
+    _inflight[buf] = task;
+    struct io_uring_sqe *sqe = _ring.get_sqe();
+    // 进行中的写入不超过缓冲区个数, 也就不超过队列长度
+    sqe->opcode = _fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = _fd;
+    sqe->addr = reinterpret_cast<uint64_t>(_bufs[buf]);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->off = task.offset;
+    sqe->buf_index = _fixed ? static_cast<uint16_t>(buf) : 0;
+    sqe->user_data = static_cast<uint64_t>(buf);
+    _busy++;
+    // 这里提交失败的请求还留在队列里, 等待完成时会再次提交
+    _ring.submit(0);
+#endif
+    return _error == 0;
+}
+
+// 处理一个io_uring完成项
+inline void AsyncWriter::complete(int buf, int res)
+{
+    const Task &task = _inflight[buf];
+    _busy--;
+    if (res == -EINVAL && _direct)
+    {
+        // 对齐不满足设备要求, pwrite_all会去掉O_DIRECT后重写
+        res = 0;
+    }
+    if (res < 0)
+    {
+        fail(-res);
+    }
+    else if (static_cast<size_t>(res) < task.len &&
+             !pwrite_all(_fd, _bufs[buf] + res, task.len - res, task.offset + res))
+    {
+        fail(errno);
+    }
+    _free.push_back(buf);
+}
+
+// 取一个空闲缓冲区, 都在写时等待其中一个完成
+inline int AsyncWriter::acquire()
+{
+    if (_mode == ASYNC_IO_POOL)
+    {
+        unique_lock<mutex> lock(_mtx);
+        while (_free.empty())
+        {
+            _done_cv.wait(lock);
+        }
+        int buf = _free.back();
+        _free.pop_back();
+        return buf;
+    }
+#if SKIPLIST_IO_URING
+    while (_free.empty() && _mode == ASYNC_IO_AUTO)
+    {
+        uint64_t buf;
+        int res;
+        if (_ring.pop_cqe(&buf, &res))
+        {
+            complete(static_cast<int>(buf), res);
+            continue;
+        }
+        int r = _ring.submit(1);
+        if (r < 0)
+        {
+            // 无法等待完成项时没法知道内核何时用完缓冲区, 只能放弃
+            LOG_ERROR("io_uring_enter失败, errno: " << -r);
+            fail(-r);
+            return -1;
+        }
+    }
+#endif
+    int buf = _free.back();
+    _free.pop_back();
+    return buf;
+}
+
+// 等待所有进行中的写入完成
+inline bool AsyncWriter::drain()
+{
+    if (_mode == ASYNC_IO_POOL)
+    {
+        unique_lock<mutex> lock(_mtx);
+        while (_busy > 0)
+        {
+            _done_cv.wait(lock);
+        }
+        return _error == 0;
+    }
+#if SKIPLIST_IO_URING
+    while (_busy > 0 && _mode == ASYNC_IO_AUTO)
+    {
+        uint64_t buf;
+        int res;
+        if (_ring.pop_cqe(&buf, &res))
+        {
+            complete(static_cast<int>(buf), res);
+            continue;
+        }
+        int r = _ring.submit(1);
+        if (r < 0)
+        {
+            LOG_ERROR("io_uring_enter失败, errno: " << -r);
+            fail(-r);
+            return false;
+        }
+    }
+#endif
+    return _error == 0;
+}
+
+inline bool AsyncWriter::finish(bool sync)
+{
+    if (_fd < 0)
+    {
+        return false;
+    }
+    if (_cur_len > 0 && _error == 0)
+    {
+        size_t len = _cur_len;
+        if (_direct)
+        {
+            // 补零到对齐长度, 多出的部分最后被截掉
+            len = (len + ASYNC_IO_ALIGN - 1) / ASYNC_IO_ALIGN * ASYNC_IO_ALIGN;
+            memset(_bufs[_cur] + _cur_len, 0, len - _cur_len);
+        }
+        submit(_cur, len);
+        _cur = -1;
+        _cur_len = 0;
+    }
+    if (drain() && _direct && ftruncate(_fd, _size) != 0)
+    {
+        fail(errno);
+    }
+    if (_error == 0 && sync && fsync(_fd) != 0)
+    {
+        fail(errno);
+    }
+    abort();
+    errno = _error;
+    return _error == 0;
+}
+
+inline void AsyncWriter::abort()
+{
+    if (_fd >= 0)
+    {
+        // 内核或线程池还在使用缓冲区, 必须等它们写完才能释放
+        drain();
+        if (!_threads.empty())
+        {
+            {
+                lock_guard<mutex> lock(_mtx);
+                _stop = true;
+            }
+            _work_cv.notify_all();
+            for (size_t i = 0; i < _threads.size(); i++)
+            {
+                _threads[i].join();
+            }
+            _threads.clear();
+        }
+        close(_fd);
+        _fd = -1;
+    }
+    release();
+}
+
+inline void AsyncWriter::release()
+{
+    for (size_t i = 0; i < _bufs.size(); i++)
+    {
+        free(_bufs[i]);
+    }
+    _bufs.clear();
+    _free.clear();
+    _inflight.clear();
+    _cur = -1;
+}
+
+// 只记录第一次失败的原因
+inline void AsyncWriter::fail(int err)
+{
+    int expected = 0;
+    _error.compare_exchange_strong(expected, err != 0 ? err : EIO);
+}
+
+// 线程池中的线程: 取出写入任务执行, 完成后归还缓冲区
+inline void AsyncWriter::pool_loop()
+{
+    unique_lock<mutex> lock(_mtx);
+    while (true)
+    {
+        while (_tasks.empty() && !_stop)
+        {
+            _work_cv.wait(lock);
+        }
+        if (_tasks.empty())
+        {
+            break;
+        }
+        Task task = _tasks.front();
+        _tasks.pop_front();
+        lock.unlock();
+        bool ok = pwrite_all(_fd, _bufs[task.buf], task.len, task.offset);
+        int err = errno;
+        if (!ok)
+        {
+            fail(err);
+        }
+        lock.lock();
+        _free.push_back(task.buf);
+        _busy--;
+        _done_cv.notify_all();
+    }
+}
+
+// 按当前的模式, 之后打开的文件会使用的后端
+inline const char *async_io_backend()
+{
+    AsyncIoMode mode = async_io_mode();
+#if SKIPLIST_IO_URING
+    if (mode == ASYNC_IO_AUTO && IoUring::supported())
+    {
+        return "io_uring";
+    }
+#endif
+    return mode == ASYNC_IO_SYNC ? "sync" : "pwrite_pool";
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CODING_H
+#define CODING_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <memory>
+using namespace std;
+
+class MappedFile;
+
+// 持久化用到的编码工具: 定长整数的小端编码, CRC32C校验, 以及key/value的二进制编解码
+
+inline void put_fixed32(string *dst, uint32_t value)
+{
+    char buf[4];
+    for (int i = 0; i < 4; i++)
+    {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst->append(buf, 4);
+}
+
+inline void put_fixed64(string *dst, uint64_t value)
+{
+    char buf[8];
+    for (int i = 0; i < 8; i++)
+    {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst->append(buf, 8);
+}
+
+inline uint32_t decode_fixed32(const char *ptr)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(ptr);
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t decode_fixed64(const char *ptr)
+{
+    return (uint64_t)decode_fixed32(ptr) | ((uint64_t)decode_fixed32(ptr + 4) << 32);
+}
+
+// CRC32C(Castagnoli多项式), 查表法计算
+inline uint32_t crc32c_extend(uint32_t crc, const char *data, size_t n)
+{
+    struct Table
+    {
+        uint32_t t[256];
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? (c >> 1) ^ 0x82f63b78u : (c >> 1);
+                }
+                t[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+    {
+        crc = table.t[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline uint32_t crc32c(const char *data, size_t n)
+{
+    return crc32c_extend(0, data, n);
+}
+
+// key/value的二进制编解码, encode把值追加到dst末尾, decode从[data, data + n)还原出值
+// 默认支持算术类型和string, 其他类型需要自行特化Codec
+template <typename T, typename Enable = void>
+struct Codec;
+
+template <typename T>
+struct Codec<T, typename enable_if<is_arithmetic<T>::value>::type>
+{
+    static void encode(const T &value, string *dst)
+    {
+        dst->append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    static bool decode(const char *data, size_t n, T *value)
+    {
+        if (n != sizeof(T))
+        {
+            return false;
+        }
+        memcpy(value, data, sizeof(T));
+        return true;
+    }
+};
+
+template <>
+struct Codec<string>
+{
+    static void encode(const string &value, string *dst)
+    {
+        dst->append(value);
+    }
+
+    static bool decode(const char *data, size_t n, string *value)
+    {
+        value->assign(data, n);
+        return true;
+    }
+};
+
+// 从mmap映射的快照中解码, 默认与 Codec<T>::decode 相同(拷贝数据)
+// 支持零拷贝的类型(如 CowString)重载该函数, 直接引用映射区域并持有owner
+template <typename T>
+bool decode_mapped(const char *data, size_t n, const shared_ptr<MappedFile> &owner, T *value)
+{
+    (void)owner;
+    return Codec<T>::decode(data, n, value);
+}
+
+// 用编解码器C解码快照中的数据: C为默认的 Codec<T> 时走 decode_mapped, 可以零拷贝; 自定义的C直接调用它的decode
+template <typename C, typename T>
+bool decode_with(const char *data, size_t n, const shared_ptr<MappedFile> &owner, T *value, true_type)
+{
+    return decode_mapped(data, n, owner, value);
+}
+
+template <typename C, typename T>
+bool decode_with(const char *data, size_t n, const shared_ptr<MappedFile> &owner, T *value, false_type)
+{
+    (void)owner;
+    return C::decode(data, n, value);
+}
+
+template <typename C, typename T>
+bool decode_with(const char *data, size_t n, const shared_ptr<MappedFile> &owner, T *value)
+{
+    return decode_with<C>(data, n, owner, value, typename is_same<C, Codec<T>>::type());
+}
+
+#endif
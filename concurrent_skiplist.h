@@ -0,0 +1,424 @@
+#ifndef CONCURRENT_SKIPLIST_H
+#define CONCURRENT_SKIPLIST_H
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "epoch.h"
+#include "random_level.h"
+using namespace std;
+
+// 无锁并发跳表, 参考 Fraser / Herlihy-Shavit 的 lock-free skiplist
+// 与 SkipList 不同, 这里没有全局锁:
+// 1. 每一层的 next 指针都是原子变量, 插入/删除通过 CAS 修改
+// 2. 删除分两步: 先在 next 指针的最低位打上删除标记(逻辑删除), 再由 find() 把节点从各层摘除(物理删除)
+// 3. 读操作不加锁也不会被阻塞, 遇到打了标记的节点直接跳过
+// 4. 被摘除的节点和被覆盖的旧value交给 EpochDomain 延迟释放, 保证没有读者还持有它们时才 delete
+// 过期时间和LRU依赖全局锁维护, 并发跳表不提供这两个功能
+
+/*---------------------------------------------------------------------------------*/
+
+// 并发跳表中的节点类
+template <typename K, typename V>
+class ConcurrentNode
+{
+
+public:
+    // 接管v的所有权, v由调用者用new分配
+    ConcurrentNode(const K &k, V *v, int);
+
+    ~ConcurrentNode();
+
+    const K &get_key() const;
+
+    // 需要在 EpochGuard 保护的范围内调用, 返回的引用在离开临界区之前有效
+    const V &get_value() const;
+
+    K key;
+
+    // value 以指针形式存放, 更新时整体替换, 旧值延迟释放
+    atomic<V *> value;
+
+    int node_level;
+
+    // 所有层都已链入后置为true, 删除操作要等节点完全链入后才能进行
+    atomic<bool> fully_linked;
+
+    // next[i] 的最低位是删除标记, 其余位是第i层下一个节点的地址
+    atomic<uintptr_t> *next;
+};
+
+template <typename K, typename V>
+ConcurrentNode<K, V>::ConcurrentNode(const K &k, V *v, int level)
+    : key(k), value(v), node_level(level), fully_linked(false)
+{
+    this->next = new atomic<uintptr_t>[level + 1];
+    for (int i = 0; i <= level; i++)
+    {
+        this->next[i].store(0, memory_order_relaxed);
+    }
+}
+
+template <typename K, typename V>
+ConcurrentNode<K, V>::~ConcurrentNode()
+{
+    delete value.load(memory_order_relaxed);
+    delete[] next;
+}
+
+template <typename K, typename V>
+const K &ConcurrentNode<K, V>::get_key() const
+{
+    return key;
+}
+
+template <typename K, typename V>
+const V &ConcurrentNode<K, V>::get_value() const
+{
+    return *value.load(memory_order_acquire);
+}
+
+/*---------------------------------------------------------------------------------*/
+
+// 并发跳表类, 接口与 SkipList 保持一致
+template <typename K, typename V>
+class ConcurrentSkipList
+{
+
+public:
+    ConcurrentSkipList(int);
+    ~ConcurrentSkipList();
+    int get_random_level();
+    // 同 SkipList::set_branching, 要在插入数据前设置
+    void set_branching(Branching branching) { _branching = branching; }
+    Branching get_branching() const { return _branching; }
+    // 传入右值的value直接移动进节点, 不拷贝
+    int insert_element(const K &, const V &);
+    int insert_element(const K &, V &&);
+    bool search_element(const K &, V *valptr = nullptr);
+    bool delete_element(const K &);
+    void display_list();
+    int size();
+
+private:
+    typedef ConcurrentNode<K, V> NodeType;
+
+    static NodeType *get_ptr(uintptr_t p) { return reinterpret_cast<NodeType *>(p & ~uintptr_t(1)); }
+    static bool is_marked(uintptr_t p) { return (p & 1) != 0; }
+
+    bool find(const K &key, NodeType **preds, NodeType **succs);
+    int insert_value(const K &key, V *value);
+    static void free_node(void *p);
+    static void free_value(void *p);
+
+private:
+    // 跳表的最大层数
+    int _max_level;
+
+    // 新节点升高一层的概率
+    Branching _branching;
+
+    // 跳表当前最高的有效层, 只作为读操作的起始层提示
+    atomic<int> _skip_list_level;
+
+    // 跳表头节点指针
+    NodeType *_header;
+
+    // 跳表当前元素个数
+    atomic<int> _element_count;
+};
+
+// 从最高层开始定位key, preds[i]/succs[i]为第i层中key应处位置的前驱和后继
+// 途中遇到打了删除标记的节点就顺手把它从该层摘除, 摘除失败说明前驱已变化, 从头重试
+// 返回第0层是否存在该key
+template <typename K, typename V>
+bool ConcurrentSkipList<K, V>::find(const K &key, NodeType **preds, NodeType **succs)
+{
+retry:
+    NodeType *pred = _header;
+    for (int i = _max_level; i >= 0; i--)
+    {
+        NodeType *curr = get_ptr(pred->next[i].load(memory_order_acquire));
+        while (curr != NULL)
+        {
+            uintptr_t succ = curr->next[i].load(memory_order_acquire);
+            while (is_marked(succ))
+            {
+                uintptr_t expected = reinterpret_cast<uintptr_t>(curr);
+                if (!pred->next[i].compare_exchange_strong(expected, succ & ~uintptr_t(1),
+                                                           memory_order_acq_rel))
+                {
+                    goto retry;
+                }
+                curr = get_ptr(succ);
+                if (curr == NULL)
+                {
+                    break;
+                }
+                succ = curr->next[i].load(memory_order_acquire);
+            }
+            if (curr != NULL && curr->key < key)
+            {
+                pred = curr;
+                curr = get_ptr(succ);
+            }
+            else
+            {
+                break;
+            }
+        }
+        preds[i] = pred;
+        succs[i] = curr;
+    }
+    return succs[0] != NULL && succs[0]->key == key;
+}
+
+// 插入元素, 返回1代表元素已存在(更新其值), 返回0代表插入成功
+template <typename K, typename V>
+int ConcurrentSkipList<K, V>::insert_element(const K &key, const V &value)
+{
+    return insert_value(key, new V(value));
+}
+
+template <typename K, typename V>
+int ConcurrentSkipList<K, V>::insert_element(const K &key, V &&value)
+{
+    return insert_value(key, new V(std::move(value)));
+}
+
+// value只在这里构造一次, 重试时不再拷贝; 最终放进新节点或者替换已有节点的value
+template <typename K, typename V>
+int ConcurrentSkipList<K, V>::insert_value(const K &key, V *value)
+{
+    EpochGuard guard;
+
+    NodeType *preds[_max_level + 1];
+    NodeType *succs[_max_level + 1];
+    int random_level = get_random_level();
+    NodeType *inserted_node = NULL;
+
+    while (true)
+    {
+        if (find(key, preds, succs))
+        {
+            // key已存在, 整体替换value, 旧值可能正被读者拷贝, 延迟释放
+            V *old = succs[0]->value.exchange(value, memory_order_acq_rel);
+            EpochDomain::instance().retire(old, free_value);
+            if (inserted_node != NULL)
+            {
+                // 还未发布, 可以直接释放, value已经交给了已有的节点
+                inserted_node->value.store(NULL, memory_order_relaxed);
+                delete inserted_node;
+            }
+            return 1;
+        }
+
+        if (inserted_node == NULL)
+        {
+            inserted_node = new NodeType(key, value, random_level);
+        }
+        for (int i = 0; i <= random_level; i++)
+        {
+            inserted_node->next[i].store(reinterpret_cast<uintptr_t>(succs[i]), memory_order_relaxed);
+        }
+
+        // 第0层链入成功即视为插入完成
+        uintptr_t expected = reinterpret_cast<uintptr_t>(succs[0]);
+        if (preds[0]->next[0].compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(inserted_node),
+                                                      memory_order_release, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    // 逐层链入索引, 前驱变化时重新定位
+    // 删除操作会等待 fully_linked, 所以这期间节点不会被打上删除标记
+    for (int i = 1; i <= random_level; i++)
+    {
+        while (true)
+        {
+            inserted_node->next[i].store(reinterpret_cast<uintptr_t>(succs[i]), memory_order_relaxed);
+            uintptr_t expected = reinterpret_cast<uintptr_t>(succs[i]);
+            if (preds[i]->next[i].compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(inserted_node),
+                                                          memory_order_release, memory_order_relaxed))
+            {
+                break;
+            }
+            find(key, preds, succs);
+        }
+    }
+    inserted_node->fully_linked.store(true, memory_order_release);
+
+    int level = _skip_list_level.load(memory_order_relaxed);
+    while (random_level > level &&
+           !_skip_list_level.compare_exchange_weak(level, random_level, memory_order_relaxed))
+    {
+    }
+
+    _element_count.fetch_add(1, memory_order_relaxed);
+    return 0;
+}
+
+// 查找元素, 不加锁也不修改跳表, 跳过打了删除标记的节点
+template <typename K, typename V>
+bool ConcurrentSkipList<K, V>::search_element(const K &key, V *valptr)
+{
+    EpochGuard guard;
+
+    NodeType *pred = _header;
+    NodeType *curr = NULL;
+    for (int i = _skip_list_level.load(memory_order_relaxed); i >= 0; i--)
+    {
+        curr = get_ptr(pred->next[i].load(memory_order_acquire));
+        while (curr != NULL)
+        {
+            uintptr_t succ = curr->next[i].load(memory_order_acquire);
+            if (is_marked(succ))
+            {
+                curr = get_ptr(succ);
+                continue;
+            }
+            if (curr->key < key)
+            {
+                pred = curr;
+                curr = get_ptr(succ);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    if (curr != NULL && curr->key == key)
+    {
+        if (valptr != nullptr)
+        {
+            *valptr = curr->get_value();
+        }
+        return true;
+    }
+    return false;
+}
+
+// 删除元素, 成功删除返回true, key不存在或被其他线程抢先删除返回false
+template <typename K, typename V>
+bool ConcurrentSkipList<K, V>::delete_element(const K &key)
+{
+    EpochGuard guard;
+
+    NodeType *preds[_max_level + 1];
+    NodeType *succs[_max_level + 1];
+    if (!find(key, preds, succs))
+    {
+        return false;
+    }
+
+    NodeType *victim = succs[0];
+    while (!victim->fully_linked.load(memory_order_acquire))
+    {
+        this_thread::yield();
+    }
+
+    // 从高层到第1层打删除标记, 阻止其他线程在这些层往它后面链入节点
+    for (int i = victim->node_level; i >= 1; i--)
+    {
+        victim->next[i].fetch_or(1, memory_order_acq_rel);
+    }
+
+    // 第0层的标记决定由哪个线程完成删除
+    uintptr_t succ = victim->next[0].load(memory_order_acquire);
+    while (true)
+    {
+        if (is_marked(succ))
+        {
+            return false;
+        }
+        if (victim->next[0].compare_exchange_weak(succ, succ | 1, memory_order_acq_rel))
+        {
+            break;
+        }
+    }
+
+    // 物理摘除, find() 返回后节点已不在任何一层上
+    find(key, preds, succs);
+    _element_count.fetch_sub(1, memory_order_relaxed);
+    EpochDomain::instance().retire(victim, free_node);
+    return true;
+}
+
+// 显示跳表, 只在没有并发修改时使用
+template <typename K, typename V>
+void ConcurrentSkipList<K, V>::display_list()
+{
+    EpochGuard guard;
+
+    cout << "-------------------------ConcurrentSkipList----------------------------" << endl;
+    for (int i = 0; i <= _skip_list_level.load(); i++)
+    {
+        NodeType *node = get_ptr(_header->next[i].load());
+        cout << "Level " << i << ": ";
+        while (node != NULL)
+        {
+            cout << node->get_key() << ":" << node->get_value() << ";";
+            node = get_ptr(node->next[i].load());
+        }
+        cout << endl;
+    }
+    cout << "-------------------------ConcurrentSkipList----------------------------" << endl;
+}
+
+template <typename K, typename V>
+int ConcurrentSkipList<K, V>::size()
+{
+    return _element_count.load(memory_order_relaxed);
+}
+
+template <typename K, typename V>
+void ConcurrentSkipList<K, V>::free_node(void *p)
+{
+    delete static_cast<NodeType *>(p);
+}
+
+template <typename K, typename V>
+void ConcurrentSkipList<K, V>::free_value(void *p)
+{
+    delete static_cast<V *>(p);
+}
+
+// 跳表构造函数
+template <typename K, typename V>
+ConcurrentSkipList<K, V>::ConcurrentSkipList(int max_level)
+    : _max_level(max_level), _branching(BRANCHING_HALF), _skip_list_level(0), _element_count(0)
+{
+    K k = K();
+    this->_header = new NodeType(k, new V(), _max_level);
+    this->_header->fully_linked.store(true);
+}
+
+// 跳表析构函数, 调用时不能再有其他线程访问跳表
+template <typename K, typename V>
+ConcurrentSkipList<K, V>::~ConcurrentSkipList()
+{
+    NodeType *node = get_ptr(_header->next[0].load());
+    while (node != NULL)
+    {
+        NodeType *next = get_ptr(node->next[0].load());
+        delete node;
+        node = next;
+    }
+    delete _header;
+}
+
+// 与 SkipList::get_random_level() 相同的分布, 随机数来自每个线程自己的生成器(见 random_level.h)
+template <typename K, typename V>
+int ConcurrentSkipList<K, V>::get_random_level()
+{
+    return random_level(_branching, _max_level);
+}
+
+#endif
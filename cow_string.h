@@ -0,0 +1,149 @@
+#ifndef COW_STRING_H
+#define COW_STRING_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <memory>
+#include <functional>
+#include "coding.h"
+#include "mmap_file.h"
+#include "maxmemory.h"
+#include "string_ref.h"
+using namespace std;
+
+// 写时拷贝的字符串
+// 从mmap加载的快照中解码时, 只记录映射区域中的地址和长度, 并持有映射的引用, 不拷贝数据
+// 需要修改时调用 mutable_str() 才拷贝出私有副本; 拷贝CowString对象只增加映射的引用计数
+// 作为跳表的key或value使用: SkipList<CowString, CowString>, 冷启动时加载快照几乎只有缺页的开销
+class CowString
+{
+public:
+    CowString() : _ptr(NULL), _len(0) {}
+    CowString(const char *s) : _own(s), _ptr(NULL), _len(0) {}
+    CowString(const string &s) : _own(s), _ptr(NULL), _len(0) {}
+
+    // 引用映射区域中的[data, data + n), owner保证引用期间映射不会被解除
+    static CowString from_mapping(const char *data, size_t n, const shared_ptr<MappedFile> &owner);
+
+    const char *data() const { return _owner ? _ptr : _own.data(); }
+    size_t size() const { return _owner ? _len : _own.size(); }
+    bool empty() const { return size() == 0; }
+
+    // 是否仍引用着映射区域
+    bool is_mapped() const { return _owner != nullptr; }
+
+    string str() const { return string(data(), size()); }
+
+    // 作为 StringLess 比较的参数, 或者转为不持有数据的引用
+    operator StringRef() const { return StringRef(data(), size()); }
+
+    // 修改前调用, 如果还引用着映射区域就先拷贝一份私有副本
+    string &mutable_str();
+
+    int compare(const CowString &other) const;
+
+    // 私有副本占用的堆内存
+    size_t owned_heap_usage() const { return ::heap_usage(_own); }
+
+private:
+    string _own;
+    const char *_ptr;
+    size_t _len;
+    shared_ptr<MappedFile> _owner;
+};
+
+inline CowString CowString::from_mapping(const char *data, size_t n, const shared_ptr<MappedFile> &owner)
+{
+    CowString s;
+    s._ptr = data;
+    s._len = n;
+    s._owner = owner;
+    return s;
+}
+
+inline string &CowString::mutable_str()
+{
+    if (_owner)
+    {
+        _own.assign(_ptr, _len);
+        _ptr = NULL;
+        _len = 0;
+        _owner.reset();
+    }
+    return _own;
+}
+
+inline int CowString::compare(const CowString &other) const
+{
+    size_t n = size() < other.size() ? size() : other.size();
+    int r = n == 0 ? 0 : memcmp(data(), other.data(), n);
+    if (r != 0)
+    {
+        return r;
+    }
+    return size() < other.size() ? -1 : (size() > other.size() ? 1 : 0);
+}
+
+inline bool operator<(const CowString &a, const CowString &b) { return a.compare(b) < 0; }
+inline bool operator==(const CowString &a, const CowString &b) { return a.compare(b) == 0; }
+inline bool operator!=(const CowString &a, const CowString &b) { return a.compare(b) != 0; }
+
+inline ostream &operator<<(ostream &os, const CowString &s)
+{
+    return os.write(s.data(), s.size());
+}
+
+inline istream &operator>>(istream &is, CowString &s)
+{
+    return is >> s.mutable_str();
+}
+
+namespace std
+{
+    template <>
+    struct hash<CowString>
+    {
+        size_t operator()(const CowString &s) const
+        {
+            // FNV-1a
+            size_t h = 14695981039346656037ULL;
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(s.data());
+            for (size_t i = 0; i < s.size(); i++)
+            {
+                h = (h ^ p[i]) * 1099511628211ULL;
+            }
+            return h;
+        }
+    };
+}
+
+template <>
+struct Codec<CowString>
+{
+    static void encode(const CowString &value, string *dst)
+    {
+        dst->append(value.data(), value.size());
+    }
+
+    static bool decode(const char *data, size_t n, CowString *value)
+    {
+        *value = CowString(string(data, n));
+        return true;
+    }
+};
+
+// 引用映射区域时数据在文件映射里, 不计入堆内存
+inline size_t heap_usage(const CowString &s)
+{
+    return s.is_mapped() ? 0 : s.owned_heap_usage();
+}
+
+// 从映射区域解码时直接引用, 不拷贝
+inline bool decode_mapped(const char *data, size_t n, const shared_ptr<MappedFile> &owner, CowString *value)
+{
+    *value = CowString::from_mapping(data, n, owner);
+    return true;
+}
+
+#endif
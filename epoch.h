@@ -0,0 +1,254 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "logger.h"
+using namespace std;
+
+// 基于epoch的内存回收(EBR, Epoch-Based Reclamation)
+// 无锁结构里被摘除的节点可能仍被其他线程的读操作引用, 不能立即delete.
+// 做法是: 每个线程访问共享结构前先 enter() 宣告自己观察到的全局epoch,
+// 摘除节点的线程把节点连同当时的全局epoch一起 retire() 到待回收列表,
+// 只有当所有活跃线程都已观察到当前epoch时全局epoch才能前进,
+// 因此全局epoch比节点退休时的epoch大2时, 不可能再有线程持有该节点指针, 可以安全释放.
+
+#define EPOCH_MAX_THREADS 256     // 同时注册的线程数上限
+#define EPOCH_COLLECT_THRESHOLD 64 // 线程本地待回收列表达到该长度时尝试回收
+
+// 待回收的对象
+struct EpochRetired
+{
+    void *ptr;
+    void (*deleter)(void *);
+    uint64_t epoch;
+};
+
+class EpochDomain
+{
+public:
+    // 进程内共享一个epoch域
+    static EpochDomain &instance();
+
+    // 进入/退出临界区, 支持嵌套
+    void enter();
+    void exit();
+
+    // 当前全局epoch
+    uint64_t current() const;
+
+    // 所有活跃线程都已观察到当前epoch时, 把全局epoch加1
+    bool try_advance();
+
+    // 在 retire_epoch 时退休的对象现在是否可以释放
+    bool is_safe(uint64_t retire_epoch) const;
+    // 同上, 按调用者先前读到的全局epoch判断
+    static bool is_safe(uint64_t retire_epoch, uint64_t global) { return retire_epoch + 2 <= global; }
+
+    // 将对象放入当前线程的待回收列表, 由deleter负责释放
+    void retire(void *ptr, void (*deleter)(void *));
+
+    // 释放当前线程(以及已退出线程遗留)的所有可安全释放的对象
+    void collect();
+
+private:
+    EpochDomain();
+    ~EpochDomain();
+
+    // 每个线程占用一个槽位, 独占一个cache line避免伪共享
+    // state 为0表示不在临界区, 否则为 (epoch << 1) | 1
+    struct alignas(64) Slot
+    {
+        atomic<uint64_t> state;
+        atomic<bool> used;
+    };
+
+    // 线程本地记录, 线程退出时归还槽位, 未释放的对象转交给 _orphans
+    struct ThreadRecord
+    {
+        int slot;
+        int nesting;
+        vector<EpochRetired> limbo;
+
+        ThreadRecord() : slot(-1), nesting(0) {}
+        ~ThreadRecord();
+    };
+
+    ThreadRecord &local();
+    static void free_safe(vector<EpochRetired> &items, uint64_t global);
+
+private:
+    atomic<uint64_t> _global_epoch;
+    Slot _slots[EPOCH_MAX_THREADS];
+
+    mutex _orphan_mtx;
+    vector<EpochRetired> _orphans;
+};
+
+// RAII形式的临界区, 构造时进入, 析构时退出
+class EpochGuard
+{
+public:
+    EpochGuard() { EpochDomain::instance().enter(); }
+    ~EpochGuard() { EpochDomain::instance().exit(); }
+
+private:
+    EpochGuard(const EpochGuard &);
+    EpochGuard &operator=(const EpochGuard &);
+};
+
+inline EpochDomain::EpochDomain() : _global_epoch(0)
+{
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+    {
+        _slots[i].state.store(0, memory_order_relaxed);
+        _slots[i].used.store(false, memory_order_relaxed);
+    }
+}
+
+// 进程退出时其他线程都已结束, 遗留的对象可以全部释放
+inline EpochDomain::~EpochDomain()
+{
+    for (size_t i = 0; i < _orphans.size(); i++)
+    {
+        _orphans[i].deleter(_orphans[i].ptr);
+    }
+}
+
+inline EpochDomain &EpochDomain::instance()
+{
+    static EpochDomain domain;
+    return domain;
+}
+
+inline EpochDomain::ThreadRecord::~ThreadRecord()
+{
+    EpochDomain &d = EpochDomain::instance();
+    if (!limbo.empty())
+    {
+        lock_guard<mutex> lock(d._orphan_mtx);
+        d._orphans.insert(d._orphans.end(), limbo.begin(), limbo.end());
+    }
+    if (slot >= 0)
+    {
+        d._slots[slot].state.store(0, memory_order_release);
+        d._slots[slot].used.store(false, memory_order_release);
+    }
+}
+
+inline EpochDomain::ThreadRecord &EpochDomain::local()
+{
+    static thread_local ThreadRecord rec;
+    if (rec.slot < 0)
+    {
+        for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+        {
+            bool expected = false;
+            if (!_slots[i].used.load(memory_order_relaxed) &&
+                _slots[i].used.compare_exchange_strong(expected, true))
+            {
+                rec.slot = i;
+                break;
+            }
+        }
+        if (rec.slot < 0)
+        {
+            LOG_ERROR("EpochDomain: 线程数超过上限 " << EPOCH_MAX_THREADS);
+            Logger::instance().flush();
+            abort();
+        }
+    }
+    return rec;
+}
+
+inline void EpochDomain::enter()
+{
+    ThreadRecord &rec = local();
+    if (rec.nesting++ == 0)
+    {
+        uint64_t e = _global_epoch.load(memory_order_relaxed);
+        _slots[rec.slot].state.store((e << 1) | 1, memory_order_relaxed);
+        // 保证槽位的写入先于后续对共享结构的读取被其他线程看到
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+inline void EpochDomain::exit()
+{
+    ThreadRecord &rec = local();
+    if (--rec.nesting == 0)
+    {
+        _slots[rec.slot].state.store(0, memory_order_release);
+    }
+}
+
+inline uint64_t EpochDomain::current() const
+{
+    return _global_epoch.load(memory_order_acquire);
+}
+
+inline bool EpochDomain::try_advance()
+{
+    uint64_t e = _global_epoch.load(memory_order_seq_cst);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+    {
+        uint64_t s = _slots[i].state.load(memory_order_seq_cst);
+        if ((s & 1) && (s >> 1) != e)
+        {
+            return false;
+        }
+    }
+    return _global_epoch.compare_exchange_strong(e, e + 1);
+}
+
+inline bool EpochDomain::is_safe(uint64_t retire_epoch) const
+{
+    return is_safe(retire_epoch, current());
+}
+
+inline void EpochDomain::retire(void *ptr, void (*deleter)(void *))
+{
+    ThreadRecord &rec = local();
+    EpochRetired r = {ptr, deleter, current()};
+    rec.limbo.push_back(r);
+    if (rec.limbo.size() >= EPOCH_COLLECT_THRESHOLD)
+    {
+        collect();
+    }
+}
+
+inline void EpochDomain::free_safe(vector<EpochRetired> &items, uint64_t global)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (items[i].epoch + 2 <= global)
+        {
+            items[i].deleter(items[i].ptr);
+        }
+        else
+        {
+            items[kept++] = items[i];
+        }
+    }
+    items.resize(kept);
+}
+
+inline void EpochDomain::collect()
+{
+    try_advance();
+    uint64_t global = current();
+    free_safe(local().limbo, global);
+
+    // 已退出线程遗留的对象, 拿不到锁就下次再说
+    unique_lock<mutex> lock(_orphan_mtx, try_to_lock);
+    if (lock.owns_lock() && !_orphans.empty())
+    {
+        free_safe(_orphans, global);
+    }
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef KEY_PREFIX_H
+#define KEY_PREFIX_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <functional>
+#include "string_ref.h"
+#include "cow_string.h"
+using namespace std;
+
+// 字符串key的前8个字节按大端序拼成的整数, 不足8字节的部分补0
+// 按字节比较时, 两个key的前缀不同, 前缀的大小关系就是key的大小关系; 前缀相同(包括一个是另一个补0后的结果)才需要完整比较
+inline uint64_t key_prefix(const char *data, size_t n)
+{
+    unsigned char buf[8] = {0};
+    memcpy(buf, data, n < 8 ? n : 8);
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        prefix = (prefix << 8) | buf[i];
+    }
+    return prefix;
+}
+
+// 不缓存前缀的key类型在节点中的占位, 只占1个字节, 放在节点已有的填充位置里
+struct NoKeyPrefix
+{
+};
+
+inline bool operator!=(const NoKeyPrefix &, const NoKeyPrefix &) { return false; }
+inline bool operator<(const NoKeyPrefix &, const NoKeyPrefix &) { return false; }
+
+// 节点中缓存的key前缀
+// 字符串类型的key缓存前8个字节, 查找时大多数比较只需比较一个整数, 不用再访问key在堆上的数据
+// 其他类型的key直接比较已经足够快, 不缓存
+template <typename K>
+struct KeyPrefix
+{
+    typedef NoKeyPrefix type;
+
+    template <typename Q>
+    static type of(const Q &) { return type(); }
+};
+
+template <>
+struct KeyPrefix<string>
+{
+    typedef uint64_t type;
+
+    // Q 可以是 string, StringRef 等能转为 StringRef 的类型
+    template <typename Q>
+    static type of(const Q &key)
+    {
+        StringRef ref(key);
+        return key_prefix(ref.data(), ref.size());
+    }
+};
+
+template <>
+struct KeyPrefix<CowString> : KeyPrefix<string>
+{
+};
+
+// Compare是否按字节比较K, 只有这时前缀的顺序才与key的顺序一致
+// 自定义的按字节比较的比较器可以特化它来启用前缀
+template <typename K, typename Compare>
+struct BytewiseCompare
+{
+    static const bool value = false;
+};
+
+template <>
+struct BytewiseCompare<string, less<string>>
+{
+    static const bool value = true;
+};
+
+template <>
+struct BytewiseCompare<string, StringLess>
+{
+    static const bool value = true;
+};
+
+template <>
+struct BytewiseCompare<CowString, less<CowString>>
+{
+    static const bool value = true;
+};
+
+template <>
+struct BytewiseCompare<CowString, StringLess>
+{
+    static const bool value = true;
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sstream>
+#include <sys/time.h>
+using namespace std;
+
+// 分级的异步日志
+// 写日志的线程只把格式化好的一行放进无锁环形缓冲区, 由后台线程批量写到输出(默认stderr), 持有_mtx时也不做I/O;
+// 缓冲区满时丢弃新日志并计数, 不阻塞写日志的线程
+// 低于编译期级别 SKIPLIST_LOG_LEVEL 的日志语句整条被预处理掉, 参数也不会求值; 默认为INFO, 插入/删除/过期等每个key一条的日志都是DEBUG
+//
+//   g++ -DSKIPLIST_LOG_LEVEL=0 ...                 // 编译进DEBUG日志
+//   Logger::instance().set_level(LOG_LEVEL_DEBUG);  // 运行时再打开
+//   LOG_INFO("load " << n << " keys");
+//
+// 每行格式: 2026-10-16 12:00:00.123456 INFO [线程号] 内容
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_ERROR = 3,
+    LOG_LEVEL_OFF = 4
+};
+
+#ifndef SKIPLIST_LOG_LEVEL
+#define SKIPLIST_LOG_LEVEL 1
+#endif
+
+// 环形缓冲区的槽数(2的幂)和每条日志的最大长度, 超长的部分截断
+const size_t LOG_RING_SIZE = 1024;
+const size_t LOG_MESSAGE_MAX = 240;
+
+class Logger
+{
+public:
+    static Logger &instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    // 运行时的级别, 只能在编译期级别之上进一步过滤
+    void set_level(LogLevel level) { _level.store(level, memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level >= _level.load(memory_order_relaxed); }
+
+    // 日志输出到哪里, 调用者负责打开和关闭; 切换前先写完已有的日志
+    void set_output(FILE *out)
+    {
+        lock_guard<mutex> guard(_drain_mtx);
+        drain_locked();
+        _out = out;
+    }
+
+    // 放入缓冲区, 不做I/O; fork出的子进程中调用也不会死锁, 只是日志不会被写出
+    void log(LogLevel level, const string &message);
+
+    // 写出缓冲区中已有的日志, 返回写出的条数
+    size_t flush()
+    {
+        lock_guard<mutex> guard(_drain_mtx);
+        return drain_locked();
+    }
+
+    uint64_t dropped() const { return _dropped.load(memory_order_relaxed); }
+
+    // 进程退出时静态对象析构, 之后的日志直接同步写到stderr
+    // 用函数内的静态变量而不是静态成员: C++11没有inline变量, 头文件里定义静态数据成员会重复定义; bool没有析构函数, 析构后仍然可读
+    static bool &destroyed()
+    {
+        static bool flag = false;
+        return flag;
+    }
+
+private:
+    struct Slot
+    {
+        atomic<size_t> seq;
+        LogLevel level;
+        uint32_t thread;
+        int64_t time_us;
+        uint32_t length;
+        char text[LOG_MESSAGE_MAX];
+    };
+
+    Logger();
+    ~Logger();
+    Logger(const Logger &);
+    Logger &operator=(const Logger &);
+
+    void drain_loop();
+    size_t drain_locked();
+    static void write_line(FILE *, LogLevel, uint32_t, int64_t, const char *, size_t);
+    static uint32_t thread_number();
+
+    Slot _slots[LOG_RING_SIZE];
+    // 生产者之间用CAS竞争 _enqueue_pos, 各自独占一条cache line, 避免和消费者互相干扰
+    alignas(64) atomic<size_t> _enqueue_pos;
+    alignas(64) size_t _dequeue_pos;
+    atomic<int> _level;
+    atomic<uint64_t> _dropped;
+    uint64_t _reported_dropped;
+    FILE *_out;
+
+    // 只有消费者(后台线程和flush)需要这把锁, 写日志的线程不碰它
+    mutex _drain_mtx;
+    mutex _wait_mtx;
+    condition_variable _wait_cv;
+    bool _stop;
+    thread _thread;
+};
+
+inline const char *log_level_name(LogLevel level)
+{
+    static const char *names[] = {"DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+    return names[level];
+}
+
+// 写日志的入口, 级别低于运行时级别时不格式化
+#define SKIPLIST_LOG(level, msg)                              \
+    do                                                        \
+    {                                                         \
+        if (Logger::instance().enabled(level))                \
+        {                                                     \
+            ostringstream log_stream_;                        \
+            log_stream_ << msg;                               \
+            Logger::instance().log(level, log_stream_.str()); \
+        }                                                     \
+    } while (0)
+
+#define LOG_NOTHING() \
+    do                \
+    {                 \
+    } while (0)
+
+#if SKIPLIST_LOG_LEVEL <= 0
+#define LOG_DEBUG(msg) SKIPLIST_LOG(LOG_LEVEL_DEBUG, msg)
+#else
+#define LOG_DEBUG(msg) LOG_NOTHING()
+#endif
+
+#if SKIPLIST_LOG_LEVEL <= 1
+#define LOG_INFO(msg) SKIPLIST_LOG(LOG_LEVEL_INFO, msg)
+#else
+#define LOG_INFO(msg) LOG_NOTHING()
+#endif
+
+#if SKIPLIST_LOG_LEVEL <= 2
+#define LOG_WARN(msg) SKIPLIST_LOG(LOG_LEVEL_WARN, msg)
+#else
+#define LOG_WARN(msg) LOG_NOTHING()
+#endif
+
+#if SKIPLIST_LOG_LEVEL <= 3
+#define LOG_ERROR(msg) SKIPLIST_LOG(LOG_LEVEL_ERROR, msg)
+#else
+#define LOG_ERROR(msg) LOG_NOTHING()
+#endif
+
+inline Logger::Logger()
+    : _enqueue_pos(0), _dequeue_pos(0), _level(SKIPLIST_LOG_LEVEL), _dropped(0), _reported_dropped(0), _out(stderr), _stop(false)
+{
+    for (size_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+        _slots[i].seq.store(i, memory_order_relaxed);
+    }
+    _thread = thread(&Logger::drain_loop, this);
+}
+
+inline Logger::~Logger()
+{
+    {
+        lock_guard<mutex> guard(_wait_mtx);
+        _stop = true;
+    }
+    _wait_cv.notify_one();
+    _thread.join();
+    flush();
+    destroyed() = true;
+}
+
+// 有界的多生产者队列(Vyukov): 每个槽的seq等于位置时可以写, 等于位置+1时可以读
+// 生产者CAS抢到一个位置后独占对应的槽, 写完把seq加1发布给消费者
+inline void Logger::log(LogLevel level, const string &message)
+{
+    if (destroyed())
+    {
+        write_line(stderr, level, thread_number(), 0, message.data(), message.size());
+        return;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    size_t pos = _enqueue_pos.load(memory_order_relaxed);
+    Slot *slot;
+    while (true)
+    {
+        slot = &_slots[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = slot->seq.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // 消费者还没取走一圈之前的日志, 缓冲区已满
+            _dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = _enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->thread = thread_number();
+    slot->time_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    slot->length = (uint32_t)(message.size() < LOG_MESSAGE_MAX ? message.size() : LOG_MESSAGE_MAX);
+    memcpy(slot->text, message.data(), slot->length);
+    slot->seq.store(pos + 1, memory_order_release);
+}
+
+// 调用者持有 _drain_mtx
+inline size_t Logger::drain_locked()
+{
+    size_t count = 0;
+    while (true)
+    {
+        Slot *slot = &_slots[_dequeue_pos & (LOG_RING_SIZE - 1)];
+        if (slot->seq.load(memory_order_acquire) != _dequeue_pos + 1)
+        {
+            break;
+        }
+        write_line(_out, slot->level, slot->thread, slot->time_us, slot->text, slot->length);
+        slot->seq.store(_dequeue_pos + LOG_RING_SIZE, memory_order_release);
+        _dequeue_pos++;
+        count++;
+    }
+    uint64_t dropped = _dropped.load(memory_order_relaxed);
+    if (dropped != _reported_dropped)
+    {
+        fprintf(_out, "日志缓冲区已满, 丢弃了 %llu 条日志\n", (unsigned long long)(dropped - _reported_dropped));
+        _reported_dropped = dropped;
+    }
+    if (count > 0)
+    {
+        fflush(_out);
+    }
+    return count;
+}
+
+// 后台线程: 有日志就写, 没有就睡10毫秒; 写日志的线程不唤醒它, 以免在热路径上碰锁
+inline void Logger::drain_loop()
+{
+    unique_lock<mutex> lock(_wait_mtx);
+    while (!_stop)
+    {
+        lock.unlock();
+        size_t n = flush();
+        lock.lock();
+        if (n == 0 && !_stop)
+        {
+            _wait_cv.wait_for(lock, chrono::milliseconds(10));
+        }
+    }
+}
+
+inline void Logger::write_line(FILE *out, LogLevel level, uint32_t thread, int64_t time_us, const char *text, size_t length)
+{
+    char stamp[32] = "";
+    if (time_us != 0)
+    {
+        time_t sec = (time_t)(time_us / 1000000);
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%06lld", (long long)(time_us % 1000000));
+    }
+    fprintf(out, "%s %s [%u] %.*s\n", stamp, log_level_name(level), thread, (int)length, text);
+}
+
+// 线程的编号, 按第一次写日志的顺序从1开始
+inline uint32_t Logger::thread_number()
+{
+    static atomic<uint32_t> next(1);
+    static thread_local uint32_t number = 0;
+    if (number == 0)
+    {
+        number = next.fetch_add(1, memory_order_relaxed);
+    }
+    return number;
+}
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef LRU_H
+#define LRU_H
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+#define CACHE_LINE_SIZE 64
+
+// LRU_EXACT 下读操作的访问记录先放入读缓冲, 攒满一批后再加锁统一移动节点
+// 读缓冲按线程分为 LRU_READ_BUFFERS 组, 每组最多 LRU_READ_BUFFER_SIZE 条
+#define LRU_READ_BUFFERS 16
+#define LRU_READ_BUFFER_SIZE 32
+
+// 当前线程使用的读缓冲编号, 线程依次编号, 同时运行的线程不超过 LRU_READ_BUFFERS 个时各用各的
+inline unsigned lru_thread_stripe()
+{
+    static atomic<unsigned> next_id(0);
+    static thread_local unsigned id = next_id.fetch_add(1, memory_order_relaxed);
+    return id % LRU_READ_BUFFERS;
+}
+
+// 淘汰策略
+// LRU_EXACT: 严格的LRU, 每次访问都把节点移到链表头部
+//            读操作只把访问记到本线程的读缓冲里, 缓冲满了才加锁批量移动, 读者之间不会每次都争抢链表锁;
+//            选择淘汰节点前先处理所有缓冲中的访问, 只有读缓冲本身有竞争时才会丢弃个别访问记录
+// LRU_CLOCK: 近似LRU(CLOCK算法), 访问只设置节点的访问标记, 不加锁也不移动节点,
+//            淘汰时从链表尾部开始, 带标记的节点清除标记后移到头部(再给一次机会), 第一个不带标记的被淘汰
+//            读多的场景下热点key的读操作不会在LRU锁上竞争
+enum LruPolicy
+{
+    LRU_EXACT,
+    LRU_CLOCK
+};
+
+// 侵入式LRU链表, 链表指针直接放在节点里:
+// 加入, 删除和移到头部都只是修改指针, 不分配内存, 也不拷贝key和value
+// NodeT 需要有以下成员:
+//   NodeT *lru_prev, *lru_next;  // 链表指针
+//   bool lru_linked;             // 是否在链表中
+//   atomic<uint8_t> lru_ref;     // CLOCK的访问标记
+// 链表由内部的锁保护, 因此 touch 可以在不持有跳表锁的读操作中调用
+// 读缓冲中可能留有已被 unlink 的节点, 节点内存被复用前必须调用 flush()
+template <typename NodeT>
+class IntrusiveLRU
+{
+public:
+    IntrusiveLRU(int capacity, LruPolicy policy = LRU_EXACT)
+        : _head(NULL), _tail(NULL), _size(0), _capacity(capacity), _policy(policy) {}
+
+    // 加入链表头部, 节点不能已在链表中
+    void link(NodeT *node);
+
+    // 从链表中摘除, 不在链表中时什么也不做
+    void unlink(NodeT *node);
+
+    // 节点是否在链表中
+    // 处理读缓冲时节点会被短暂摘下再放回头部, 所以不能不加锁直接读 lru_linked
+    bool contains(NodeT *node);
+
+    // 记录一次访问
+    void touch(NodeT *node);
+
+    // 处理读缓冲中所有的访问记录
+    void flush();
+
+    // 选出应当被淘汰的节点(不摘除), 链表为空返回NULL
+    NodeT *victim();
+
+    // 从链表尾部起考察n个节点, 返回score最小的一个(不摘除)
+    // 其余被考察过的节点移到链表头部, 下一次从新的一批节点开始考察
+    template <typename Score>
+    NodeT *sample(int n, Score score);
+
+    void set_capacity(int capacity) { _capacity = capacity; }
+
+    bool full() const { return _size >= _capacity; }
+    int size() const { return _size; }
+    int capacity() const { return _capacity; }
+    LruPolicy policy() const { return _policy; }
+
+    // 从最近访问到最久未访问遍历, 不能与修改并发
+    NodeT *head() const { return _head; }
+
+private:
+    void link_front(NodeT *node);
+    void link_back(NodeT *node);
+    void unlink_locked(NodeT *node);
+    void promote_locked(NodeT *node);
+    void drain_locked();
+
+private:
+    // 一组读缓冲, 末尾填充一个cache line, 相邻两组的锁和计数不会落在同一个cache line上
+    // size 在持有mtx时修改, 处理缓冲时先不加锁读一下, 为0就跳过
+    struct ReadBuffer
+    {
+        mutex mtx;
+        atomic<int> size;
+        NodeT *nodes[LRU_READ_BUFFER_SIZE];
+        char pad[CACHE_LINE_SIZE];
+
+        ReadBuffer() : size(0) {}
+    };
+
+    ReadBuffer _buffers[LRU_READ_BUFFERS];
+
+    mutex _mtx;
+    NodeT *_head;
+    NodeT *_tail;
+    int _size;
+    int _capacity;
+    LruPolicy _policy;
+};
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::link_front(NodeT *node)
+{
+    node->lru_prev = NULL;
+    node->lru_next = _head;
+    if (_head != NULL)
+    {
+        _head->lru_prev = node;
+    }
+    _head = node;
+    if (_tail == NULL)
+    {
+        _tail = node;
+    }
+    node->lru_linked = true;
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::link_back(NodeT *node)
+{
+    node->lru_next = NULL;
+    node->lru_prev = _tail;
+    if (_tail != NULL)
+    {
+        _tail->lru_next = node;
+    }
+    _tail = node;
+    if (_head == NULL)
+    {
+        _head = node;
+    }
+    node->lru_linked = true;
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::unlink_locked(NodeT *node)
+{
+    if (node->lru_prev != NULL)
+    {
+        node->lru_prev->lru_next = node->lru_next;
+    }
+    else
+    {
+        _head = node->lru_next;
+    }
+    if (node->lru_next != NULL)
+    {
+        node->lru_next->lru_prev = node->lru_prev;
+    }
+    else
+    {
+        _tail = node->lru_prev;
+    }
+    node->lru_prev = NULL;
+    node->lru_next = NULL;
+    node->lru_linked = false;
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::link(NodeT *node)
+{
+    lock_guard<mutex> lock(_mtx);
+    node->lru_ref.store(0, memory_order_relaxed);
+    link_front(node);
+    _size++;
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::unlink(NodeT *node)
+{
+    lock_guard<mutex> lock(_mtx);
+    if (node->lru_linked)
+    {
+        unlink_locked(node);
+        _size--;
+    }
+}
+
+template <typename NodeT>
+bool IntrusiveLRU<NodeT>::contains(NodeT *node)
+{
+    lock_guard<mutex> lock(_mtx);
+    return node->lru_linked;
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::touch(NodeT *node)
+{
+    if (_policy == LRU_CLOCK)
+    {
+        // 已经有标记时不再写, 避免热点key所在的cache line在多个核之间来回失效
+        if (node->lru_ref.load(memory_order_relaxed) == 0)
+        {
+            node->lru_ref.store(1, memory_order_relaxed);
+        }
+        return;
+    }
+
+    ReadBuffer &buffer = _buffers[lru_thread_stripe()];
+    // 同一组缓冲正被其他线程使用, 或缓冲已满且还没被处理时, 丢弃这次访问记录, 不等待
+    if (!buffer.mtx.try_lock())
+    {
+        return;
+    }
+    int size = buffer.size.load(memory_order_relaxed);
+    if (size < LRU_READ_BUFFER_SIZE)
+    {
+        buffer.nodes[size++] = node;
+        buffer.size.store(size, memory_order_release);
+    }
+    buffer.mtx.unlock();
+    bool full = size == LRU_READ_BUFFER_SIZE;
+
+    // 攒满一批再加锁移动, 链表锁正被占用时留给下一次
+    if (full && _mtx.try_lock())
+    {
+        drain_locked();
+        _mtx.unlock();
+    }
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::flush()
+{
+    for (int i = 0; i < LRU_READ_BUFFERS; i++)
+    {
+        if (_buffers[i].size.load(memory_order_acquire) != 0)
+        {
+            lock_guard<mutex> lock(_mtx);
+            drain_locked();
+            return;
+        }
+    }
+}
+
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::promote_locked(NodeT *node)
+{
+    // 读者拿到节点后它可能已被删除, 不在链表中就不再加回去
+    if (node->lru_linked && node != _head)
+    {
+        unlink_locked(node);
+        link_front(node);
+    }
+}
+
+// 按记录的顺序把读缓冲中的节点移到链表头部, 调用者需要持有_mtx
+template <typename NodeT>
+void IntrusiveLRU<NodeT>::drain_locked()
+{
+    for (int i = 0; i < LRU_READ_BUFFERS; i++)
+    {
+        ReadBuffer &buffer = _buffers[i];
+        if (buffer.size.load(memory_order_acquire) == 0)
+        {
+            continue;
+        }
+        lock_guard<mutex> lock(buffer.mtx);
+        int size = buffer.size.load(memory_order_relaxed);
+        for (int j = 0; j < size; j++)
+        {
+            promote_locked(buffer.nodes[j]);
+        }
+        buffer.size.store(0, memory_order_relaxed);
+    }
+}
+
+template <typename NodeT>
+NodeT *IntrusiveLRU<NodeT>::victim()
+{
+    lock_guard<mutex> lock(_mtx);
+    drain_locked();
+    if (_policy == LRU_CLOCK)
+    {
+        // 每个节点最多被跳过一次, 最多遍历 _size + 1 个节点
+        while (_tail != NULL && _tail->lru_ref.exchange(0, memory_order_relaxed) != 0)
+        {
+            NodeT *node = _tail;
+            unlink_locked(node);
+            link_front(node);
+        }
+    }
+    return _tail;
+}
+
+template <typename NodeT>
+template <typename Score>
+NodeT *IntrusiveLRU<NodeT>::sample(int n, Score score)
+{
+    lock_guard<mutex> lock(_mtx);
+    drain_locked();
+    NodeT *best = NULL;
+    uint64_t best_score = 0;
+    int examined = 0;
+    for (NodeT *node = _tail; node != NULL && examined < n; node = node->lru_prev, examined++)
+    {
+        uint64_t s = score(node);
+        if (best == NULL || s < best_score)
+        {
+            best = node;
+            best_score = s;
+        }
+    }
+
+    // 考察过的节点都在链表尾部, 逐个移到头部, 选中的节点留在尾部
+    for (int i = 0; i < examined; i++)
+    {
+        NodeT *node = _tail;
+        unlink_locked(node);
+        if (node == best)
+        {
+            continue;
+        }
+        link_front(node);
+    }
+    if (best != NULL)
+    {
+        link_back(best);
+    }
+    return best;
+}
+
+#endif
@@ -1,23 +1,15 @@
 #include <iostream>
 #include <unistd.h>
+// 演示程序打开DEBUG日志, 可以看到每次插入/过期的结果
+#define SKIPLIST_LOG_LEVEL 0
 #include "skiplist.h"
 #define FILE_PATH "./store/dumpFile"
 
-void printLRUCache(LRU<int, string> *lruCache)
-{
-    cout << "-------------LRUCache--------------------" << endl;
-    for (const auto &p : lruCache->l)
-    {
-        cout << "key: " << p.first << ", value : " << p.second << endl;
-    }
-    cout << "-------------LRUCache--------------------" << endl;
-}
-
 int main()
 {
 
-    // 键值中的key用int型，如果用其他类型，需要自定义比较函数
-    // 而且如果修改key的类型，同时需要修改skipList.load_file函数
+    // 键值中的key用int型, 其他类型默认按 < 排序, 也可以通过第三个模板参数指定比较函数
+    // load_file 按key的类型自动解码, 不需要修改
     // 插入18个元素
     SkipList<int, std::string> skipList(8);
     skipList.insert_element(1, "test1");
@@ -41,7 +33,7 @@ int main()
     skipList.display_list();
     std::cout << "skipList size:" << skipList.size() << std::endl;
 
-    std::cout << "LRU 缓存大小为： " << skipList.lruCache->capacity << std::endl;
+    std::cout << "LRU 缓存大小为： " << skipList.lru_capacity() << std::endl;
     // 设置11个元素过期时间
     skipList.expire_element(1, 10);
     sleep(1);
@@ -55,8 +47,8 @@ int main()
     sleep(1);
     skipList.expire_element(9, 6);
 
-    printLRUCache(skipList.lruCache);
-    cout << "LRU缓存中元素个数: " << skipList.lruCache->l.size() << endl;
+    skipList.display_lru();
+    cout << "LRU缓存中元素个数: " << skipList.lru_size() << endl;
 
     sleep(1);
     skipList.expire_element(19, 15);
@@ -64,28 +56,28 @@ int main()
     skipList.ttl_element(1);
     skipList.ttl_element(3);
 
-    printLRUCache(skipList.lruCache);
-    cout << "LRU缓存中元素个数: " << skipList.lruCache->l.size() << endl;
+    skipList.display_lru();
+    cout << "LRU缓存中元素个数: " << skipList.lru_size() << endl;
 
     skipList.expire_element(25, 30);
     sleep(1);
     skipList.ttl_element(7);
 
-    printLRUCache(skipList.lruCache);
+    skipList.display_lru();
     skipList.display_list();
 
     skipList.expire_element(26, 7);
-    cout << "LRU缓存中元素个数: " << skipList.lruCache->l.size() << endl;
+    cout << "LRU缓存中元素个数: " << skipList.lru_size() << endl;
     sleep(1);
     skipList.ttl_element(1);
     skipList.ttl_element(7);
     skipList.expire_element(32, 6);
     sleep(1);
-    cout << "LRU缓存中元素个数: " << skipList.lruCache->l.size() << endl;
+    cout << "LRU缓存中元素个数: " << skipList.lru_size() << endl;
     skipList.ttl_element(7);
     skipList.expire_element(41, 6);
 
-    printLRUCache(skipList.lruCache);
+    skipList.display_lru();
 
     skipList.expire_element(51, 5);
     sleep(1);
@@ -0,0 +1,91 @@
+#ifndef MAXMEMORY_H
+#define MAXMEMORY_H
+
+#include <string>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <stdint.h>
+#include "ttl.h"
+using namespace std;
+
+// 内存达到上限时的淘汰策略
+enum MaxmemoryPolicy
+{
+    MAXMEMORY_NOEVICTION,   // 不淘汰, 超出上限后拒绝插入
+    MAXMEMORY_VOLATILE_LRU, // 在设置了过期时间的key中淘汰最久未访问的
+    MAXMEMORY_ALLKEYS_LRU,  // 在所有key中淘汰最久未访问的
+    MAXMEMORY_ALLKEYS_LFU,  // 在所有key中淘汰访问频率最低的
+    MAXMEMORY_VOLATILE_TTL  // 在设置了过期时间的key中淘汰最早到期的
+};
+
+// ALLKEYS_LFU 每次淘汰时考察的节点数
+#define MAXMEMORY_SAMPLES 16
+
+// LFU计数器, 与Redis相同: 低8位是对数计数器, 高16位是最近一次衰减时的分钟数
+// 计数越大再加1的概率越小, 255大约对应百万次访问; 每过 LFU_DECAY_MINUTES 分钟没有访问计数减1
+#define LFU_INIT_VAL 5
+#define LFU_LOG_FACTOR 10
+#define LFU_DECAY_MINUTES 1
+
+inline uint32_t lfu_minutes()
+{
+    return static_cast<uint32_t>(now_ms() / 60000) & 0xffff;
+}
+
+inline uint32_t lfu_init()
+{
+    return (lfu_minutes() << 8) | LFU_INIT_VAL;
+}
+
+// 按距离上次衰减过去的时间衰减后的计数
+inline uint32_t lfu_count(uint32_t lfu)
+{
+    uint32_t counter = lfu & 0xff;
+    uint32_t now = lfu_minutes();
+    uint32_t last = lfu >> 8;
+    uint32_t elapsed = now >= last ? now - last : 0x10000 - last + now;
+    uint32_t periods = elapsed / LFU_DECAY_MINUTES;
+    return periods >= counter ? 0 : counter - periods;
+}
+
+// 记录一次访问后的计数器
+inline uint32_t lfu_access(uint32_t lfu)
+{
+    static thread_local unsigned int seed =
+        (unsigned int)time(NULL) ^ (unsigned int)hash<thread::id>()(this_thread::get_id());
+
+    uint32_t counter = lfu_count(lfu);
+    if (counter < 255)
+    {
+        uint32_t base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+        double p = 1.0 / (base * LFU_LOG_FACTOR + 1);
+        if (static_cast<double>(rand_r(&seed)) / RAND_MAX < p)
+        {
+            counter++;
+        }
+    }
+    return (lfu_minutes() << 8) | counter;
+}
+
+// key/value在对象之外占用的堆内存, 用于统计跳表占用的内存
+// 默认认为没有额外的堆内存, 其他持有堆内存的类型需要提供重载
+template <typename T>
+size_t heap_usage(const T &)
+{
+    return 0;
+}
+
+// 短字符串存放在对象内部(SSO), 不占用堆内存
+inline size_t heap_usage(const string &s)
+{
+    const char *p = s.data();
+    const char *self = reinterpret_cast<const char *>(&s);
+    if (p >= self && p < self + sizeof(s))
+    {
+        return 0;
+    }
+    return s.capacity() + 1;
+}
+
+#endif
@@ -0,0 +1,504 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <sstream>
+#include <unistd.h>
+#include <errno.h>
+#include "logger.h"
+#include "lru.h"
+using namespace std;
+
+// 跳表的运行统计: 各操作的次数和延迟直方图, 锁的等待和持有时间, 命中率, 过期清理和淘汰的key数, 层数分布, 内存
+// 计数按线程分散到 METRICS_STRIPES 组各自独占cache line的计数器上, 写操作只对本线程那组做一次relaxed加法, 读取时再合并;
+// 延迟和锁的计时每次要多读一两次时钟, 默认关闭, 由 enable_metrics_timing() 打开
+//
+//   list.enable_metrics_timing();
+//   cout << list.info();                        // 类似Redis INFO 的文本
+//   list.dump_metrics("store/skiplist.prom");   // Prometheus 文本格式
+
+#define METRICS_STRIPES 16
+// 直方图第i个桶是 [2^i, 2^(i+1)) 纳秒, 第0个桶包括0, 最后一个桶包括所有更大的值
+#define METRICS_BUCKETS 40
+// 层数分布最多统计的层数, 与 random_level 的上限相同
+#define METRICS_MAX_LEVEL 32
+
+// 计时的操作
+enum MetricOp
+{
+    METRIC_INSERT,
+    METRIC_SEARCH,
+    METRIC_DELETE,
+    METRIC_EXPIRE,
+    METRIC_OPS
+};
+
+// 只计数的事件
+enum MetricCounter
+{
+    METRIC_KEYSPACE_HITS,   // 查询找到了key
+    METRIC_KEYSPACE_MISSES, // 查询没找到key(包括已到期的key)
+    METRIC_LRU_HITS,        // 查询找到的key在LRU链表中, 记录了一次访问
+    METRIC_LRU_EVICTED,     // 设置了过期时间的key超过 VOLATILE_LRU_THRESHOLD 个时被淘汰的key
+    METRIC_EXPIRED_ACTIVE,  // 后台线程清理的到期key
+    METRIC_EXPIRED_LAZY,    // 访问时发现到期而清理的key
+    METRIC_REJECTED_WRITES, // 超出内存上限被拒绝的写操作
+    METRIC_COUNTERS
+};
+
+inline const char *metric_op_name(MetricOp op)
+{
+    static const char *names[] = {"insert", "search", "delete", "expire"};
+    return names[op];
+}
+
+inline const char *metric_counter_name(MetricCounter counter)
+{
+    static const char *names[] = {"keyspace_hits", "keyspace_misses", "lru_hits", "lru_evicted_keys",
+                                  "expired_keys_active", "expired_keys_lazy", "rejected_writes"};
+    return names[counter];
+}
+
+// 单调时钟, 纳秒
+inline uint64_t metrics_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+inline int metrics_bucket(uint64_t ns)
+{
+    int b = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+    return b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1;
+}
+
+// 按2的幂分桶的延迟直方图, 分位数只精确到所在的桶(误差在2倍以内), 足够看出数量级的变化
+struct LatencyHistogram
+{
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+
+    LatencyHistogram() { clear(); }
+
+    void clear()
+    {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        sum_ns = 0;
+    }
+
+    void record(uint64_t ns)
+    {
+        buckets[metrics_bucket(ns)]++;
+        count++;
+        sum_ns += ns;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < METRICS_BUCKETS; i++)
+        {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        sum_ns += other.sum_ns;
+    }
+
+    double mean_ns() const { return count == 0 ? 0 : (double)sum_ns / count; }
+
+    // 第q分位(0 < q <= 1)所在桶的上界
+    uint64_t percentile_ns(double q) const
+    {
+        uint64_t rank = (uint64_t)(q * count + 0.999999);
+        uint64_t seen = 0;
+        for (int i = 0; i < METRICS_BUCKETS; i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+            {
+                return (2ULL << i) - 1;
+            }
+        }
+        return 0;
+    }
+};
+
+// 跳表锁的统计, 在锁内修改和读取, 见 PaddedMutex
+// 只统计通过 lock()/unlock() 的加锁, 条件变量经 native() 的加锁不计入
+struct LockStats
+{
+    uint64_t acquisitions;
+    uint64_t contended; // 第一次try_lock失败, 需要等待的次数
+    LatencyHistogram wait;
+    LatencyHistogram hold;
+
+    LockStats() : acquisitions(0), contended(0) {}
+
+    void merge(const LockStats &other)
+    {
+        acquisitions += other.acquisitions;
+        contended += other.contended;
+        wait.merge(other.wait);
+        hold.merge(other.hold);
+    }
+};
+
+// 某一时刻合并后的统计, 可以再合并多个跳表(分片)的结果
+struct MetricsSnapshot
+{
+    uint64_t ops[METRIC_OPS];
+    LatencyHistogram latency[METRIC_OPS];
+    uint64_t counters[METRIC_COUNTERS];
+    // levels[k] 是随机层数为k的节点个数, 包括已删除的节点, 反映随机数生成器的分布
+    uint64_t levels[METRICS_MAX_LEVEL + 1];
+    LockStats lock;
+    bool timing;
+
+    // 以下在读取时从跳表中取得
+    uint64_t keys;
+    uint64_t volatile_keys; // 设置了过期时间的key
+    uint64_t used_memory;   // key/value和节点占用的内存, 按 Node::memory_usage() 统计
+    uint64_t arena_memory;  // 节点内存池向系统申请的内存
+    uint64_t maxmemory;
+    uint64_t evicted_keys; // 按内存上限淘汰的key
+    uint64_t lru_size;
+    uint64_t lru_capacity;
+    int level;
+    int max_level;
+    int shards;
+
+    MetricsSnapshot()
+    {
+        memset(ops, 0, sizeof(ops));
+        memset(counters, 0, sizeof(counters));
+        memset(levels, 0, sizeof(levels));
+        timing = false;
+        keys = volatile_keys = used_memory = arena_memory = maxmemory = evicted_keys = lru_size = lru_capacity = 0;
+        level = max_level = 0;
+        shards = 0;
+    }
+
+    void merge(const MetricsSnapshot &other)
+    {
+        for (int i = 0; i < METRIC_OPS; i++)
+        {
+            ops[i] += other.ops[i];
+            latency[i].merge(other.latency[i]);
+        }
+        for (int i = 0; i < METRIC_COUNTERS; i++)
+        {
+            counters[i] += other.counters[i];
+        }
+        for (int i = 0; i <= METRICS_MAX_LEVEL; i++)
+        {
+            levels[i] += other.levels[i];
+        }
+        lock.merge(other.lock);
+        timing = timing || other.timing;
+        keys += other.keys;
+        volatile_keys += other.volatile_keys;
+        used_memory += other.used_memory;
+        arena_memory += other.arena_memory;
+        maxmemory += other.maxmemory;
+        evicted_keys += other.evicted_keys;
+        lru_size += other.lru_size;
+        lru_capacity += other.lru_capacity;
+        level = other.level > level ? other.level : level;
+        max_level = other.max_level > max_level ? other.max_level : max_level;
+        shards += other.shards;
+    }
+};
+
+// 当前线程使用的计数器组, 线程依次编号, 同时运行的线程不超过 METRICS_STRIPES 个时各用各的
+inline unsigned metrics_thread_stripe()
+{
+    static atomic<unsigned> next_id(0);
+    static thread_local unsigned id = next_id.fetch_add(1, memory_order_relaxed);
+    return id % METRICS_STRIPES;
+}
+
+// 每个跳表一个, 记录操作次数和延迟等计数
+class Metrics
+{
+public:
+    Metrics() : _stripes(new Stripe[METRICS_STRIPES]), _timing(false) {}
+    ~Metrics() { delete[] _stripes; }
+
+    void set_timing(bool on) { _timing.store(on, memory_order_relaxed); }
+    bool timing() const { return _timing.load(memory_order_relaxed); }
+
+    // 操作开始时调用, 未打开计时返回0, 不读时钟
+    uint64_t start() const { return timing() ? metrics_now_ns() : 0; }
+
+    // 操作结束时调用, start_ns 为 start() 的返回值
+    void record_op(MetricOp op, uint64_t start_ns)
+    {
+        Stripe &s = local();
+        s.ops[op].fetch_add(1, memory_order_relaxed);
+        if (start_ns != 0)
+        {
+            uint64_t ns = metrics_now_ns() - start_ns;
+            s.latency[op][metrics_bucket(ns)].fetch_add(1, memory_order_relaxed);
+            s.latency_sum[op].fetch_add(ns, memory_order_relaxed);
+        }
+    }
+
+    // 不计时, 只加操作次数, 用于 multi_get 等批量操作
+    void add_ops(MetricOp op, uint64_t n) { local().ops[op].fetch_add(n, memory_order_relaxed); }
+
+    void add(MetricCounter counter, uint64_t n = 1) { local().counters[counter].fetch_add(n, memory_order_relaxed); }
+
+    void record_level(int level)
+    {
+        local().levels[level < METRICS_MAX_LEVEL ? level : METRICS_MAX_LEVEL].fetch_add(1, memory_order_relaxed);
+    }
+
+    // 合并各组计数到snapshot中; 与写操作并发时各个计数之间不是同一时刻的值
+    void collect(MetricsSnapshot *snapshot) const
+    {
+        for (int i = 0; i < METRICS_STRIPES; i++)
+        {
+            const Stripe &s = _stripes[i];
+            for (int op = 0; op < METRIC_OPS; op++)
+            {
+                snapshot->ops[op] += s.ops[op].load(memory_order_relaxed);
+                LatencyHistogram &h = snapshot->latency[op];
+                for (int b = 0; b < METRICS_BUCKETS; b++)
+                {
+                    uint64_t n = s.latency[op][b].load(memory_order_relaxed);
+                    h.buckets[b] += n;
+                    h.count += n;
+                }
+                h.sum_ns += s.latency_sum[op].load(memory_order_relaxed);
+            }
+            for (int c = 0; c < METRIC_COUNTERS; c++)
+            {
+                snapshot->counters[c] += s.counters[c].load(memory_order_relaxed);
+            }
+            for (int l = 0; l <= METRICS_MAX_LEVEL; l++)
+            {
+                snapshot->levels[l] += s.levels[l].load(memory_order_relaxed);
+            }
+        }
+        snapshot->timing = timing();
+    }
+
+private:
+    // 一个线程的计数; 每组几百字节, 末尾填充一个cache line, 相邻两组的首尾不会落在同一条cache line上
+    struct Stripe
+    {
+        atomic<uint64_t> ops[METRIC_OPS];
+        atomic<uint64_t> latency[METRIC_OPS][METRICS_BUCKETS];
+        atomic<uint64_t> latency_sum[METRIC_OPS];
+        atomic<uint64_t> counters[METRIC_COUNTERS];
+        atomic<uint64_t> levels[METRICS_MAX_LEVEL + 1];
+        char _pad[CACHE_LINE_SIZE];
+
+        Stripe()
+        {
+            for (int i = 0; i < METRIC_OPS; i++)
+            {
+                ops[i].store(0, memory_order_relaxed);
+                latency_sum[i].store(0, memory_order_relaxed);
+                for (int b = 0; b < METRICS_BUCKETS; b++)
+                {
+                    latency[i][b].store(0, memory_order_relaxed);
+                }
+            }
+            for (int i = 0; i < METRIC_COUNTERS; i++)
+            {
+                counters[i].store(0, memory_order_relaxed);
+            }
+            for (int i = 0; i <= METRICS_MAX_LEVEL; i++)
+            {
+                levels[i].store(0, memory_order_relaxed);
+            }
+        }
+    };
+
+    Stripe &local() { return _stripes[metrics_thread_stripe()]; }
+
+    Metrics(const Metrics &);
+    Metrics &operator=(const Metrics &);
+
+    Stripe *_stripes;
+    atomic<bool> _timing;
+};
+
+// 命中率, 没有查询时为0
+inline double metrics_ratio(uint64_t part, uint64_t total)
+{
+    return total == 0 ? 0 : (double)part / total;
+}
+
+// 类似Redis INFO的文本, 分为若干节, 每行 名称:值
+// 延迟单位为微秒, 分位数为所在2的幂桶的上界
+inline string format_info(const MetricsSnapshot &m)
+{
+    ostringstream out;
+    out << "# Stats\n";
+    for (int op = 0; op < METRIC_OPS; op++)
+    {
+        out << metric_op_name((MetricOp)op) << "_ops:" << m.ops[op] << "\n";
+    }
+    for (int c = 0; c < METRIC_COUNTERS; c++)
+    {
+        out << metric_counter_name((MetricCounter)c) << ":" << m.counters[c] << "\n";
+    }
+    uint64_t searches = m.counters[METRIC_KEYSPACE_HITS] + m.counters[METRIC_KEYSPACE_MISSES];
+    out << "keyspace_hit_rate:" << metrics_ratio(m.counters[METRIC_KEYSPACE_HITS], searches) << "\n";
+    out << "lru_hit_rate:" << metrics_ratio(m.counters[METRIC_LRU_HITS], searches) << "\n";
+    out << "evicted_keys:" << m.evicted_keys << "\n";
+
+    out << "\n# Latency\n";
+    out << "timing:" << (m.timing ? 1 : 0) << "\n";
+    for (int op = 0; op < METRIC_OPS; op++)
+    {
+        const LatencyHistogram &h = m.latency[op];
+        out << metric_op_name((MetricOp)op) << "_usec:count=" << h.count << ",avg=" << h.mean_ns() / 1000
+            << ",p50=" << h.percentile_ns(0.5) / 1000.0 << ",p99=" << h.percentile_ns(0.99) / 1000.0
+            << ",p999=" << h.percentile_ns(0.999) / 1000.0 << "\n";
+    }
+
+    out << "\n# Lock\n";
+    out << "lock_acquisitions:" << m.lock.acquisitions << "\n";
+    out << "lock_contended:" << m.lock.contended << "\n";
+    out << "lock_wait_usec:avg=" << m.lock.wait.mean_ns() / 1000 << ",p99=" << m.lock.wait.percentile_ns(0.99) / 1000.0
+        << ",total=" << m.lock.wait.sum_ns / 1000 << "\n";
+    out << "lock_hold_usec:avg=" << m.lock.hold.mean_ns() / 1000 << ",p99=" << m.lock.hold.percentile_ns(0.99) / 1000.0
+        << ",total=" << m.lock.hold.sum_ns / 1000 << "\n";
+
+    out << "\n# Memory\n";
+    out << "used_memory:" << m.used_memory << "\n";
+    out << "arena_memory:" << m.arena_memory << "\n";
+    out << "maxmemory:" << m.maxmemory << "\n";
+    out << "lru_size:" << m.lru_size << "\n";
+    out << "lru_capacity:" << m.lru_capacity << "\n";
+
+    out << "\n# Keyspace\n";
+    out << "keys:" << m.keys << "\n";
+    out << "volatile_keys:" << m.volatile_keys << "\n";
+    out << "shards:" << m.shards << "\n";
+    out << "level:" << m.level << "\n";
+    out << "max_level:" << m.max_level << "\n";
+
+    out << "\n# Levels\n";
+    for (int l = 1; l <= METRICS_MAX_LEVEL; l++)
+    {
+        if (m.levels[l] != 0)
+        {
+            out << "level_" << l << ":" << m.levels[l] << "\n";
+        }
+    }
+    return out.str();
+}
+
+// Prometheus 直方图只输出 2^7 纳秒到 2^34 纳秒(约17秒)之间的桶, 更小的并入第一个桶, 桶的计数是累计的
+inline void format_prometheus_histogram(ostringstream &out, const string &name, const string &labels, const LatencyHistogram &h)
+{
+    string sep = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS - 1; i++)
+    {
+        cumulative += h.buckets[i];
+        if (i + 1 >= 7 && i + 1 <= 34)
+        {
+            out << name << "_bucket{" << labels << sep << "le=\"" << (double)(1ULL << (i + 1)) / 1e9 << "\"} " << cumulative << "\n";
+        }
+    }
+    out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << h.count << "\n";
+    out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << (double)h.sum_ns / 1e9 << "\n";
+    out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << h.count << "\n";
+}
+
+// Prometheus 文本格式(exposition format 0.0.4), 指标名以 prefix_ 开头
+inline string format_prometheus(const MetricsSnapshot &m, const string &prefix = "skiplist")
+{
+    ostringstream out;
+    out.precision(12);
+
+    out << "# HELP " << prefix << "_ops_total Operations by type.\n";
+    out << "# TYPE " << prefix << "_ops_total counter\n";
+    for (int op = 0; op < METRIC_OPS; op++)
+    {
+        out << prefix << "_ops_total{op=\"" << metric_op_name((MetricOp)op) << "\"} " << m.ops[op] << "\n";
+    }
+
+    for (int c = 0; c < METRIC_COUNTERS; c++)
+    {
+        string name = prefix + "_" + metric_counter_name((MetricCounter)c) + "_total";
+        out << "# TYPE " << name << " counter\n";
+        out << name << " " << m.counters[c] << "\n";
+    }
+    out << "# TYPE " << prefix << "_evicted_keys_total counter\n";
+    out << prefix << "_evicted_keys_total " << m.evicted_keys << "\n";
+
+    out << "# HELP " << prefix << "_op_duration_seconds Operation latency, only while timing is enabled.\n";
+    out << "# TYPE " << prefix << "_op_duration_seconds histogram\n";
+    for (int op = 0; op < METRIC_OPS; op++)
+    {
+        format_prometheus_histogram(out, prefix + "_op_duration_seconds", string("op=\"") + metric_op_name((MetricOp)op) + "\"", m.latency[op]);
+    }
+
+    out << "# TYPE " << prefix << "_lock_acquisitions_total counter\n";
+    out << prefix << "_lock_acquisitions_total " << m.lock.acquisitions << "\n";
+    out << "# TYPE " << prefix << "_lock_contended_total counter\n";
+    out << prefix << "_lock_contended_total " << m.lock.contended << "\n";
+    out << "# HELP " << prefix << "_lock_wait_seconds Time spent waiting for the write lock.\n";
+    out << "# TYPE " << prefix << "_lock_wait_seconds histogram\n";
+    format_prometheus_histogram(out, prefix + "_lock_wait_seconds", "", m.lock.wait);
+    out << "# HELP " << prefix << "_lock_hold_seconds Time the write lock was held.\n";
+    out << "# TYPE " << prefix << "_lock_hold_seconds histogram\n";
+    format_prometheus_histogram(out, prefix + "_lock_hold_seconds", "", m.lock.hold);
+
+    out << "# HELP " << prefix << "_node_levels_total Nodes created by random level.\n";
+    out << "# TYPE " << prefix << "_node_levels_total counter\n";
+    for (int l = 1; l <= METRICS_MAX_LEVEL; l++)
+    {
+        if (m.levels[l] != 0)
+        {
+            out << prefix << "_node_levels_total{level=\"" << l << "\"} " << m.levels[l] << "\n";
+        }
+    }
+
+    const char *gauges[] = {"keys", "volatile_keys", "used_memory_bytes", "arena_memory_bytes", "maxmemory_bytes",
+                            "lru_size", "lru_capacity", "level", "max_level"};
+    uint64_t values[] = {m.keys, m.volatile_keys, m.used_memory, m.arena_memory, m.maxmemory,
+                         m.lru_size, m.lru_capacity, (uint64_t)m.level, (uint64_t)m.max_level};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        out << "# TYPE " << prefix << "_" << gauges[i] << " gauge\n";
+        out << prefix << "_" << gauges[i] << " " << values[i] << "\n";
+    }
+    return out.str();
+}
+
+// 先写临时文件再rename, 采集程序(如 node_exporter 的 textfile collector)不会读到写了一半的文件
+inline bool write_metrics_file(const string &path, const string &text)
+{
+    string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == NULL)
+    {
+        LOG_ERROR("创建统计文件 " << tmp << " 失败, errno: " << errno);
+        return false;
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        LOG_ERROR("写入统计文件 " << path << " 失败, errno: " << errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
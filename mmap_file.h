@@ -0,0 +1,91 @@
+#ifndef MMAP_FILE_H
+#define MMAP_FILE_H
+
+#include <string>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logger.h"
+using namespace std;
+
+// 只读的文件内存映射
+// 映射之后文件内容按需通过缺页中断读入, 打开文件本身不需要读取和拷贝数据
+// 通过 shared_ptr 共享, 最后一个引用释放时解除映射
+class MappedFile
+{
+public:
+    // 文件不存在或映射失败返回空指针
+    static shared_ptr<MappedFile> open(const string &path);
+
+    ~MappedFile();
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // 提示内核马上要读整个文件: 立即在后台预读, 之后的缺页大多不必等磁盘
+    // 不用MADV_SEQUENTIAL, 加载后的值还引用着映射区域, 读过的页不应被尽早回收
+    void will_need() const;
+
+private:
+    MappedFile(const char *data, size_t size) : _data(data), _size(size) {}
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+private:
+    const char *_data;
+    size_t _size;
+};
+
+inline shared_ptr<MappedFile> MappedFile::open(const string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return shared_ptr<MappedFile>();
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return shared_ptr<MappedFile>();
+    }
+
+    // 空文件无法映射, 用空区间表示
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return shared_ptr<MappedFile>(new MappedFile(NULL, 0));
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立后即可关闭文件描述符, 即使文件被rename替换, 映射仍指向原来的内容
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("映射文件 " << path << " 失败, errno: " << errno);
+        return shared_ptr<MappedFile>();
+    }
+    return shared_ptr<MappedFile>(new MappedFile(static_cast<const char *>(addr), st.st_size));
+}
+
+inline void MappedFile::will_need() const
+{
+    if (_data != NULL)
+    {
+        madvise(const_cast<char *>(_data), _size, MADV_WILLNEED);
+    }
+}
+
+inline MappedFile::~MappedFile()
+{
+    if (_data != NULL)
+    {
+        munmap(const_cast<char *>(_data), _size);
+    }
+}
+
+#endif
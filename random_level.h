@@ -0,0 +1,152 @@
+#ifndef RANDOM_LEVEL_H
+#define RANDOM_LEVEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <cmath>
+#include <thread>
+#include <functional>
+using namespace std;
+
+// 新节点升高一层的概率
+// 1/2 每个节点平均2个next指针, 查找时每层平均比较2次;
+// 1/4 每个节点平均1.33个next指针, 节点更小, 每层平均比较4次, 层数减半;
+// 1/e 使 (每层比较次数 x 层数) 最小, 介于两者之间
+enum Branching
+{
+    BRANCHING_HALF,
+    BRANCHING_QUARTER,
+    BRANCHING_E,
+};
+
+// 每个线程自己的 xorshift64* 随机数生成器
+// rand() 内部有全局锁, 多个线程同时插入时会在这里排队; 这里不加锁, 每次只需几条指令
+// 默认用时间, 线程id和对象地址作种子; 测试时可以用 seed() 固定种子, 使同一线程插入同样的数据得到同样的层数
+class LevelRandom
+{
+public:
+    LevelRandom() : _state(0) {}
+
+    void seed(uint64_t seed)
+    {
+        // splitmix64 打散种子, 相近的种子也得到差别很大的初始状态; 状态不能为0
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        _state = z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+    }
+
+    uint64_t next()
+    {
+        if (_state == 0)
+        {
+            seed(((uint64_t)time(NULL) << 32) ^ (uint64_t)hash<thread::id>()(this_thread::get_id()) ^ (uint64_t)(uintptr_t)this);
+        }
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // 当前线程的生成器
+    static LevelRandom &local()
+    {
+        static thread_local LevelRandom rng;
+        return rng;
+    }
+
+private:
+    uint64_t _state;
+};
+
+// 固定当前线程的随机层数序列, 用于可重复的测试
+inline void seed_random_level(uint64_t seed)
+{
+    LevelRandom::local().seed(seed);
+}
+
+// 1/e 时层数不小于k+1的概率 e^-k 乘以2^64, k从1开始
+static const uint64_t LEVEL_THRESHOLDS_E[32] = {
+    0x5E2D58D8B3BCE000ULL,
+    0x22A555477F039800ULL,
+    0x0CBED86667585780ULL,
+    0x04B0556E084F3D00ULL,
+    0x01B993FE00D53760ULL,
+    0x00A2728F889EA6B0ULL,
+    0x003BC2D73849531EULL,
+    0x0015FC21041027ADULL,
+    0x0008167912932A2DULL,
+    0x0002F9AF36AC8F93ULL,
+    0x000118354238F676ULL,
+    0x0000671530ED0EF2ULL,
+    0x000025EC0A77303BULL,
+    0x00000DF3637ED80BULL,
+    0x00000521D72889FBULL,
+    0x000001E355BBAEE8ULL,
+    0x000000B1CF18BAD3ULL,
+    0x00000041698A31A6ULL,
+    0x000000181056FF2CULL,
+    0x00000008DA432AF9ULL,
+    0x0000000341B61A1BULL,
+    0x0000000132B48BF1ULL,
+    0x0000000070D49F90ULL,
+    0x0000000029820F1FULL,
+    0x000000000F451BD2ULL,
+    0x00000000059E14A9ULL,
+    0x0000000002110A53ULL,
+    0x0000000000C29F80ULL,
+    0x000000000047990AULL,
+    0x00000000001A56E0ULL,
+    0x000000000009B090ULL,
+    0x000000000003908CULL};
+
+// 1/p, 即每一层节点数是上一层的几倍
+inline double branching_base(Branching branching)
+{
+    return branching == BRANCHING_QUARTER ? 4.0 : (branching == BRANCHING_E ? M_E : 2.0);
+}
+
+// 返回1到max_level之间的层数, 返回k的概率为 p^(k-1) * (1-p)
+// 只取一个随机数, 不逐层抛硬币: 均匀的64位随机数从最高位开始连续0的个数n满足 P(n >= k) = 1/2^k,
+// 1/2 时层数就是 n + 1, 1/4 时每两个0升一层; xorshift64* 的高位比低位随机, 所以数高位的0而不是低位的
+// 1/e 不是2的幂, 依次和 LEVEL_THRESHOLDS_E 比较, 小于第k个阈值就至少有k+1层, 绝大多数时候比较一两次就结束
+inline int random_level(Branching branching, int max_level)
+{
+    uint64_t r = LevelRandom::local().next();
+    int k;
+    switch (branching)
+    {
+    case BRANCHING_QUARTER:
+        k = 1 + __builtin_clzll(r | 1) / 2;
+        break;
+    case BRANCHING_E:
+        k = 1;
+        while (k <= 32 && r < LEVEL_THRESHOLDS_E[k - 1])
+        {
+            k++;
+        }
+        break;
+    default:
+        k = 1 + __builtin_clzll(r | 1);
+        break;
+    }
+    return k < max_level ? k : max_level;
+}
+
+// 预计存放expected_size个key时合适的最大层数: log(1/p)(expected_size), 至少为1
+// 层数不够时高层节点过多, 查找退化; 层数过多只是头节点浪费几个指针
+inline int max_level_for(size_t expected_size, Branching branching)
+{
+    double levels = expected_size > 1 ? ceil(log((double)expected_size) / log(branching_base(branching))) : 1;
+    return levels < 1 ? 1 : (levels > 32 ? 32 : (int)levels);
+}
+
+// 最高层为level时跳表大约有多少个key, 是 max_level_for 的反函数
+inline size_t level_capacity(int level, Branching branching)
+{
+    return (size_t)pow(branching_base(branching), level);
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "resp.h"
+#include "../stress-test/bench_util.h"
+
+// kvserver 的压测客户端, 类似 redis-benchmark -P
+// 每个连接一个线程, 一次发出 pipeline 条命令, 收齐回复后再发下一批; 延迟按批统计, 即这一批从发出到收齐回复的时间
+// 先用SET装载 keyspace 个key, 再按 --set 的比例混合执行SET和GET
+//
+//   ./bin/kv_bench --port=6379 --connections=8 --pipeline=16 --requests=1000000
+
+struct BenchOptions
+{
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    int connections = 8;
+    int pipeline = 16;
+    uint64_t requests = 1000000;
+    uint64_t keyspace = 100000;
+    int value_size = 100;
+    double set_ratio = 0.1;
+    bool load = true;
+};
+
+BenchOptions opt;
+
+static int connect_to(const std::string &host, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "connect %s:%d failed: %s\n", host.c_str(), port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool write_all(int fd, const std::string &buf)
+{
+    size_t pos = 0;
+    while (pos < buf.size())
+    {
+        ssize_t n = write(fd, buf.data() + pos, buf.size() - pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+// 读到count个完整的回复为止, 返回其中错误回复的个数, 连接断开时返回-1
+static int read_replies(int fd, std::string *in, int count)
+{
+    int errors = 0;
+    size_t pos = 0;
+    char buf[64 * 1024];
+    while (count > 0)
+    {
+        size_t n = resp_reply_length(in->data(), in->size(), pos);
+        if (n == static_cast<size_t>(-1))
+        {
+            return -1;
+        }
+        if (n > 0)
+        {
+            errors += (*in)[pos] == '-' ? 1 : 0;
+            pos += n;
+            count--;
+            continue;
+        }
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        in->append(buf, r);
+    }
+    in->erase(0, pos);
+    return errors;
+}
+
+static std::string make_key(uint64_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key:%012llu", static_cast<unsigned long long>(i));
+    return buf;
+}
+
+struct WorkerResult
+{
+    Histogram latency;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    bool failed = false;
+};
+
+// 从 next 中按批领取请求编号, 直到领完 total 个; loading 时第i个请求是 SET key:i
+static void worker(int id, bool loading, uint64_t total, std::atomic<uint64_t> *next, WorkerResult *result)
+{
+    int fd = connect_to(opt.host, opt.port);
+    if (fd < 0)
+    {
+        result->failed = true;
+        return;
+    }
+    BenchRandom rng(id * 7919 + (loading ? 1 : 2));
+    std::string value(opt.value_size, 'v');
+    std::string out, in;
+    std::vector<StringRef> args;
+    std::string key;
+    while (true)
+    {
+        uint64_t begin = next->fetch_add(opt.pipeline);
+        if (begin >= total)
+        {
+            break;
+        }
+        uint64_t end = begin + opt.pipeline < total ? begin + opt.pipeline : total;
+        out.clear();
+        for (uint64_t i = begin; i < end; i++)
+        {
+            key = make_key(loading ? i : rng.uniform(opt.keyspace));
+            args.clear();
+            if (loading || rng.real() < opt.set_ratio)
+            {
+                args.push_back("SET");
+                args.push_back(StringRef(key));
+                args.push_back(StringRef(value));
+            }
+            else
+            {
+                args.push_back("GET");
+                args.push_back(StringRef(key));
+            }
+            resp_command(&out, args);
+        }
+        uint64_t start = now_ns();
+        int errors = write_all(fd, out) ? read_replies(fd, &in, static_cast<int>(end - begin)) : -1;
+        if (errors < 0)
+        {
+            result->failed = true;
+            break;
+        }
+        result->latency.record(now_ns() - start);
+        result->requests += end - begin;
+        result->errors += errors;
+    }
+    close(fd);
+}
+
+static bool run_phase(const char *name, bool loading, uint64_t total)
+{
+    std::atomic<uint64_t> next(0);
+    std::vector<WorkerResult> results(opt.connections);
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns();
+    for (int i = 0; i < opt.connections; i++)
+    {
+        threads.push_back(std::thread(worker, i, loading, total, &next, &results[i]));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    Histogram latency;
+    uint64_t requests = 0, errors = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].failed)
+        {
+            fprintf(stderr, "%s: connection %zu failed\n", name, i);
+            return false;
+        }
+        latency.merge(results[i].latency);
+        requests += results[i].requests;
+        errors += results[i].errors;
+    }
+    printf("[%s] %llu requests in %.3fs, %.0f requests/s, %llu errors\n", name, (unsigned long long)requests, seconds,
+           requests / seconds, (unsigned long long)errors);
+    printf("  batch latency(us): mean %.2f  p50 %.2f  p99 %.2f  p999 %.2f  max %.2f\n", latency.mean() / 1000,
+           latency.percentile(0.5) / 1000.0, latency.percentile(0.99) / 1000.0, latency.percentile(0.999) / 1000.0,
+           latency.max() / 1000.0);
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: kv_bench [--option=value ...]\n"
+            "  --host=IP           server address (127.0.0.1)\n"
+            "  --port=N            server port (6379)\n"
+            "  --connections=N     connections, one thread each (8)\n"
+            "  --pipeline=N        commands sent per round trip (16)\n"
+            "  --requests=N        requests in the run phase (1000000)\n"
+            "  --keyspace=N        distinct keys, loaded with SET first (100000)\n"
+            "  --value-size=N      value length in bytes (100)\n"
+            "  --set=R             fraction of SET in the run phase, the rest are GET (0.1)\n"
+            "  --load=0|1          run the load phase (1)\n");
+}
+
+static bool parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (name == "host")
+            opt.host = value;
+        else if (name == "port")
+            opt.port = atoi(value.c_str());
+        else if (name == "connections")
+            opt.connections = atoi(value.c_str());
+        else if (name == "pipeline")
+            opt.pipeline = atoi(value.c_str());
+        else if (name == "requests")
+            opt.requests = strtoull(value.c_str(), NULL, 10);
+        else if (name == "keyspace")
+            opt.keyspace = strtoull(value.c_str(), NULL, 10);
+        else if (name == "value-size")
+            opt.value_size = atoi(value.c_str());
+        else if (name == "set")
+            opt.set_ratio = atof(value.c_str());
+        else if (name == "load")
+            opt.load = value == "1";
+        else
+            return false;
+    }
+    return opt.connections > 0 && opt.pipeline > 0 && opt.keyspace > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse(argc, argv))
+    {
+        usage();
+        return 1;
+    }
+    printf("connections %d, pipeline %d, keyspace %llu, value %d bytes, set %.2f\n", opt.connections, opt.pipeline,
+           (unsigned long long)opt.keyspace, opt.value_size, opt.set_ratio);
+    if (opt.load && !run_phase("load", true, opt.keyspace))
+    {
+        return 1;
+    }
+    return run_phase("run", false, opt.requests) ? 0 : 1;
+}
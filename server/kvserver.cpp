@@ -0,0 +1,824 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
+#include <csignal>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "../skiplist.h"
+#include "resp.h"
+
+// 用Redis协议(RESP)对外提供 SkipList<string, string> 的键值服务
+// 多个reactor线程, 每个线程一个epoll和一个监听socket(SO_REUSEPORT, 由内核分配新连接), 连接建立后只由这个线程处理;
+// 读操作不加锁, 写操作在跳表的锁内完成, 所以多个reactor可以同时处理请求
+// 支持pipeline: 一次读到的多条命令依次执行, 回复攒在输出缓冲区里, 处理完这一批再一次write出去
+//
+//   ./bin/kvserver --port=6379 --threads=4
+//   ./bin/kv_bench --port=6379 --connections=50 --pipeline=16
+//
+// 支持的命令: GET SET DEL EXISTS EXPIRE PEXPIRE TTL PTTL SCAN DBSIZE SAVE BGSAVE INFO PING ECHO SELECT CONFIG QUIT
+
+typedef SkipList<std::string, std::string, StringLess> Store;
+
+struct ServerOptions
+{
+    int port = 6379;
+    int threads = 4;
+    int max_level = 0;
+    size_t maxmemory = 0;
+    std::string policy = "noeviction";
+    std::string wal = "none";
+    std::string io = "auto";
+    bool load = false;
+    int timing = 0;
+};
+
+ServerOptions opt;
+std::atomic<bool> g_stop(false);
+
+// 每次read的最大字节数, 输出缓冲区积压超过 OUTPUT_LIMIT 时暂停读取这个连接, 等客户端把回复读走
+const size_t READ_CHUNK = 64 * 1024;
+const size_t OUTPUT_LIMIT = 16 * 1024 * 1024;
+const int EPOLL_BATCH = 256;
+
+struct Connection
+{
+    int fd;
+    std::vector<char> in;
+    size_t in_end;
+    std::string out;
+    size_t out_pos;
+    uint32_t events;
+    bool closing; // 回复写完后关闭(QUIT 或协议错误)
+    RespParser parser; // 记住不完整命令解析到的位置
+
+    explicit Connection(int f) : fd(f), in(READ_CHUNK), in_end(0), out_pos(0), events(0), closing(false) {}
+};
+
+// 命令的执行, 所有reactor共用
+class CommandTable
+{
+public:
+    explicit CommandTable(Store *store) : _store(store) {}
+
+    // 执行一条命令, 回复追加到out; 返回false表示回复后关闭连接
+    bool execute(const std::vector<StringRef> &args, std::string *out, std::string *scratch);
+
+private:
+    void set(const std::vector<StringRef> &args, std::string *out);
+    void expire(const std::vector<StringRef> &args, std::string *out, int64_t unit_ms);
+    void scan(const std::vector<StringRef> &args, std::string *out);
+    bool wal_failed(std::string *out);
+
+    Store *_store;
+};
+
+static void wrong_args(std::string *out, const StringRef &cmd)
+{
+    resp_error(out, "ERR wrong number of arguments for '" + cmd.str() + "' command");
+}
+
+// 把n个unit_ms毫秒换算为毫秒; 乘积或者加上当前时间得到的到期时间会超出int64时返回false,
+// 与Redis一样回复 invalid expire time, 不让溢出的值进入跳表
+static bool expire_to_ms(int64_t n, int64_t unit_ms, int64_t *ms)
+{
+    if (n > (INT64_MAX - now_ms()) / unit_ms || n < INT64_MIN / unit_ms)
+    {
+        return false;
+    }
+    *ms = n * unit_ms;
+    return true;
+}
+
+// SCAN 的游标是下一个要返回的key的十六进制编码, "0" 表示从头开始或已经遍历完
+// 跳表是有序的, 用key作游标, 遍历期间插入和删除的key不会导致已返回的key重复返回
+static std::string encode_cursor(const std::string &key)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string cursor;
+    cursor.reserve(key.size() * 2);
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        unsigned char c = key[i];
+        cursor.push_back(digits[c >> 4]);
+        cursor.push_back(digits[c & 15]);
+    }
+    return cursor;
+}
+
+static bool decode_cursor(const StringRef &cursor, std::string *key)
+{
+    if (cursor.size() % 2 != 0)
+    {
+        return false;
+    }
+    key->clear();
+    for (size_t i = 0; i < cursor.size(); i += 2)
+    {
+        int v = 0;
+        for (int j = 0; j < 2; j++)
+        {
+            char c = cursor.data()[i + j];
+            int d = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1);
+            if (d < 0)
+            {
+                return false;
+            }
+            v = v * 16 + d;
+        }
+        key->push_back(static_cast<char>(v));
+    }
+    return true;
+}
+
+bool CommandTable::execute(const std::vector<StringRef> &args, std::string *out, std::string *scratch)
+{
+    const StringRef &cmd = args[0];
+    size_t argc = args.size();
+
+    // 最常用的GET和SET放在前面
+    if (resp_equals(cmd, "GET"))
+    {
+        if (argc != 2)
+        {
+            wrong_args(out, cmd);
+            return true;
+        }
+        // 在epoch临界区内直接把节点里的value编码进回复, 不拷贝出来
+        bool found = _store->search_element(args[1], [out](const std::string &value)
+                                            { resp_bulk(out, value); });
+        if (!found)
+        {
+            resp_null(out);
+        }
+    }
+    else if (resp_equals(cmd, "SET"))
+    {
+        set(args, out);
+    }
+    else if (resp_equals(cmd, "DEL"))
+    {
+        if (argc < 2)
+        {
+            wrong_args(out, cmd);
+            return true;
+        }
+        int64_t n = 0;
+        for (size_t i = 1; i < argc; i++)
+        {
+            n += _store->delete_element(args[i].str()) ? 1 : 0;
+        }
+        // delete_element 对不存在的key和WAL写入失败都返回false
+        if (n == static_cast<int64_t>(argc - 1) || !wal_failed(out))
+        {
+            resp_integer(out, n);
+        }
+    }
+    else if (resp_equals(cmd, "EXISTS"))
+    {
+        if (argc < 2)
+        {
+            wrong_args(out, cmd);
+            return true;
+        }
+        int64_t n = 0;
+        for (size_t i = 1; i < argc; i++)
+        {
+            n += _store->search_element(args[i], [](const std::string &) {}) ? 1 : 0;
+        }
+        resp_integer(out, n);
+    }
+    else if (resp_equals(cmd, "EXPIRE"))
+    {
+        expire(args, out, 1000);
+    }
+    else if (resp_equals(cmd, "PEXPIRE"))
+    {
+        expire(args, out, 1);
+    }
+    else if (resp_equals(cmd, "TTL") || resp_equals(cmd, "PTTL"))
+    {
+        if (argc != 2)
+        {
+            wrong_args(out, cmd);
+            return true;
+        }
+        int64_t ms = _store->pttl_element(args[1].str());
+        // 与Redis相同: 不存在为-2, 没有过期时间为-1, TTL把剩余的毫秒数四舍五入到秒
+        if (ms >= 0 && resp_equals(cmd, "TTL"))
+        {
+            ms = (ms + 500) / 1000;
+        }
+        resp_integer(out, ms);
+    }
+    else if (resp_equals(cmd, "SCAN"))
+    {
+        scan(args, out);
+    }
+    else if (resp_equals(cmd, "DBSIZE"))
+    {
+        resp_integer(out, _store->size());
+    }
+    else if (resp_equals(cmd, "SAVE"))
+    {
+        if (_store->dump_file())
+        {
+            resp_simple(out, "OK");
+        }
+        else if (_store->bgsave_in_progress())
+        {
+            resp_error(out, "ERR Background save already in progress");
+        }
+        else
+        {
+            resp_error(out, "ERR Failed to save the snapshot, see the server log");
+        }
+    }
+    else if (resp_equals(cmd, "BGSAVE"))
+    {
+        if (_store->bgsave())
+        {
+            resp_simple(out, "Background saving started");
+        }
+        else
+        {
+            resp_error(out, "ERR Background save already in progress or failed to start");
+        }
+    }
+    else if (resp_equals(cmd, "INFO"))
+    {
+        *scratch = _store->info();
+        resp_bulk(out, *scratch);
+    }
+    else if (resp_equals(cmd, "PING"))
+    {
+        if (argc > 1)
+        {
+            resp_bulk(out, args[1].data(), args[1].size());
+        }
+        else
+        {
+            resp_simple(out, "PONG");
+        }
+    }
+    else if (resp_equals(cmd, "ECHO"))
+    {
+        if (argc != 2)
+        {
+            wrong_args(out, cmd);
+            return true;
+        }
+        resp_bulk(out, args[1].data(), args[1].size());
+    }
+    else if (resp_equals(cmd, "SELECT"))
+    {
+        // 只有一个库
+        if (argc == 2 && resp_equals(args[1], "0"))
+        {
+            resp_simple(out, "OK");
+        }
+        else
+        {
+            resp_error(out, "ERR DB index is out of range");
+        }
+    }
+    else if (resp_equals(cmd, "CONFIG"))
+    {
+        // redis-benchmark 启动时会 CONFIG GET save/appendonly, 回复空数组即可
+        resp_array(out, 0);
+    }
+    else if (resp_equals(cmd, "QUIT"))
+    {
+        resp_simple(out, "OK");
+        return false;
+    }
+    else
+    {
+        resp_error(out, "ERR unknown command '" + cmd.str() + "'");
+    }
+    return true;
+}
+
+// SET key value [EX seconds | PX milliseconds]
+// 和Redis一样, 不带EX/PX时清除key原来的过期时间; 插入和过期时间在一次加锁内完成, 只写一条WAL记录
+void CommandTable::set(const std::vector<StringRef> &args, std::string *out)
+{
+    if (args.size() != 3 && args.size() != 5)
+    {
+        wrong_args(out, args[0]);
+        return;
+    }
+    int64_t ttl_ms = 0;
+    if (args.size() == 5)
+    {
+        int64_t n;
+        bool ex = resp_equals(args[3], "EX");
+        if (!ex && !resp_equals(args[3], "PX"))
+        {
+            resp_error(out, "ERR syntax error");
+            return;
+        }
+        if (!resp_to_int(args[4], &n))
+        {
+            resp_error(out, "ERR value is not an integer or out of range");
+            return;
+        }
+        if (n <= 0 || !expire_to_ms(n, ex ? 1000 : 1, &ttl_ms))
+        {
+            resp_error(out, "ERR invalid expire time in 'set' command");
+            return;
+        }
+    }
+    if (_store->set_element(args[1].str(), args[2].str(), ttl_ms) < 0)
+    {
+        if (!wal_failed(out))
+        {
+            resp_error(out, "OOM command not allowed when used memory > 'maxmemory'.");
+        }
+        return;
+    }
+    resp_simple(out, "OK");
+}
+
+void CommandTable::expire(const std::vector<StringRef> &args, std::string *out, int64_t unit_ms)
+{
+    int64_t n;
+    if (args.size() != 3)
+    {
+        wrong_args(out, args[0]);
+        return;
+    }
+    int64_t ms;
+    if (!resp_to_int(args[2], &n))
+    {
+        resp_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (!expire_to_ms(n, unit_ms, &ms))
+    {
+        std::string name = args[0].str();
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            name[i] = tolower(static_cast<unsigned char>(name[i]));
+        }
+        resp_error(out, "ERR invalid expire time in '" + name + "' command");
+        return;
+    }
+    bool ok = _store->pexpire_element(args[1].str(), ms);
+    if (ok || !wal_failed(out))
+    {
+        resp_integer(out, ok ? 1 : 0);
+    }
+}
+
+// 写操作返回失败时区分原因: WAL写入失败(WAL_SYNC_ALWAYS)时回复错误, 客户端不应认为修改已经持久化
+bool CommandTable::wal_failed(std::string *out)
+{
+    WriteAheadLog *wal = _store->get_wal();
+    if (wal == NULL || wal->error() == 0)
+    {
+        return false;
+    }
+    resp_error(out, "MISCONF Errors writing to the WAL, the write was applied in memory but may be lost on restart: " +
+                        std::string(strerror(wal->error())));
+    return true;
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]
+// 与Redis一样, COUNT是每次最多检查的key数, 经MATCH过滤后返回的key可能更少
+void CommandTable::scan(const std::vector<StringRef> &args, std::string *out)
+{
+    if (args.size() < 2 || args.size() % 2 != 0)
+    {
+        wrong_args(out, args[0]);
+        return;
+    }
+    std::string start;
+    bool from_first = resp_equals(args[1], "0");
+    if (!from_first && !decode_cursor(args[1], &start))
+    {
+        resp_error(out, "ERR invalid cursor");
+        return;
+    }
+    std::string pattern;
+    int64_t count = 10;
+    for (size_t i = 2; i < args.size(); i += 2)
+    {
+        if (resp_equals(args[i], "MATCH"))
+        {
+            pattern = args[i + 1].str();
+        }
+        else if (resp_equals(args[i], "COUNT") && resp_to_int(args[i + 1], &count) && count > 0)
+        {
+        }
+        else
+        {
+            resp_error(out, "ERR syntax error");
+            return;
+        }
+    }
+
+    std::vector<std::string> keys;
+    std::string next;
+    {
+        Store::Iterator it(_store);
+        if (from_first)
+        {
+            it.seek_to_first();
+        }
+        else
+        {
+            it.seek(start);
+        }
+        for (int64_t i = 0; i < count && it.valid(); i++, it.next())
+        {
+            if (pattern.empty() || fnmatch(pattern.c_str(), it.key().c_str(), 0) == 0)
+            {
+                keys.push_back(it.key());
+            }
+        }
+        if (it.valid())
+        {
+            next = encode_cursor(it.key());
+        }
+    }
+    resp_array(out, 2);
+    if (next.empty())
+    {
+        resp_bulk(out, "0", 1);
+    }
+    else
+    {
+        resp_bulk(out, next);
+    }
+    resp_array(out, keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        resp_bulk(out, keys[i]);
+    }
+}
+
+// 一个reactor线程: 自己的监听socket和epoll, 处理分到这个线程的连接
+class Reactor
+{
+public:
+    Reactor(CommandTable *commands, int id) : _commands(commands), _id(id), _listen_fd(-1), _epoll_fd(-1) {}
+    ~Reactor();
+
+    bool listen_on(int port);
+    void run();
+
+private:
+    void accept_all();
+    void on_readable(Connection *c);
+    bool flush(Connection *c);
+    void update_events(Connection *c);
+    void close_connection(Connection *c);
+
+    CommandTable *_commands;
+    int _id;
+    int _listen_fd;
+    int _epoll_fd;
+    std::unordered_set<Connection *> _connections;
+    std::vector<StringRef> _args;
+    std::string _scratch;
+};
+
+Reactor::~Reactor()
+{
+    for (std::unordered_set<Connection *>::iterator it = _connections.begin(); it != _connections.end(); ++it)
+    {
+        close((*it)->fd);
+        delete *it;
+    }
+    if (_listen_fd >= 0)
+    {
+        close(_listen_fd);
+    }
+    if (_epoll_fd >= 0)
+    {
+        close(_epoll_fd);
+    }
+}
+
+bool Reactor::listen_on(int port)
+{
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(_listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(_listen_fd, 1024) != 0)
+    {
+        LOG_ERROR("监听端口 " << port << " 失败, errno: " << errno);
+        return false;
+    }
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // 监听socket
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+    return true;
+}
+
+void Reactor::run()
+{
+    struct epoll_event events[EPOLL_BATCH];
+    while (!g_stop.load(memory_order_relaxed))
+    {
+        // 超时只是为了定期检查 g_stop
+        int n = epoll_wait(_epoll_fd, events, EPOLL_BATCH, 100);
+        for (int i = 0; i < n; i++)
+        {
+            Connection *c = static_cast<Connection *>(events[i].data.ptr);
+            if (c == NULL)
+            {
+                accept_all();
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                close_connection(c);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !flush(c))
+            {
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+            {
+                on_readable(c);
+            }
+        }
+    }
+}
+
+void Reactor::accept_all()
+{
+    while (true)
+    {
+        int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                LOG_WARN("reactor " << _id << " accept失败, errno: " << errno);
+            }
+            return;
+        }
+        // 回复是攒够一批才写的, 不需要Nagle再合并
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection *c = new Connection(fd);
+        _connections.insert(c);
+        c->events = EPOLLIN;
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+// 读一次, 执行读到的所有完整命令, 然后把这一批回复一起写出去
+void Reactor::on_readable(Connection *c)
+{
+    if (c->in.size() - c->in_end < READ_CHUNK)
+    {
+        c->in.resize(c->in_end + READ_CHUNK);
+    }
+    ssize_t n = read(c->fd, &c->in[c->in_end], c->in.size() - c->in_end);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        close_connection(c);
+        return;
+    }
+    if (n < 0)
+    {
+        return;
+    }
+    c->in_end += n;
+
+    size_t pos = 0;
+    while (!c->closing)
+    {
+        RespStatus st = c->parser.parse(&c->in[0], c->in_end, &pos, &_args);
+        if (st == RESP_INCOMPLETE)
+        {
+            break;
+        }
+        if (st == RESP_ERROR)
+        {
+            resp_error(&c->out, std::string("ERR Protocol error: ") + c->parser.error());
+            c->closing = true;
+            break;
+        }
+        if (!_args.empty() && !_commands->execute(_args, &c->out, &_scratch))
+        {
+            c->closing = true;
+        }
+    }
+    // 未解析完的半条命令移到缓冲区开头; 缓冲区因为大的value变得很大时, 用完后缩回去
+    if (pos > 0)
+    {
+        memmove(&c->in[0], &c->in[pos], c->in_end - pos);
+        c->in_end -= pos;
+    }
+    if (c->in_end == 0 && c->in.size() > 4 * READ_CHUNK)
+    {
+        std::vector<char>(READ_CHUNK).swap(c->in);
+    }
+    flush(c);
+}
+
+// 尽量写出输出缓冲区, 写不完时关注EPOLLOUT; 连接被关闭时返回false
+bool Reactor::flush(Connection *c)
+{
+    while (c->out_pos < c->out.size())
+    {
+        ssize_t n = write(c->fd, c->out.data() + c->out_pos, c->out.size() - c->out_pos);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            close_connection(c);
+            return false;
+        }
+        c->out_pos += n;
+    }
+    if (c->out_pos == c->out.size())
+    {
+        c->out.clear();
+        c->out_pos = 0;
+        if (c->closing)
+        {
+            close_connection(c);
+            return false;
+        }
+    }
+    update_events(c);
+    return true;
+}
+
+void Reactor::update_events(Connection *c)
+{
+    size_t pending = c->out.size() - c->out_pos;
+    uint32_t events = (pending > 0 ? (uint32_t)EPOLLOUT : 0u) | (pending < OUTPUT_LIMIT && !c->closing ? (uint32_t)EPOLLIN : 0u);
+    if (events != c->events)
+    {
+        c->events = events;
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+}
+
+void Reactor::close_connection(Connection *c)
+{
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    _connections.erase(c);
+    delete c;
+}
+
+static void on_signal(int)
+{
+    g_stop.store(true);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: kvserver [--option=value ...]\n"
+            "  --port=N            TCP port (6379)\n"
+            "  --threads=N         reactor threads (4)\n"
+            "  --max-level=N       skiplist max level (18)\n"
+            "  --maxmemory=BYTES   memory limit, 0 means unlimited (0)\n"
+            "  --policy=P          noeviction|volatile-lru|allkeys-lru|allkeys-lfu|volatile-ttl (noeviction)\n"
+            "  --wal=M             none|always|everyms (none)\n"
+            "  --io=M              snapshot/WAL writes: auto (io_uring, else pool)|pool|sync (auto)\n"
+            "  --load=0|1          load store/dumpFile and replay the WAL on start (0)\n"
+            "  --timing=0|1        record latency and lock timing for INFO (0)\n");
+}
+
+static bool parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (name == "port")
+            opt.port = atoi(value.c_str());
+        else if (name == "threads")
+            opt.threads = atoi(value.c_str());
+        else if (name == "max-level")
+            opt.max_level = atoi(value.c_str());
+        else if (name == "maxmemory")
+            opt.maxmemory = strtoull(value.c_str(), NULL, 10);
+        else if (name == "policy")
+            opt.policy = value;
+        else if (name == "wal")
+            opt.wal = value;
+        else if (name == "io")
+            opt.io = value;
+        else if (name == "load")
+            opt.load = value == "1";
+        else if (name == "timing")
+            opt.timing = atoi(value.c_str());
+        else
+            return false;
+    }
+    return opt.threads > 0 && opt.port > 0;
+}
+
+static MaxmemoryPolicy parse_policy(const std::string &name)
+{
+    if (name == "volatile-lru")
+        return MAXMEMORY_VOLATILE_LRU;
+    if (name == "allkeys-lru")
+        return MAXMEMORY_ALLKEYS_LRU;
+    if (name == "allkeys-lfu")
+        return MAXMEMORY_ALLKEYS_LFU;
+    if (name == "volatile-ttl")
+        return MAXMEMORY_VOLATILE_TTL;
+    return MAXMEMORY_NOEVICTION;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse(argc, argv))
+    {
+        usage();
+        return 1;
+    }
+    set_async_io_mode(opt.io == "sync" ? ASYNC_IO_SYNC : opt.io == "pool" ? ASYNC_IO_POOL : ASYNC_IO_AUTO);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    Store store(opt.max_level > 0 ? opt.max_level : 18);
+    // 作为服务时不沿用演示用的 VOLATILE_LRU_THRESHOLD(8个带过期时间的key), 只按内存上限淘汰
+    store.set_maxmemory(opt.maxmemory, parse_policy(opt.policy));
+    if (opt.load)
+    {
+        store.load_file();
+    }
+    if (opt.wal != "none")
+    {
+        store.enable_wal(opt.wal == "always" ? WAL_SYNC_ALWAYS : WAL_SYNC_EVERY_MS);
+    }
+    store.enable_metrics_timing(opt.timing != 0);
+
+    CommandTable commands(&store);
+    std::vector<Reactor *> reactors;
+    for (int i = 0; i < opt.threads; i++)
+    {
+        reactors.push_back(new Reactor(&commands, i));
+        if (!reactors.back()->listen_on(opt.port))
+        {
+            return 1;
+        }
+    }
+    LOG_INFO("kvserver 监听端口 " << opt.port << ", " << opt.threads << " 个reactor线程, 持久化写入: " << async_io_backend());
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.threads; i++)
+    {
+        threads.push_back(std::thread(&Reactor::run, reactors[i]));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    for (size_t i = 0; i < reactors.size(); i++)
+    {
+        delete reactors[i];
+    }
+    LOG_INFO("kvserver 退出");
+    return 0;
+}
@@ -0,0 +1,353 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include "../string_ref.h"
+using namespace std;
+
+// Redis 序列化协议(RESP2)的解析和回复编码
+// 请求是批量字符串组成的数组: *<参数个数>\r\n $<长度>\r\n <参数>\r\n ...
+// 也接受telnet风格的内联命令: 以空格分隔参数的一行
+// 解析出的参数是指向输入缓冲区的 StringRef, 不拷贝; 缓冲区被修改前参数有效
+// 数组形式的命令不完整时, 解析器记住已经解析出的参数(相对命令开头的偏移), 读到更多数据后从断点继续,
+// 不从头重新解析, 一条很大的命令分成很多次读到时总的解析开销仍是线性的; 所以每个连接要有自己的解析器
+
+// 单个参数和参数个数的上限, 防止恶意的长度让缓冲区无限增长
+const int64_t RESP_MAX_BULK = 512 * 1024 * 1024;
+const int64_t RESP_MAX_ARGS = 1024 * 1024;
+const size_t RESP_MAX_INLINE = 64 * 1024;
+
+enum RespStatus
+{
+    RESP_OK,         // 解析出一个完整的命令
+    RESP_INCOMPLETE, // 数据还不完整, 等读到更多数据后从同一位置重新解析
+    RESP_ERROR       // 协议错误, 应当回复错误后关闭连接
+};
+
+// 从 buf[*pos, len) 解析一个命令, 成功时 *pos 移到命令之后
+// 空行被跳过, 返回 RESP_OK 且 args 为空
+// 返回 RESP_INCOMPLETE 时 *pos 不变, 调用者可以把 buf[*pos, len) 移到别处(比如缓冲区开头), 下次从新的位置传入同一段数据
+class RespParser
+{
+public:
+    RespParser() : _error(NULL), _count(-1), _next(0) {}
+
+    RespStatus parse(const char *buf, size_t len, size_t *pos, vector<StringRef> *args)
+    {
+        args->clear();
+        if (*pos >= len)
+        {
+            return RESP_INCOMPLETE;
+        }
+        if (_count >= 0 || buf[*pos] == '*')
+        {
+            return parse_multibulk(buf, len, pos, args);
+        }
+        return parse_inline(buf, len, pos, args);
+    }
+
+    const char *error() const { return _error; }
+
+private:
+    // 读取 [p, len) 中以\r\n结尾的整数, 成功时 *next 为\r\n之后的位置
+    RespStatus read_number(const char *buf, size_t len, size_t p, int64_t *value, size_t *next)
+    {
+        const char *cr = static_cast<const char *>(memchr(buf + p, '\r', len - p));
+        if (cr == NULL || cr + 1 >= buf + len)
+        {
+            // 数字不会太长, 攒了很多字节还没有\r说明格式不对
+            if (len - p > 32)
+            {
+                _error = "invalid length";
+                return RESP_ERROR;
+            }
+            return RESP_INCOMPLETE;
+        }
+        if (cr[1] != '\n' || cr == buf + p)
+        {
+            _error = "invalid length";
+            return RESP_ERROR;
+        }
+        bool negative = buf[p] == '-';
+        int64_t v = 0;
+        for (const char *c = buf + p + (negative ? 1 : 0); c < cr; c++)
+        {
+            if (*c < '0' || *c > '9' || v > RESP_MAX_BULK)
+            {
+                _error = "invalid length";
+                return RESP_ERROR;
+            }
+            v = v * 10 + (*c - '0');
+        }
+        *value = negative ? -v : v;
+        *next = cr + 2 - buf;
+        return RESP_OK;
+    }
+
+    // 以下的偏移都相对于命令开头 buf + *pos
+    RespStatus parse_multibulk(const char *buf, size_t len, size_t *pos, vector<StringRef> *args)
+    {
+        const char *start = buf + *pos;
+        size_t avail = len - *pos;
+        RespStatus st;
+        if (_count < 0)
+        {
+            int64_t count;
+            st = read_number(start, avail, 1, &count, &_next);
+            if (st != RESP_OK)
+            {
+                return st;
+            }
+            if (count > RESP_MAX_ARGS)
+            {
+                _error = "invalid multibulk length";
+                return RESP_ERROR;
+            }
+            _count = count < 0 ? 0 : count;
+            _spans.clear();
+        }
+        while (static_cast<int64_t>(_spans.size()) < _count)
+        {
+            // 只有参数的长度行可能被重复解析, 它不超过32字节
+            size_t p = _next;
+            if (p >= avail)
+            {
+                return RESP_INCOMPLETE;
+            }
+            if (start[p] != '$')
+            {
+                return fail("expected '$'");
+            }
+            int64_t n;
+            st = read_number(start, avail, p + 1, &n, &p);
+            if (st != RESP_OK)
+            {
+                if (st == RESP_ERROR)
+                {
+                    _count = -1;
+                }
+                return st;
+            }
+            if (n < 0 || n > RESP_MAX_BULK)
+            {
+                return fail("invalid bulk length");
+            }
+            if (avail - p < static_cast<size_t>(n) + 2)
+            {
+                return RESP_INCOMPLETE;
+            }
+            _spans.push_back(Span(p, n));
+            _next = p + n + 2;
+        }
+        for (size_t i = 0; i < _spans.size(); i++)
+        {
+            args->push_back(StringRef(start + _spans[i].first, _spans[i].second));
+        }
+        *pos += _next;
+        _count = -1;
+        _spans.clear();
+        return RESP_OK;
+    }
+
+    RespStatus fail(const char *error)
+    {
+        _error = error;
+        _count = -1;
+        return RESP_ERROR;
+    }
+
+    RespStatus parse_inline(const char *buf, size_t len, size_t *pos, vector<StringRef> *args)
+    {
+        const char *start = buf + *pos;
+        const char *nl = static_cast<const char *>(memchr(start, '\n', len - *pos));
+        if (nl == NULL)
+        {
+            if (len - *pos > RESP_MAX_INLINE)
+            {
+                _error = "too big inline request";
+                return RESP_ERROR;
+            }
+            return RESP_INCOMPLETE;
+        }
+        const char *end = nl > start && nl[-1] == '\r' ? nl - 1 : nl;
+        const char *p = start;
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+            {
+                p++;
+            }
+            const char *word = p;
+            while (p < end && *p != ' ' && *p != '\t')
+            {
+                p++;
+            }
+            if (p > word)
+            {
+                args->push_back(StringRef(word, p - word));
+            }
+        }
+        *pos = nl + 1 - buf;
+        return RESP_OK;
+    }
+
+    typedef pair<size_t, size_t> Span; // 参数的偏移和长度
+
+    const char *_error;
+    // 正在解析的数组命令的参数个数, 没有时为-1; _next 为下一个参数的偏移, _spans 为已经完整的参数
+    int64_t _count;
+    size_t _next;
+    vector<Span> _spans;
+};
+
+// 回复的编码, 追加到输出缓冲区
+
+inline void resp_simple(string *out, const char *s)
+{
+    out->push_back('+');
+    out->append(s);
+    out->append("\r\n");
+}
+
+inline void resp_error(string *out, const string &message)
+{
+    out->push_back('-');
+    out->append(message);
+    out->append("\r\n");
+}
+
+inline void resp_integer(string *out, int64_t v)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), ":%lld\r\n", static_cast<long long>(v));
+    out->append(buf, n);
+}
+
+inline void resp_bulk(string *out, const char *data, size_t size)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "$%zu\r\n", size);
+    out->append(buf, n);
+    out->append(data, size);
+    out->append("\r\n");
+}
+
+inline void resp_bulk(string *out, const string &s)
+{
+    resp_bulk(out, s.data(), s.size());
+}
+
+inline void resp_null(string *out)
+{
+    out->append("$-1\r\n");
+}
+
+inline void resp_array(string *out, size_t count)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "*%zu\r\n", count);
+    out->append(buf, n);
+}
+
+// 把命令编码为RESP数组, 供客户端(压测程序)使用
+inline void resp_command(string *out, const vector<StringRef> &args)
+{
+    resp_array(out, args.size());
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        resp_bulk(out, args[i].data(), args[i].size());
+    }
+}
+
+// 按字母不区分大小写比较命令名
+inline bool resp_equals(const StringRef &arg, const char *name)
+{
+    size_t n = strlen(name);
+    return arg.size() == n && strncasecmp(arg.data(), name, n) == 0;
+}
+
+// 把参数解析为整数, 只接受可选的负号和十进制数字, 超出int64范围时返回false
+inline bool resp_to_int(const StringRef &arg, int64_t *out)
+{
+    if (arg.empty() || arg.size() > 20)
+    {
+        return false;
+    }
+    bool negative = arg.data()[0] == '-';
+    size_t i = negative ? 1 : 0;
+    if (i == arg.size())
+    {
+        return false;
+    }
+    // 按无符号数累加, 负数的绝对值可以比 INT64_MAX 大1
+    uint64_t limit = negative ? static_cast<uint64_t>(INT64_MAX) + 1 : static_cast<uint64_t>(INT64_MAX);
+    uint64_t v = 0;
+    for (; i < arg.size(); i++)
+    {
+        char c = arg.data()[i];
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        uint64_t d = c - '0';
+        if (v > (limit - d) / 10)
+        {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    *out = negative ? -static_cast<int64_t>(v - 1) - 1 : static_cast<int64_t>(v);
+    return true;
+}
+
+// 读取一个完整回复的长度, 用于客户端跳过回复; 不完整时返回0, 格式错误返回 (size_t)-1
+// 只处理本服务器会发出的类型: 简单字符串, 错误, 整数, 批量字符串和由它们组成的(嵌套)数组
+inline size_t resp_reply_length(const char *buf, size_t len, size_t pos = 0)
+{
+    if (pos >= len)
+    {
+        return 0;
+    }
+    const char *cr = static_cast<const char *>(memchr(buf + pos, '\r', len - pos));
+    if (cr == NULL || cr + 1 >= buf + len)
+    {
+        return 0;
+    }
+    size_t line_end = cr + 2 - buf;
+    char type = buf[pos];
+    if (type == '+' || type == '-' || type == ':')
+    {
+        return line_end - pos;
+    }
+    long long n = atoll(buf + pos + 1);
+    if (type == '$')
+    {
+        if (n < 0)
+        {
+            return line_end - pos;
+        }
+        return len - line_end < static_cast<size_t>(n) + 2 ? 0 : line_end + n + 2 - pos;
+    }
+    if (type == '*')
+    {
+        size_t p = line_end;
+        for (long long i = 0; i < n; i++)
+        {
+            size_t m = resp_reply_length(buf, len, p);
+            if (m == 0 || m == static_cast<size_t>(-1))
+            {
+                return m;
+            }
+            p += m;
+        }
+        return p - pos;
+    }
+    return static_cast<size_t>(-1);
+}
+
+#endif
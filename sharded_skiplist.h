@@ -0,0 +1,491 @@
+#ifndef SHARDED_SKIPLIST_H
+#define SHARDED_SKIPLIST_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include "skiplist.h"
+using namespace std;
+
+// 分片方式
+// SHARD_HASH: 按key的哈希值分片, 负载均匀, 范围查询需要归并所有分片
+// SHARD_RANGE: 按给定的分割点把key的范围切成连续的几段, 范围查询只访问涉及到的分片,
+//              但key分布不均匀时各分片的负载也不均匀
+enum ShardMode
+{
+    SHARD_HASH,
+    SHARD_RANGE
+};
+
+// 把key分到N个相互独立的 SkipList 上, 每个分片有自己的锁, LRU, 过期堆, 快照文件和WAL,
+// 落在不同分片上的写操作可以在多个核上并行, 不再争抢同一把锁
+// 第i个分片的快照文件为 STORE_FILE.i, WAL为 WAL_FILE.i
+// 跨分片的操作(multi_get, write_batch, scan, dump_file等)逐个分片进行, 不是所有分片同一时刻的快照
+// Compare和KeyCodec原样传给每个分片; 按哈希分片时用 hash<K>, 要求Compare认为相等的key哈希值也相等
+//
+//   ShardedSkipList<int, string> list(8, 18);            // 按哈希分成8片
+//   ShardedSkipList<int, string> ranged({100, 200}, 18);  // (-, 100), [100, 200), [200, -) 三片
+template <typename K, typename V, typename Compare = less<K>, typename KeyCodec = Codec<K>>
+class ShardedSkipList
+{
+public:
+    ShardedSkipList(int shards, int max_level, ReclaimMode mode = RECLAIM_EPOCH, LruPolicy lru = LRU_EXACT,
+                    const Compare &compare = Compare());
+    // split_keys 严格递增, 第i个分片保存 [split_keys[i-1], split_keys[i]) 内的key, 共 split_keys.size() + 1 个分片
+    ShardedSkipList(const vector<K> &split_keys, int max_level, ReclaimMode mode = RECLAIM_EPOCH, LruPolicy lru = LRU_EXACT,
+                    const Compare &compare = Compare());
+    ~ShardedSkipList();
+
+    int insert_element(const K &, const V &);
+    int insert_element(const K &, V &&);
+    int set_element(const K &, const V &, int64_t milliseconds = 0);
+    int set_element(const K &, V &&, int64_t milliseconds = 0);
+    bool search_element(const K &, V *valptr = nullptr);
+    bool search_element(const K &, function<void(const V &)> callback);
+    int multi_get(const vector<K> &, vector<V> *, vector<bool> *found = nullptr);
+    bool delete_element(const K &);
+    int write_batch(const WriteBatch<K, V> &);
+    bool expire_element(const K &, int);
+    bool pexpire_element(const K &, int64_t);
+    int ttl_element(const K &);
+    int64_t pttl_element(const K &);
+    int scan(const K &, const K &, int, function<bool(const K &, const V &)>);
+    bool dump_file();
+    bool bgsave();
+    void wait_bgsave();
+    void load_file();
+    void enable_wal(WalSyncPolicy policy = WAL_SYNC_EVERY_MS, int interval_ms = 100);
+    int size();
+    void set_maxmemory(size_t, MaxmemoryPolicy);
+    void set_branching(Branching);
+    size_t used_memory();
+    uint64_t evicted_keys();
+    // 各分片的统计合并后的结果, 锁的统计是所有分片的锁之和
+    void enable_metrics_timing(bool on = true);
+    MetricsSnapshot metrics();
+    string info();
+    bool dump_metrics(const string &path);
+
+    int shard_count() const { return static_cast<int>(_shards.size()); }
+    // key所在的分片
+    int shard_of(const K &) const;
+    SkipList<K, V, Compare, KeyCodec> *shard(int i) { return _shards[i]; }
+
+private:
+    void init(int shards, int max_level, ReclaimMode mode, LruPolicy lru);
+
+private:
+    ShardMode _mode;
+    Compare _compare;
+    vector<K> _split_keys;
+    // 每个分片单独分配, 各自的锁在 SkipList 内部已填充到独占的cache line
+    vector<SkipList<K, V, Compare, KeyCodec> *> _shards;
+};
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+ShardedSkipList<K, V, Compare, KeyCodec>::ShardedSkipList(int shards, int max_level, ReclaimMode mode, LruPolicy lru,
+                                                          const Compare &compare)
+    : _mode(SHARD_HASH), _compare(compare)
+{
+    init(shards > 0 ? shards : 1, max_level, mode, lru);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+ShardedSkipList<K, V, Compare, KeyCodec>::ShardedSkipList(const vector<K> &split_keys, int max_level, ReclaimMode mode, LruPolicy lru,
+                                                          const Compare &compare)
+    : _mode(SHARD_RANGE), _compare(compare), _split_keys(split_keys)
+{
+    init(static_cast<int>(split_keys.size()) + 1, max_level, mode, lru);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::init(int shards, int max_level, ReclaimMode mode, LruPolicy lru)
+{
+    for (int i = 0; i < shards; i++)
+    {
+        SkipList<K, V, Compare, KeyCodec> *shard = new SkipList<K, V, Compare, KeyCodec>(max_level, mode, lru, _compare);
+        shard->set_store_file(string(STORE_FILE) + "." + to_string(i), string(WAL_FILE) + "." + to_string(i));
+        _shards.push_back(shard);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+ShardedSkipList<K, V, Compare, KeyCodec>::~ShardedSkipList()
+{
+    for (size_t i = 0; i < _shards.size(); i++)
+    {
+        delete _shards[i];
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::shard_of(const K &key) const
+{
+    if (_mode == SHARD_RANGE)
+    {
+        return static_cast<int>(upper_bound(_split_keys.begin(), _split_keys.end(), key, _compare) - _split_keys.begin());
+    }
+    // 整数key的哈希值就是它本身, 乘以黄金分割数打散后取高位, 避免key都是分片数的倍数时落到同一片
+    uint64_t h = static_cast<uint64_t>(hash<K>()(key)) * 0x9e3779b97f4a7c15ull;
+    return static_cast<int>((h >> 32) % _shards.size());
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::insert_element(const K &key, const V &value)
+{
+    return _shards[shard_of(key)]->insert_element(key, value);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::insert_element(const K &key, V &&value)
+{
+    return _shards[shard_of(key)]->insert_element(key, std::move(value));
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::set_element(const K &key, const V &value, int64_t milliseconds)
+{
+    return _shards[shard_of(key)]->set_element(key, value, milliseconds);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::set_element(const K &key, V &&value, int64_t milliseconds)
+{
+    return _shards[shard_of(key)]->set_element(key, std::move(value), milliseconds);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::search_element(const K &key, V *valptr)
+{
+    return _shards[shard_of(key)]->search_element(key, valptr);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::search_element(const K &key, function<void(const V &)> callback)
+{
+    return _shards[shard_of(key)]->search_element(key, callback);
+}
+
+// 按分片拆分后分别批量查询, 结果按keys中的顺序放回
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::multi_get(const vector<K> &keys, vector<V> *values, vector<bool> *found)
+{
+    if (values != NULL)
+    {
+        values->assign(keys.size(), V());
+    }
+    if (found != NULL)
+    {
+        found->assign(keys.size(), false);
+    }
+
+    vector<vector<size_t>> index(_shards.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        index[shard_of(keys[i])].push_back(i);
+    }
+
+    int count = 0;
+    vector<K> shard_keys;
+    vector<V> shard_values;
+    vector<bool> shard_found;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        if (index[s].empty())
+        {
+            continue;
+        }
+        shard_keys.clear();
+        for (size_t i = 0; i < index[s].size(); i++)
+        {
+            shard_keys.push_back(keys[index[s][i]]);
+        }
+        count += _shards[s]->multi_get(shard_keys, &shard_values, &shard_found);
+        for (size_t i = 0; i < index[s].size(); i++)
+        {
+            if (values != NULL)
+            {
+                (*values)[index[s][i]] = shard_values[i];
+            }
+            if (found != NULL)
+            {
+                (*found)[index[s][i]] = shard_found[i];
+            }
+        }
+    }
+    return count;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::delete_element(const K &key)
+{
+    return _shards[shard_of(key)]->delete_element(key);
+}
+
+// 按分片拆分后分别应用, 每个分片内的部分是原子的, 整批跨分片时不是
+// 有分片超出内存上限拒绝写入或WAL落盘失败时返回-1, 其他分片的部分仍会写入
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::write_batch(const WriteBatch<K, V> &batch)
+{
+    vector<WriteBatch<K, V>> parts(_shards.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        const typename WriteBatch<K, V>::Op &op = batch.ops()[i];
+        WriteBatch<K, V> &part = parts[shard_of(op.key)];
+        if (op.is_delete)
+        {
+            part.del(op.key);
+        }
+        else
+        {
+            part.put(op.key, op.value);
+        }
+    }
+
+    int ret = 0;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        if (!parts[s].empty() && _shards[s]->write_batch(parts[s]) != 0)
+        {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::expire_element(const K &key, int seconds)
+{
+    return _shards[shard_of(key)]->expire_element(key, seconds);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::pexpire_element(const K &key, int64_t milliseconds)
+{
+    return _shards[shard_of(key)]->pexpire_element(key, milliseconds);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::ttl_element(const K &key)
+{
+    return _shards[shard_of(key)]->ttl_element(key);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int64_t ShardedSkipList<K, V, Compare, KeyCodec>::pttl_element(const K &key)
+{
+    return _shards[shard_of(key)]->pttl_element(key);
+}
+
+// 与 SkipList::scan 相同, 按key的顺序访问 [start, end) 范围内最多limit个键值对
+// 按范围分片时依次遍历涉及到的分片; 按哈希分片时每个分片各自有序, 用最小堆对所有分片的迭代器做多路归并
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::scan(const K &start, const K &end, int limit, function<bool(const K &, const V &)> callback)
+{
+    int count = 0;
+    if (_mode == SHARD_RANGE)
+    {
+        for (int s = shard_of(start); s < shard_count(); s++)
+        {
+            // 这个分片的最小key已经不在范围内
+            if (s > 0 && !_compare(_split_keys[s - 1], end))
+            {
+                break;
+            }
+            for (typename SkipList<K, V, Compare, KeyCodec>::Iterator it = _shards[s]->seek(start); it.valid() && _compare(it.key(), end); it.next())
+            {
+                if (limit > 0 && count >= limit)
+                {
+                    return count;
+                }
+                count++;
+                if (!callback(it.key(), it.value()))
+                {
+                    return count;
+                }
+            }
+        }
+        return count;
+    }
+
+    // 迭代器存在期间处于epoch临界区内, 不能因为vector扩容被拷贝, 先预留好空间
+    vector<typename SkipList<K, V, Compare, KeyCodec>::Iterator> its;
+    its.reserve(_shards.size());
+    vector<int> heap;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        its.push_back(_shards[s]->seek(start));
+        if (its[s].valid())
+        {
+            heap.push_back(static_cast<int>(s));
+        }
+    }
+
+    // 堆顶是当前key最小的分片
+    auto later = [this, &its](int a, int b)
+    { return _compare(its[b].key(), its[a].key()); };
+    make_heap(heap.begin(), heap.end(), later);
+    while (!heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), later);
+        typename SkipList<K, V, Compare, KeyCodec>::Iterator &it = its[heap.back()];
+        if (!_compare(it.key(), end) || (limit > 0 && count >= limit))
+        {
+            break;
+        }
+        count++;
+        if (!callback(it.key(), it.value()))
+        {
+            break;
+        }
+        it.next();
+        if (it.valid())
+        {
+            push_heap(heap.begin(), heap.end(), later);
+        }
+        else
+        {
+            heap.pop_back();
+        }
+    }
+    return count;
+}
+
+// 有分片写入失败或正在进行后台快照时返回false, 其他分片照常写出
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::dump_file()
+{
+    bool ok = true;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        ok = _shards[s]->dump_file() && ok;
+    }
+    return ok;
+}
+
+// 每个分片各自fork一个子进程写快照, 有分片正在进行后台快照时它不会再开始, 返回false
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::bgsave()
+{
+    bool ok = true;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        ok = _shards[s]->bgsave() && ok;
+    }
+    return ok;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::wait_bgsave()
+{
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->wait_bgsave();
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::load_file()
+{
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->load_file();
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::enable_wal(WalSyncPolicy policy, int interval_ms)
+{
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->enable_wal(policy, interval_ms);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int ShardedSkipList<K, V, Compare, KeyCodec>::size()
+{
+    int n = 0;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        n += _shards[s]->size();
+    }
+    return n;
+}
+
+// 内存上限平均分给各个分片, 每个分片按自己的用量独立淘汰
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::set_maxmemory(size_t bytes, MaxmemoryPolicy policy)
+{
+    size_t per_shard = bytes == 0 ? 0 : max<size_t>(bytes / _shards.size(), 1);
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->set_maxmemory(per_shard, policy);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::set_branching(Branching branching)
+{
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->set_branching(branching);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+size_t ShardedSkipList<K, V, Compare, KeyCodec>::used_memory()
+{
+    size_t n = 0;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        n += _shards[s]->used_memory();
+    }
+    return n;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t ShardedSkipList<K, V, Compare, KeyCodec>::evicted_keys()
+{
+    uint64_t n = 0;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        n += _shards[s]->evicted_keys();
+    }
+    return n;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void ShardedSkipList<K, V, Compare, KeyCodec>::enable_metrics_timing(bool on)
+{
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        _shards[s]->enable_metrics_timing(on);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+MetricsSnapshot ShardedSkipList<K, V, Compare, KeyCodec>::metrics()
+{
+    MetricsSnapshot m;
+    for (size_t s = 0; s < _shards.size(); s++)
+    {
+        m.merge(_shards[s]->metrics());
+    }
+    return m;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+string ShardedSkipList<K, V, Compare, KeyCodec>::info()
+{
+    return format_info(metrics());
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool ShardedSkipList<K, V, Compare, KeyCodec>::dump_metrics(const string &path)
+{
+    return write_metrics_file(path, format_prometheus(metrics()));
+}
+
+#endif
@@ -7,242 +7,849 @@
 #include <cstring>
 #include <mutex>
 #include <fstream>
-#include <list>
-#include <unordered_map>
+#include <sstream>
+#include <vector>
 #include <time.h>
+#include <new>
+#include <cstdio>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <sys/wait.h>
+#include "arena.h"
+#include "logger.h"
+#include "epoch.h"
+#include "coding.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "cow_string.h"
+#include "string_ref.h"
+#include "key_prefix.h"
+#include "tower_keys.h"
+#include "random_level.h"
+#include "ttl.h"
+#include "lru.h"
+#include "maxmemory.h"
+#include "write_batch.h"
+#include "metrics.h"
 using namespace std;
 
 #define STORE_FILE "store/dumpFile"
 
+// 设置了过期时间的key最多保留的个数, 超出时按LRU淘汰
+// 调用 set_maxmemory() 之后改为按内存上限淘汰, 不再限制个数
 int VOLATILE_LRU_THRESHOLD = 8;
 
-mutex mtx; // 修改跳表时需要加锁
-string delimiter = ":";
-
-// LRU缓存类
-template <typename K, typename V>
-class LRU
+// 被删除节点的回收方式
+// RECLAIM_IMMEDIATE: 在锁内直接析构并放回空闲链表, 只适用于查询和修改不会并发的场景
+// RECLAIM_EPOCH: search_element 不加锁, 可能还有读者停在被删除的节点上,
+//                先记下删除时的epoch, 等所有读者都离开后再析构回收
+enum ReclaimMode
 {
-public:
-    int capacity;
-    list<pair<K, V>> l;
-    unordered_map<K, typename list<pair<K, V>>::iterator> m;
-
-public:
-    LRU(int c) : capacity(c){};
-    bool get(K, V *valptr = nullptr);
-    int put(K, V, K *delKeyPtr = nullptr);
-    void del(K);
+    RECLAIM_IMMEDIATE,
+    RECLAIM_EPOCH
 };
 
-// 获取数据，并将该数据放到 list 头部
-template <typename K, typename V>
-bool LRU<K, V>::get(K key, V *valptr)
+// 独占cache line的互斥锁, 每个跳表实例一把, 修改跳表时需要加锁
+// 前后各填充一个cache line而不是用alignas: C++11的new不保证超过16字节的对齐,
+// 多个实例(分片)的锁之间, 以及锁和相邻的频繁修改的成员之间都不会伪共享
+// set_timed(true) 后统计等待和持有锁的时间(见 metrics.h 的 LockStats), 统计只在锁内修改, 不需要原子操作
+class PaddedMutex
 {
-    if (m.find(key) != m.end())
-    {
-        pair<K, V> p = *(m[key]);
-        l.erase(m[key]);
-        l.push_front(p);
-        m[key] = l.begin();
-        *valptr = p.second;
-        return true;
-    }
-    else
+public:
+    PaddedMutex() : _timed(false), _hold_start(0) {}
+
+    void lock()
     {
-        return false;
+        if (!_timed.load(memory_order_relaxed))
+        {
+            _mtx.lock();
+            return;
+        }
+        // 没有竞争时只读一次时钟
+        uint64_t start = 0;
+        if (!_mtx.try_lock())
+        {
+            start = metrics_now_ns();
+            _mtx.lock();
+        }
+        _hold_start = metrics_now_ns();
+        _stats.acquisitions++;
+        _stats.wait.record(start != 0 ? _hold_start - start : 0);
+        _stats.contended += start != 0 ? 1 : 0;
     }
-}
 
-// 插入数据，如果 key 已存在，则更新，否则插入。并将它放置到 list 头部
-// 如果 list 中数据满了，移除其尾部数据。
-// 返回值为1代表正常插入数据, 没有出现溢出而删除元素的情况
-// 返回值为0代表元素已存在, 修改了其值
-// 返回值为-1代表有溢出, 先删除了一个元素, 那么此时这个元素也要相应地在跳表里被删除
-// 要删除的元素通过delKeyPtr传出去删
-template <typename K, typename V>
-int LRU<K, V>::put(K key, V value, K *delKeyPtr)
-{
-    if (m.find(key) != m.end())
+    void unlock()
     {
-        l.erase(m[key]);
-        l.push_front({key, value});
-        m[key] = l.begin();
-        return 0;
+        // 加锁时没有计时的不统计, 计时开关在持有锁期间改变也不会记错
+        if (_hold_start != 0)
+        {
+            _stats.hold.record(metrics_now_ns() - _hold_start);
+            _hold_start = 0;
+        }
+        _mtx.unlock();
     }
-    else
+
+    bool try_lock()
     {
-        if (l.size() >= capacity)
+        if (!_mtx.try_lock())
         {
-            auto last = l.back();
-            l.pop_back();
-            m.erase(last.first);
-            *delKeyPtr = last.first;
-            l.push_front(make_pair(key, value));
-            m.insert({key, l.begin()});
-            return -1;
+            return false;
         }
-        else
+        if (_timed.load(memory_order_relaxed))
         {
-            l.push_front({key, value});
-            m.insert({key, l.begin()});
-            return 1;
+            _hold_start = metrics_now_ns();
+            _stats.acquisitions++;
+            _stats.wait.record(0);
         }
+        return true;
     }
+
+    void set_timed(bool on) { _timed.store(on, memory_order_relaxed); }
+
+    // 调用者持有锁
+    const LockStats &stats() const { return _stats; }
+
+    // condition_variable 只接受 unique_lock<mutex>
+    mutex &native() { return _mtx; }
+
+private:
+    char _pad_before[CACHE_LINE_SIZE];
+    mutex _mtx;
+    atomic<bool> _timed;
+    uint64_t _hold_start;
+    LockStats _stats;
+    char _pad_after[CACHE_LINE_SIZE];
+};
+
+string delimiter = ":";
+
+// 把文本格式存盘文件中的字符串转为key/value
+inline bool parse_text(const string &str, string *out)
+{
+    *out = str;
+    return true;
 }
 
-template <typename K, typename V>
-void LRU<K, V>::del(K key)
+template <typename T>
+bool parse_text(const string &str, T *out)
 {
-    l.erase(m[key]);
-    m.erase(key);
+    istringstream iss(str);
+    iss >> *out;
+    return !iss.fail();
 }
 
 /*---------------------------------------------------------------------------------*/
 
 // 跳表中的节点类
+// 节点的next指针数组不再单独 new, 而是紧跟在 key/value 之后, 和节点一起从跳表的 Arena 中分配
+// 一个 level 层的节点占用 Node<K, V>::alloc_size(level) 字节, 通过 placement new 构造
 template <typename K, typename V>
 class Node
 {
 
 public:
-    Node() {}
-
-    Node(K k, V v, int);
+    // value按原样转发, 传入右值时移动进节点, 不拷贝
+    template <typename VV>
+    Node(const K &k, VV &&v, int);
 
     ~Node();
 
     // 成员函数后加const表示传入的this指针为const指针
     // 该函数不会对该类的(非静态)成员变量作任何改变
-    K get_key() const;
+    // 返回引用, 不拷贝; 不加锁的读者只能在epoch临界区内使用, value的引用在下一次更新后还能用到离开临界区
+    const K &get_key() const;
 
-    V get_value() const;
+    const V &get_value() const;
 
-    void set_value(V);
+    // 与 get_key / get_value 相同, 供迭代器使用
+    const K &key_ref() const { return key; }
+    const V &value_ref() const { return *value_ptr.load(memory_order_acquire); }
 
-    // 括号里的 * 表示next是一个指针
-    // 括号外的 Node<K, V>* 表示next指向的数据类型
-    // 跳表的每一层是一个特殊的链表,这个链表的每个节点可能有一个或多个next指针
-    // 这里next用于指向一个指针数组, 数组里都是Node节点的指针
-    Node<K, V> *(*next);
+    // 整体替换value, 不在原地修改: 不加锁的读者可能正在拷贝旧值, 原地赋值会让它读到释放了的内存
+    // 返回被替换下来的堆上的旧值, 由调用者等读者离开后释放; 旧值是节点内的初始value时返回NULL
+    template <typename VV>
+    V *replace_value(VV &&);
 
-    int node_level;
+    // 不加锁的读者通过 get_next 读取next指针, 持有_mtx的写者通过 set_next 把节点链入或摘除,
+    // 读者看到一个新节点时, 它的key/value和next数组一定已经初始化完成
+    // 启用 TowerKeys 时同时更新 next_keys 中缓存的key
+    Node<K, V> *get_next(int level) const { return __atomic_load_n(&next[level], __ATOMIC_ACQUIRE); }
+    void set_next(int level, Node<K, V> *node);
+
+    // 各层next所指节点的key, 见 tower_keys.h; 只有 TowerKeys<K>::enabled 时才有, 长度为 node_level + 1
+    const K *next_keys() const { return reinterpret_cast<const K *>(next + node_level + 1); }
+    K *next_keys() { return reinterpret_cast<K *>(next + node_level + 1); }
+
+    // 到期时间(毫秒), 0表示永久有效
+    // 查询不加锁, 所以用原子变量, 修改只在持有_mtx时进行
+    int64_t get_expire_at() const;
+
+    void set_expire_at(int64_t);
+
+    // 节点占用的内存: 节点本身加上key和value在堆上的内存
+    size_t memory_usage() const;
+
+    // 建立level级索引的节点需要的字节数
+    static size_t alloc_size(int level);
 
 private:
-    K key;
+    // 创建节点时的value, 第一次更新后不再使用, 节点析构时才释放
     V value;
+    // 当前的value, 指向 value 或更新时新分配的对象, 读者通过它读取
+    atomic<V *> value_ptr;
+    atomic<int64_t> expire_at;
+
+public:
+    // LRU链表指针和CLOCK访问标记, 由 IntrusiveLRU 维护
+    Node<K, V> *lru_prev;
+    Node<K, V> *lru_next;
+    bool lru_linked;
+    atomic<uint8_t> lru_ref;
+
+    // key的前缀(见 key_prefix.h), 构造后不再修改, 查找时先比较它
+    // 放在next数组前面, 和next指针通常在同一个cache line里; 不缓存前缀的key类型只占一个字节, 落在已有的填充里
+    typename KeyPrefix<K>::type prefix;
+
+    // LFU计数器, 格式见 maxmemory.h
+    atomic<uint32_t> lfu;
+
+private:
+    // key放在next数组前面: 查找时比较完key紧接着读next指针, 通常只访问节点的一个cache line
+    K key;
+
+public:
+    int node_level;
+
+    // 跳表的每一层是一个特殊的链表,这个链表的每个节点可能有一个或多个next指针
+    // next[i]代表当前节点在第i层的下一个节点, 数组实际长度为 node_level + 1
+    // 声明为长度1的数组, 其余元素占用节点后面多分配出的空间, 再往后是 next_keys
+    Node<K, V> *next[1];
 };
 
 // 跳表节点的构造函数
 // 每次使用函数构造一个节点之前, 要先通过调用SkipList<K, V>::get_random_level()方法
 // 以得知应该为该节点建立几级索引, 级数就通过level参数传入
+// 调用者需要先按 alloc_size(level) 分配好内存
 template <typename K, typename V>
-Node<K, V>::Node(const K k, const V v, int level)
+template <typename VV>
+Node<K, V>::Node(const K &k, VV &&v, int level) : value(std::forward<VV>(v)), value_ptr(&value), expire_at(0),
+                                                              lru_prev(NULL), lru_next(NULL), lru_linked(false), lru_ref(0),
+                                                              prefix(KeyPrefix<K>::of(k)), lfu(lfu_init()), key(k), node_level(level)
 {
-    this->key = k;
-    this->value = v;
-    this->node_level = level;
-
-    // next指向一个大小为level+1的指针数组
-    // this->next[i]代表当前节点在第i层的下一个节点
-    // 也就是说, 如果一个节点在跳表的每一层都出现的话
+    // 如果一个节点在跳表的每一层都出现的话
     // 那么这个节点在每一层都应该有一个next指针,指向该层链表的下一个节点
     // 每个节点应该建立的索引级数为传入的level参数
-    // 所以这个节点的next数组大小自然就是level + 1
-    this->next = new Node<K, V> *[level + 1];
-
-    // 数组元素以0(NULL)初始化
-    memset(this->next, 0, sizeof(Node<K, V> *) * (level + 1));
+    // 所以这个节点的next数组大小自然就是level + 1, 数组元素以0(NULL)初始化
+    for (int i = 0; i <= level; i++)
+    {
+        this->next[i] = NULL;
+        TowerKeys<K>::clear(next_keys(), i);
+    }
 };
 
+// next数组和节点一起分配, 这里不需要释放
 template <typename K, typename V>
 Node<K, V>::~Node()
 {
-    delete[] next;
+    V *current = value_ptr.load(memory_order_relaxed);
+    if (current != &value)
+    {
+        delete current;
+    }
 };
 
 template <typename K, typename V>
-K Node<K, V>::get_key() const
+size_t Node<K, V>::memory_usage() const
+{
+    size_t n = alloc_size(node_level) + heap_usage(key) + heap_usage(value);
+    const V *current = value_ptr.load(memory_order_relaxed);
+    if (current != &value)
+    {
+        n += sizeof(V) + heap_usage(*current);
+    }
+    return n;
+}
+
+template <typename K, typename V>
+size_t Node<K, V>::alloc_size(int level)
+{
+    return sizeof(Node<K, V>) + sizeof(Node<K, V> *) * level + TowerKeys<K>::size(level);
+}
+
+// 先写缓存的key再发布指针; 读者可能看到新指针和旧key, 或者旧指针和新key, 缓存的key只用来跳过层, 不会因此查错
+template <typename K, typename V>
+void Node<K, V>::set_next(int level, Node<K, V> *node)
+{
+    if (TowerKeys<K>::enabled)
+    {
+        if (node != NULL)
+        {
+            TowerKeys<K>::store(next_keys(), level, node->key);
+        }
+        else
+        {
+            TowerKeys<K>::clear(next_keys(), level);
+        }
+    }
+    __atomic_store_n(&next[level], node, __ATOMIC_RELEASE);
+}
+
+template <typename K, typename V>
+const K &Node<K, V>::get_key() const
 {
     return key;
 };
 
 template <typename K, typename V>
-V Node<K, V>::get_value() const
+const V &Node<K, V>::get_value() const
 {
-    return value;
+    return *value_ptr.load(memory_order_acquire);
 };
+
 template <typename K, typename V>
-void Node<K, V>::set_value(V value)
+template <typename VV>
+V *Node<K, V>::replace_value(VV &&v)
 {
-    this->value = value;
+    V *old = value_ptr.exchange(new V(std::forward<VV>(v)), memory_order_acq_rel);
+    return old == &value ? NULL : old;
 };
 
+template <typename K, typename V>
+int64_t Node<K, V>::get_expire_at() const
+{
+    return expire_at.load(memory_order_acquire);
+}
+
+template <typename K, typename V>
+void Node<K, V>::set_expire_at(int64_t t)
+{
+    expire_at.store(t, memory_order_release);
+}
+
 /*---------------------------------------------------------------------------------*/
 
 // skiplist类
-template <typename K, typename V>
+// key的顺序由Compare决定, 默认为 less<K>; 互不小于对方的两个key视为同一个key, 不再要求K支持==
+// Compare是透明比较器(定义了 is_transparent, 如 StringLess)时, search_element 和 seek 还接受与K可比较的其他类型,
+// 查找时不用构造临时的K: SkipList<string, string, StringLess> 可以直接用 StringRef 或 const char* 查找
+// 快照和WAL中的key用KeyCodec编解码, 默认为 Codec<K>, 需要不同的磁盘格式时可以换成自定义的编解码器
+template <typename K, typename V, typename Compare = less<K>, typename KeyCodec = Codec<K>>
 class SkipList
 {
 
 public:
-    SkipList(int);
+    class Iterator;
+
+    SkipList(int, ReclaimMode mode = RECLAIM_EPOCH, LruPolicy lru = LRU_EXACT, const Compare &compare = Compare());
     ~SkipList();
     int get_random_level();
-    Node<K, V> *create_node(K, V, int);
-    int insert_element(K, V);
+    // 新节点升高一层的概率, 默认为1/2; 只影响之后插入的节点, 最好在插入数据前设置
+    // 最大层数可以按预计的key个数用 max_level_for() 算出
+    void set_branching(Branching branching) { _branching = branching; }
+    Branching get_branching() const { return _branching; }
+    template <typename VV>
+    Node<K, V> *create_node(const K &, VV &&, int);
+    // WAL_SYNC_ALWAYS 下日志写入或fsync失败时, 写操作返回失败: insert_element / write_batch 返回-1,
+    // delete_element / expire_element 返回false; 修改已在内存中生效, 但不保证重启后还在, 原因见 get_wal()->error()
+    // 传入右值的value直接移动进节点, 整个插入过程不拷贝value
+    int insert_element(const K &, const V &);
+    int insert_element(const K &, V &&);
+    // 与Redis的SET相同: 插入或覆盖key, milliseconds大于0时同时设置过期时间, 为0时清除原来的过期时间
+    // 插入和过期时间在一次加锁内完成, 写一条WAL记录, 读者不会看到没有过期时间的中间状态; 返回值同 insert_element
+    int set_element(const K &, const V &, int64_t milliseconds = 0);
+    int set_element(const K &, V &&, int64_t milliseconds = 0);
     void display_list();
-    bool search_element(K, V *valptr = nullptr);
-    bool delete_element(K);
-    void expire_element(K, int);
-    int ttl_element(K);
-    void dump_file();
+    bool search_element(const K &, V *valptr = nullptr);
+    // 找到时在epoch临界区内把节点中value的引用交给callback, 不拷贝value; callback里不能修改跳表
+    bool search_element(const K &, function<void(const V &)> callback);
+    template <typename Q, typename C = Compare, typename = typename C::is_transparent>
+    bool search_element(const Q &, V *valptr = nullptr);
+    template <typename Q, typename C = Compare, typename = typename C::is_transparent>
+    bool search_element(const Q &, function<void(const V &)> callback);
+    int multi_get(const vector<K> &, vector<V> *, vector<bool> *found = nullptr);
+    bool delete_element(const K &);
+    int write_batch(const WriteBatch<K, V> &);
+    // key不存在时返回false
+    bool expire_element(const K &, int);
+    bool pexpire_element(const K &, int64_t);
+    int ttl_element(const K &);
+    int64_t pttl_element(const K &);
+    // 快照写入失败或后台快照正在进行时返回false
+    bool dump_file();
+    bool bgsave();
+    void wait_bgsave();
+    bool bgsave_in_progress();
+    SnapshotStats last_snapshot();
     void load_file();
+    void enable_wal(WalSyncPolicy policy = WAL_SYNC_EVERY_MS, int interval_ms = 100);
+    void set_store_file(const string &, const string &);
+    WriteAheadLog *get_wal();
+    // 不加锁, 可以与写操作并发调用
     int size();
+    void display_lru();
+    int lru_size();
+    int lru_capacity();
+    void set_maxmemory(size_t, MaxmemoryPolicy);
+    size_t used_memory();
+    uint64_t evicted_keys();
+    Iterator seek(const K &);
+    template <typename Q, typename C = Compare, typename = typename C::is_transparent>
+    Iterator seek(const Q &);
+    int scan(const K &, const K &, int, function<bool(const K &, const V &)>);
+    // 运行统计, 见 metrics.h; 计数一直开启, 延迟和锁的计时需要先调用 enable_metrics_timing()
+    void enable_metrics_timing(bool on = true);
+    MetricsSnapshot metrics();
+    string info();
+    bool dump_metrics(const string &path);
 
 private:
     void get_key_value_from_string(const string &str, string *key, string *value);
     bool is_valid_string(const string &str);
-    int isExpire(K);
+    void load_text_file();
+    void load_snapshot(SnapshotReader &);
+    bool write_snapshot(SnapshotWriter &);
+    void finish_bgsave(pid_t, int, chrono::steady_clock::time_point, bool);
+    int isExpire(const K &);
+    static bool is_expired(const Node<K, V> *, int64_t);
+    bool expire_if_needed(const K &);
+    template <typename Q, typename F>
+    bool find_value(const Q &, F);
+    template <typename VV>
+    int insert_impl(const K &, VV &&, bool set_ttl, int64_t expire_at);
+    template <typename Q>
+    Node<K, V> *find_node(const Q &) const;
+    // node是第一个不小于key的节点时, 判断它的key与key是否相等
+    template <typename Q>
+    bool key_matches(const Node<K, V> *node, const Q &key) const { return node != NULL && !_compare(key, node->key_ref()); }
+    // 查找时先算出key的前缀, 与节点中缓存的前缀比较, Compare不是按字节比较时不使用前缀
+    typedef typename KeyPrefix<K>::type Prefix;
+    template <typename Q>
+    Prefix prefix_of(const Q &key) const { return prefix_of(key, integral_constant<bool, BytewiseCompare<K, Compare>::value>()); }
+    template <typename Q>
+    static Prefix prefix_of(const Q &key, true_type) { return KeyPrefix<K>::of(key); }
+    template <typename Q>
+    static Prefix prefix_of(const Q &, false_type) { return Prefix(); }
+    template <typename Q>
+    bool node_less(const Node<K, V> *, const Q &, const Prefix &) const;
+    // 按节点中缓存的各层下一个key(见 tower_keys.h)判断, 不访问后继节点; 未启用时不作判断
+    template <typename Q>
+    int tower_level(const Node<K, V> *, int, const Q &) const;
+    template <typename Q>
+    int tower_level(const Node<K, V> *, int, const Q &, true_type) const;
+    template <typename Q>
+    static int tower_level(const Node<K, V> *, int level, const Q &, false_type) { return level; }
+    template <typename Q>
+    bool tower_may_less(const Node<K, V> *, int, const Q &) const;
+    template <typename Q>
+    bool tower_may_less(const Node<K, V> *, int, const Q &, true_type) const;
+    template <typename Q>
+    static bool tower_may_less(const Node<K, V> *, int, const Q &, false_type) { return true; }
+    template <typename Q>
+    Node<K, V> *find_greater_or_equal(const Q &) const;
+    template <typename Q>
+    Node<K, V> *find_less_than(const Q &) const;
+    Node<K, V> *find_last() const;
+    void find_predecessors(const K &, Node<K, V> **) const;
+    int find_predecessors_from(const K &, Node<K, V> **) const;
+    // multi_get 按前 MULTI_GET_SAMPLE 个key决定是否改为同时查找 MULTI_GET_LANES 个key
+    static const size_t MULTI_GET_SAMPLE = 8;
+    static const int MULTI_GET_LANES = 8;
+    void find_nodes_interleaved(const vector<K> &, const size_t *, size_t, Node<K, V> **) const;
+    template <typename VV>
+    int put_element(const K &, VV &&);
+    template <typename VV>
+    int put_element_at(const K &, VV &&, Node<K, V> **);
+    bool set_expire(const K &, int64_t);
+    void clear_expire(const K &);
+    int expire_cycle(int64_t, int);
+    void expire_loop();
+    bool erase_element(const K &);
+    bool erase_element_at(const K &, Node<K, V> **);
+    void free_node(Node<K, V> *);
+    void recycle_node(Node<K, V> *);
+    void reclaim_nodes();
+    void retire_value(V *);
+    int get_level() const { return __atomic_load_n(&_skip_list_level, __ATOMIC_ACQUIRE); }
+    void set_level(int level) { __atomic_store_n(&_skip_list_level, level, __ATOMIC_RELEASE); }
+    bool tracks_all_keys() const;
+    bool record_access(Node<K, V> *);
+    bool reserve_memory();
+    bool evict_one();
+    uint64_t log_insert(const K &, const V &);
+    uint64_t log_delete(const K &);
+    uint64_t log_expire(const K &, int64_t);
+    uint64_t log_insert_expire(const K &, const V &, int64_t);
+    uint64_t log_batch(const WriteBatch<K, V> &);
+    static void encode_insert(const K &, const V &, string *);
+    bool wait_durable(uint64_t);
+    void replay_wal();
+    void apply_wal_record(WalRecordType, const char *, size_t);
 
 private:
+    // key的比较器
+    Compare _compare;
+
+    // 修改跳表时需要持有的锁, 每个实例一把, 多个实例(如 ShardedSkipList 的各个分片)的写操作互不阻塞
+    PaddedMutex _mtx;
+
     // 跳表的最大层数
     int _max_level;
 
+    // 新节点升高一层的概率
+    Branching _branching;
+
     // 跳表当前所在的层数, 构造函数会初始化为0
+    // 持有_mtx的写者通过 set_level 修改, 不加锁的读者通过 get_level 读取
     int _skip_list_level;
 
     // 跳表头节点指针
     Node<K, V> *_header;
 
     // 跳表当前元素个数, 构造函数会初始化为0
-    int _element_count;
+    // 只在持有_mtx时修改, size() 不加锁读取, 可能与其他线程的写操作同时进行
+    atomic<int> _element_count;
+
+    // 节点内存池, 跳表析构时整体释放
+    Arena _arena;
+
+    // 被删除节点的回收方式
+    ReclaimMode _reclaim_mode;
+
+    // 按层数分类的空闲节点链表, _free_lists[i] 里是可重新用于i层节点的内存
+    // 空闲内存的前8个字节存放链表中下一块内存的地址
+    vector<void *> _free_lists;
+
+    // 等待epoch推进后才能回收的节点, 以及它们被删除时的epoch
+    vector<pair<Node<K, V> *, uint64_t>> _retired_nodes;
+    // 被更新替换下来的旧value, 同样等读者离开后再释放
+    vector<pair<V *, uint64_t>> _retired_values;
+
+    // 过期时间记录在节点里, 这里按到期时间索引设置了过期时间的key, 由后台线程主动清理到期的key
+    // 以下成员都由_mtx保护
+    ExpireHeap<K> _expire_heap;
+    // 设置了过期时间的key的个数, 堆中条目远多于它时说明失效条目太多, 需要重建堆
+    int _volatile_count;
+    thread _expire_thread;
+    condition_variable _expire_cv;
+    bool _expire_stop;
+
+    // 快照文件和WAL文件的路径, 默认为 STORE_FILE 和 WAL_FILE
+    string _store_file;
+    string _wal_file;
+
+    // 文件描述符, 用于读取旧版本的文本格式存盘文件
+    ifstream _file_reader;
 
-    // 用于存放设置了过期时间的key对应的时间, pair的第一项为过期时间, pair的第二项为设置时的时间
-    // 比如: pair第二项为1000秒, 过期时间为5秒, 则获取系统时间得到的值大于1005秒的时候就过期了
-    unordered_map<K, pair<int, time_t>> expire_key_mp;
+    // 预写日志, 调用enable_wal()后才会创建
+    WriteAheadLog *_wal;
 
-    // 文件描述符, 用于将数据存盘到本地
-    ofstream _file_writer;
-    ifstream _file_reader;
+    // 正在从快照和WAL恢复数据, 此时的修改不需要再写WAL
+    bool _replaying;
+
+    // 后台快照: 等待子进程结束的线程, 是否正在进行, 以及最近一次快照的结果
+    // _bgsave_running 和 _last_snapshot 由_mtx保护
+    thread _bgsave_thread;
+    bool _bgsave_running;
+    SnapshotStats _last_snapshot;
+
+    // 淘汰候选key按访问顺序串成的LRU链表, 链表指针在节点里
+    // 默认只包含设置了过期时间的key, ALLKEYS_* 策略下包含所有key
+    IntrusiveLRU<Node<K, V>> _lru;
+
+    // 内存上限(字节), 0表示不限制
+    size_t _maxmemory;
+    // 查询不加锁时也会读取, 所以用原子变量
+    atomic<MaxmemoryPolicy> _maxmemory_policy;
+    // 所有节点占用的内存, 按 Node::memory_usage() 统计, 由_mtx保护
+    size_t _used_memory;
+    uint64_t _evicted_keys;
 
+    // 操作次数和延迟等计数, 各线程分开累加, 不需要_mtx
+    Metrics _metrics;
+};
+
+// 按key有序遍历跳表的迭代器, 不拷贝key和value
+// 遍历不加锁, 可以与插入和删除并发: 迭代器存在期间处于epoch临界区内, 它停留的节点即使被删除也不会被回收,
+// 删除的节点保留next指针, 所以仍能继续向后走; 并发插入的key可能被遍历到, 也可能遍历不到
+// 已到期但还未被清理的key会被跳过
+// 迭代器只能在创建它的线程中使用, 持有迭代器期间被删除的节点都不能回收, 不要长时间持有
+// RECLAIM_IMMEDIATE 模式下不能与删除并发使用
+//
+//   for (SkipList<K, V>::Iterator it = list.seek(start); it.valid(); it.next()) { it.key(); it.value(); }
+//   SkipList<K, V>::Iterator it(&list);
+//   for (it.seek_to_last(); it.valid(); it.prev()) { ... }
+template <typename K, typename V, typename Compare, typename KeyCodec>
+class SkipList<K, V, Compare, KeyCodec>::Iterator
+{
 public:
-    // 设置了过期时间键值对的LRU缓存
-    LRU<K, V> *lruCache;
+    // 创建后处于无效位置, 需要先调用seek系列函数
+    explicit Iterator(const SkipList<K, V, Compare, KeyCodec> *list);
+    Iterator(const Iterator &other);
+    Iterator &operator=(const Iterator &other);
+    ~Iterator();
+
+    bool valid() const { return _node != NULL; }
+
+    // 以下函数要求 valid() 为true
+    // 返回的引用在迭代器移动之前有效
+    const K &key() const { return _node->key_ref(); }
+    const V &value() const { return _node->value_ref(); }
+    void next();
+    // 向前移动需要从头节点重新查找, 复杂度为O(log n)
+    void prev();
+
+    // 定位到第一个大于等于target的key
+    void seek(const K &target) { seek_impl(target); }
+    // 定位到最后一个小于等于target的key
+    void seek_for_prev(const K &target) { seek_for_prev_impl(target); }
+    // 透明比较器下可以用与K可比较的其他类型定位
+    template <typename Q, typename C = Compare, typename = typename C::is_transparent>
+    void seek(const Q &target) { seek_impl(target); }
+    template <typename Q, typename C = Compare, typename = typename C::is_transparent>
+    void seek_for_prev(const Q &target) { seek_for_prev_impl(target); }
+    void seek_to_first();
+    void seek_to_last();
+
+private:
+    template <typename Q>
+    void seek_impl(const Q &target);
+    template <typename Q>
+    void seek_for_prev_impl(const Q &target);
+    // 从node开始向后跳过已到期的节点
+    void skip_expired_forward(Node<K, V> *node);
+    // 从node开始向前跳过已到期的节点
+    void skip_expired_backward(Node<K, V> *node);
+
+private:
+    const SkipList<K, V, Compare, KeyCodec> *_list;
+    Node<K, V> *_node;
 };
 
-// 创建一个新的节点
-template <typename K, typename V>
-Node<K, V> *SkipList<K, V>::create_node(const K k, const V v, int level)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SkipList<K, V, Compare, KeyCodec>::Iterator::Iterator(const SkipList<K, V, Compare, KeyCodec> *list) : _list(list), _node(NULL)
+{
+    EpochDomain::instance().enter();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SkipList<K, V, Compare, KeyCodec>::Iterator::Iterator(const Iterator &other) : _list(other._list), _node(other._node)
+{
+    EpochDomain::instance().enter();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+typename SkipList<K, V, Compare, KeyCodec>::Iterator &SkipList<K, V, Compare, KeyCodec>::Iterator::operator=(const Iterator &other)
+{
+    _list = other._list;
+    _node = other._node;
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SkipList<K, V, Compare, KeyCodec>::Iterator::~Iterator()
+{
+    EpochDomain::instance().exit();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::skip_expired_forward(Node<K, V> *node)
 {
-    Node<K, V> *n = new Node<K, V>(k, v, level);
+    int64_t now = 0;
+    while (node != NULL && node->get_expire_at() != 0)
+    {
+        if (now == 0)
+        {
+            now = now_ms();
+        }
+        if (!is_expired(node, now))
+        {
+            break;
+        }
+        node = node->get_next(0);
+    }
+    _node = node;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::skip_expired_backward(Node<K, V> *node)
+{
+    int64_t now = now_ms();
+    while (node != _list->_header && is_expired(node, now))
+    {
+        node = _list->find_less_than(node->key_ref());
+    }
+    _node = node == _list->_header ? NULL : node;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::next()
+{
+    skip_expired_forward(_node->get_next(0));
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::prev()
+{
+    skip_expired_backward(_list->find_less_than(_node->key_ref()));
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::seek_impl(const Q &target)
+{
+    skip_expired_forward(_list->find_greater_or_equal(target));
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::seek_for_prev_impl(const Q &target)
+{
+    Node<K, V> *node = _list->find_greater_or_equal(target);
+    if (_list->key_matches(node, target))
+    {
+        skip_expired_backward(node);
+    }
+    else
+    {
+        skip_expired_backward(_list->find_less_than(target));
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::seek_to_first()
+{
+    skip_expired_forward(_list->_header->get_next(0));
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::Iterator::seek_to_last()
+{
+    skip_expired_backward(_list->find_last());
+}
+
+// 创建一个新的节点, 优先复用同层数的空闲节点, 否则从内存池中分配
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename VV>
+Node<K, V> *SkipList<K, V, Compare, KeyCodec>::create_node(const K &k, VV &&v, int level)
+{
+    void *mem = _free_lists[level];
+    if (mem != NULL)
+    {
+        _free_lists[level] = *reinterpret_cast<void **>(mem);
+    }
+    else
+    {
+        mem = _arena.allocate(Node<K, V>::alloc_size(level), alignof(Node<K, V>));
+    }
+    Node<K, V> *n = new (mem) Node<K, V>(k, std::forward<VV>(v), level);
+    _used_memory += n->memory_usage();
+    if (tracks_all_keys())
+    {
+        _lru.link(n);
+    }
     return n;
 }
 
+// 回收被摘除的节点, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::free_node(Node<K, V> *node)
+{
+    // 等待回收的节点最多 EPOCH_COLLECT_THRESHOLD 个左右, 摘除时就不再计入内存,
+    // 否则淘汰时内存迟迟不下降, 会多淘汰很多key
+    _used_memory -= node->memory_usage();
+    _lru.unlink(node);
+    if (_reclaim_mode == RECLAIM_IMMEDIATE)
+    {
+        // LRU的读缓冲里可能还有这个节点, 内存被复用之前要先处理掉
+        _lru.flush();
+        recycle_node(node);
+        return;
+    }
+
+    _retired_nodes.push_back(make_pair(node, EpochDomain::instance().current()));
+    if (_retired_nodes.size() >= EPOCH_COLLECT_THRESHOLD)
+    {
+        reclaim_nodes();
+    }
+}
+
+// 析构节点并把内存挂到对应层数的空闲链表上
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::recycle_node(Node<K, V> *node)
+{
+    int level = node->node_level;
+    node->~Node<K, V>();
+    void *mem = node;
+    *reinterpret_cast<void **>(mem) = _free_lists[level];
+    _free_lists[level] = mem;
+}
+
+// 回收所有读者都已离开的节点, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::reclaim_nodes()
+{
+    EpochDomain &domain = EpochDomain::instance();
+    domain.try_advance();
+
+    // LRU的读缓冲里可能还有即将被复用的节点. 先读epoch再处理读缓冲: 此后才记入读缓冲的访问来自仍在临界区内的读者,
+    // 按这个epoch判断它访问的节点不会被回收; 若在flush之后再读, 其他跳表或分片可能已经推进了epoch
+    uint64_t global = domain.current();
+    _lru.flush();
+    size_t kept = 0;
+    for (size_t i = 0; i < _retired_nodes.size(); i++)
+    {
+        if (EpochDomain::is_safe(_retired_nodes[i].second, global))
+        {
+            recycle_node(_retired_nodes[i].first);
+        }
+        else
+        {
+            _retired_nodes[kept++] = _retired_nodes[i];
+        }
+    }
+    _retired_nodes.resize(kept);
+
+    kept = 0;
+    for (size_t i = 0; i < _retired_values.size(); i++)
+    {
+        if (EpochDomain::is_safe(_retired_values[i].second, global))
+        {
+            delete _retired_values[i].first;
+        }
+        else
+        {
+            _retired_values[kept++] = _retired_values[i];
+        }
+    }
+    _retired_values.resize(kept);
+}
+
+// 释放被替换下来的旧value, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::retire_value(V *value)
+{
+    if (_reclaim_mode == RECLAIM_IMMEDIATE)
+    {
+        delete value;
+        return;
+    }
+
+    _retired_values.push_back(make_pair(value, EpochDomain::instance().current()));
+    if (_retired_values.size() >= EPOCH_COLLECT_THRESHOLD)
+    {
+        reclaim_nodes();
+    }
+}
+
 /*
 insert_element()方法用于向跳表插入给定的key和value
 返回1代表元素存在
 返回0代表插入成功
+返回-1代表超出内存上限且无法淘汰(MAXMEMORY_NOEVICTION或没有可淘汰的key), 没有插入
                            +------------+
                            |  insert 50 |
                            +------------+
@@ -262,34 +869,86 @@ level_0         1    4   9 10         30+-->40--| 50 |-->60     70       100
                                                 +----+
 
 */
-template <typename K, typename V>
-int SkipList<K, V>::insert_element(K key, const V value)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::insert_element(const K &key, const V &value)
 {
-    // 有两种清理过期key的方法:
-    // 1. 被动清理 : 主动访问一个过期key时, 删除该key
-    // 2. 内存不足时触发主动清理 : 在设置了过期时间的键空间中，移除最近最少使用的key
+    return insert_impl(key, value, false, 0);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::insert_element(const K &key, V &&value)
+{
+    return insert_impl(key, std::move(value), false, 0);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::set_element(const K &key, const V &value, int64_t milliseconds)
+{
+    return insert_impl(key, value, true, milliseconds > 0 ? now_ms() + milliseconds : 0);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::set_element(const K &key, V &&value, int64_t milliseconds)
+{
+    return insert_impl(key, std::move(value), true, milliseconds > 0 ? now_ms() + milliseconds : 0);
+}
 
-    mtx.lock();
-    // 如果过期先指行被动清理原来的, 没过期就先更新LRU里的值
-    if (isExpire(key) == 1)
+// set_ttl为false时保留key原来的过期时间; 为true时把过期时间设为expire_at, expire_at为0表示清除
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename VV>
+int SkipList<K, V, Compare, KeyCodec>::insert_impl(const K &key, VV &&value, bool set_ttl, int64_t expire_at)
+{
+    uint64_t start = _metrics.start();
+    _mtx.lock();
+    if (!reserve_memory())
+    {
+        _mtx.unlock();
+        _metrics.add(METRIC_REJECTED_WRITES);
+        _metrics.record_op(METRIC_INSERT, start);
+        LOG_WARN("超出内存上限, 拒绝插入key: " << key);
+        return -1;
+    }
+    // 先写日志再插入, 插入时value可能被移动进节点; 两步都在锁内, 日志中的顺序与修改的顺序一致
+    // 要修改过期时间时插入和过期时间写成一条记录; 清除过期时间而key原来就没有时只记插入
+    Node<K, V> *node = set_ttl && expire_at == 0 ? find_node(key) : NULL;
+    bool log_ttl = set_ttl && (expire_at != 0 || (node != NULL && node->get_expire_at() != 0));
+    uint64_t seq = log_ttl ? log_insert_expire(key, value, expire_at) : log_insert(key, value);
+    int ret = put_element(key, std::forward<VV>(value));
+    if (set_ttl && expire_at != 0)
     {
-        lruCache->del(key);
-        expire_key_mp.erase(key);
-        delete_element(key);
-        _element_count--;
+        set_expire(key, expire_at);
     }
-    else if (isExpire(key) == 0)
+    else if (set_ttl)
     {
-        lruCache->put(key, value);
+        clear_expire(key);
     }
+    _mtx.unlock();
 
-    // current指针指向跳表头节点, 接下来将使用current指针来遍历跳表
-    Node<K, V> *current = this->_header;
+    // 在锁外等待日志落盘, 等待期间其他线程的写入可以进入同一批次
+    bool durable = wait_durable(seq);
+    _metrics.record_op(METRIC_INSERT, start);
+    return durable ? ret : -1;
+}
 
-    // 创建一个update数组,并初始化
+// 插入或更新元素, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename VV>
+int SkipList<K, V, Compare, KeyCodec>::put_element(const K &key, VV &&value)
+{
+    // 创建一个update数组
     // update数组里放的是node->next[i]里等待被操作的那些节点
     Node<K, V> *update[_max_level + 1];
-    memset(update, 0, sizeof(Node<K, V> *) * (_max_level + 1));
+    find_predecessors(key, update);
+    return put_element_at(key, std::forward<VV>(value), update);
+}
+
+// 查找key在每一层的前驱节点, 即每一层最后一个key小于key的节点, 放入update[0.._skip_list_level]
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::find_predecessors(const K &key, Node<K, V> **update) const
+{
+    // current指针指向跳表头节点, 接下来将使用current指针来遍历跳表
+    Node<K, V> *current = this->_header;
+    Prefix prefix = prefix_of(key);
 
     // 从跳表的最左上角节点开始查找
     // current一开始指向level_4的1这个节点, i一开始等于4
@@ -297,9 +956,16 @@ int SkipList<K, V>::insert_element(K key, const V value)
     // 为空的话就加入update数组, 通过i--这个操作, 就进入了下一层
     for (int i = _skip_list_level; i >= 0; i--)
     {
-        while (current->next[i] != NULL && current->next[i]->get_key() < key)
+        // 启用 TowerKeys 时, 缓存的key表明下一个节点不小于key的层不用访问后继节点, 前驱就是current
+        for (int m = tower_level(current, i, key); i > m; i--)
+        {
+            update[i] = current;
+        }
+        Node<K, V> *next = current->next[i];
+        while (next != NULL && node_less(next, key, prefix))
         {
-            current = current->next[i];
+            current = next;
+            next = tower_may_less(current, i, key) ? current->next[i] : NULL;
         }
         // level_4的1, level_3的10, level_2的30, level_1的30, level_0的40
         // 这些节点都在这个for循环里都会被依次加入update数组,以备后续之需
@@ -309,201 +975,1170 @@ int SkipList<K, V>::insert_element(K key, const V value)
         update[i] = current;
     }
     // 退出这个for循环时, current指向的是level_0的40
+}
 
-    // 遍历至第0层, 当前指针current指向第一个大于等于待插入节点值的节点
-    current = current->next[0];
-    // 此时current指向level_0的60
-
-    // 如果当前节点的key值和待插入节点key相等，则说明待插入节点值存在。
-    if (current != NULL && current->get_key() == key)
+// 沿用上一个key的update数组查找key的前驱(finger search), 要求key不小于上一个key
+// 第一次调用前update[0.._max_level]都要初始化为_header
+// 上一个key的前驱都在key前面, 不用从头节点出发: 自底向上找到第一个前驱的下一个节点不小于key的层h,
+// 第h层及以上的前驱不用移动, 只需从第h层往下查找; 相邻的key离得越近, h越低, 走的节点越少
+// 只通过 get_next 读取指针, 不持有_mtx的读者也可以调用, 此时需要在epoch临界区内
+// 返回h, 即重新查找了几层
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::find_predecessors_from(const K &key, Node<K, V> **update) const
+{
+    int level = get_level();
+    Prefix prefix = prefix_of(key);
+    int h = 0;
+    while (h <= level)
     {
-        cout << "key: " << key << ", exists" << endl;
-        current->set_value(value); // 更新其值
-        mtx.unlock();
-        return 1;
+        Node<K, V> *next = update[h]->get_next(h);
+        if (next == NULL || !node_less(next, key, prefix))
+        {
+            break;
+        }
+        h++;
     }
 
-    // 如果current节点为null 这就意味着要将该元素插入最后一个节点。
-    // 如果current的key值和待插入的key不等，代表我们应该在update[0]和current之间插入该节点。
-    if (current == NULL || current->get_key() != key)
+    Node<K, V> *current = h <= level ? update[h] : _header;
+    for (int i = h - 1; i >= 0; i--)
     {
-
-        // 获取当前节点应该建立的随机索引等级
-        int random_level = get_random_level();
-
-        // 如果随机索引等级大于跳表当前层级, 用指向头节点的指针初始化 update 中的值
-        if (random_level > _skip_list_level)
+        // 从上一层下来的位置和这一层原来的前驱, 取更靠后的一个出发
+        if (update[i] != _header && (current == _header || _compare(current->key_ref(), update[i]->key_ref())))
         {
-            for (int i = _skip_list_level + 1; i < random_level + 1; i++)
-            {
-                update[i] = _header;
-            }
-            _skip_list_level = random_level;
+            current = update[i];
         }
+        Node<K, V> *next = current->get_next(i);
+        while (next != NULL && node_less(next, key, prefix))
+        {
+            current = next;
+            next = current->get_next(i);
+        }
+        update[i] = current;
+    }
+    return h;
+}
+
+// 在已经查好的前驱之后插入或更新元素, 调用者需要持有_mtx
+// 插入后update仍是key在每一层的前驱, 可以继续用于后面更大的key
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename VV>
+int SkipList<K, V, Compare, KeyCodec>::put_element_at(const K &key, VV &&value, Node<K, V> **update)
+{
+    // 遍历至第0层, 当前指针current指向第一个大于等于待插入节点值的节点
+    Node<K, V> *current = update[0]->next[0];
+    // 此时current指向level_0的60
+
+    // 有两种清理过期key的方法:
+    // 1. 被动清理 : 主动访问一个过期key时, 删除该key
+    // 2. 内存不足时触发主动清理 : 在设置了过期时间的键空间中，移除最近最少使用的key
+    // 如果过期先执行被动清理, 再作为新key插入; 摘除节点不改变前驱, update仍然可用
+    if (key_matches(current, key) && current->get_expire_at() != 0 && is_expired(current, now_ms()))
+    {
+        erase_element_at(key, update);
+        current = update[0]->next[0];
+    }
 
-        // 使用生成的随机索引等级创建新的节点
-        Node<K, V> *inserted_node = create_node(key, value, random_level);
-
-        // 插入节点
-        // 这个过程如下:
-        // level_0 : 节点50的next[0]指向60, update[0]也就是节点40的next[0]指向50
-        // level_1 : 节点50的next[1]指向70, update[1]也就是节点30的next[1]指向50
-        // level_2 : 节点50的next[2]指向70, update[2]也就是节点30的next[2]指向50
-        // level_3 : 节点50的next[3]指向70, update[3]也就是节点10的next[3]指向50
-        for (int i = 0; i <= random_level; i++)
+    // 如果当前节点的key值和待插入节点key相等，则说明待插入节点值存在。
+    if (key_matches(current, key))
+    {
+        LOG_DEBUG("key: " << key << ", exists");
+        size_t before = current->memory_usage();
+        V *old = current->replace_value(std::forward<VV>(value)); // 更新其值
+        if (old != NULL)
         {
-            inserted_node->next[i] = update[i]->next[i];
-            update[i]->next[i] = inserted_node;
+            retire_value(old);
         }
-        cout << "Successfully inserted key:" << key << ", value:" << value << endl;
-        _element_count++;
+        _used_memory = _used_memory - before + current->memory_usage();
+        // 被写入也算一次访问
+        record_access(current);
+        return 1;
     }
-    mtx.unlock();
+
+    // 如果current节点为null 这就意味着要将该元素插入最后一个节点。
+    // 如果current的key值和待插入的key不等，代表我们应该在update[0]和current之间插入该节点。
+
+    // 获取当前节点应该建立的随机索引等级
+    int random_level = get_random_level();
+
+    // 如果随机索引等级大于跳表当前层级, 用指向头节点的指针初始化 update 中的值
+    if (random_level > _skip_list_level)
+    {
+        for (int i = _skip_list_level + 1; i < random_level + 1; i++)
+        {
+            update[i] = _header;
+        }
+        set_level(random_level);
+    }
+
+    // 使用生成的随机索引等级创建新的节点
+    Node<K, V> *inserted_node = create_node(key, std::forward<VV>(value), random_level);
+
+    // 插入节点
+    // 这个过程如下:
+    // level_0 : 节点50的next[0]指向60, update[0]也就是节点40的next[0]指向50
+    // level_1 : 节点50的next[1]指向70, update[1]也就是节点30的next[1]指向50
+    // level_2 : 节点50的next[2]指向70, update[2]也就是节点30的next[2]指向50
+    // level_3 : 节点50的next[3]指向70, update[3]也就是节点10的next[3]指向50
+    for (int i = 0; i <= random_level; i++)
+    {
+        inserted_node->set_next(i, update[i]->next[i]);
+        update[i]->set_next(i, inserted_node);
+    }
+    LOG_DEBUG("Successfully inserted key:" << key << ", value:" << inserted_node->value_ref());
+    _element_count.fetch_add(1, memory_order_relaxed);
     return 0;
 }
 
 // 设置key的过期时间为seconds,单位为秒
-template <typename K, typename V>
-void SkipList<K, V>::expire_element(K key, int seconds)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::expire_element(const K &key, int seconds)
+{
+    return pexpire_element(key, static_cast<int64_t>(seconds) * 1000);
+}
+
+// 设置key的过期时间为milliseconds,单位为毫秒
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::pexpire_element(const K &key, int64_t milliseconds)
 {
+    uint64_t start = _metrics.start();
+    int64_t expire_at = now_ms() + milliseconds;
 
-    V val;
-    if (search_element(key, &val) == false)
+    _mtx.lock();
+    if (set_expire(key, expire_at) == false)
+    {
+        _mtx.unlock();
+        _metrics.record_op(METRIC_EXPIRE, start);
+        LOG_DEBUG("该key不存在, 设置过期时间失败.");
+        return false;
+    }
+    uint64_t seq = log_expire(key, expire_at);
+    _mtx.unlock();
+
+    if (!wait_durable(seq))
+    {
+        _metrics.record_op(METRIC_EXPIRE, start);
+        return false;
+    }
+    _metrics.record_op(METRIC_EXPIRE, start);
+    LOG_DEBUG("成功设置key: " << key << "过期时间为: " << milliseconds << " 毫秒!");
+    return true;
+}
+
+// 记录key的到期时间(毫秒)并加入LRU链表, key不存在返回false, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::set_expire(const K &key, int64_t expire_at)
+{
+    Node<K, V> *node = find_node(key);
+    if (node == NULL)
+    {
+        return false;
+    }
+
+    if (node->get_expire_at() == 0)
+    {
+        _volatile_count++;
+    }
+    node->set_expire_at(expire_at);
+
+    // 旧的到期时间留在堆里, 弹出时发现和节点记录的不一致就丢弃
+    bool earliest = _expire_heap.empty() || expire_at < _expire_heap.next_expire_at();
+    _expire_heap.push(expire_at, key);
+    if (!_expire_thread.joinable())
+    {
+        _expire_thread = thread(&SkipList<K, V, Compare, KeyCodec>::expire_loop, this);
+    }
+    else if (earliest)
+    {
+        // 后台线程可能正睡到更晚的到期时间
+        _expire_cv.notify_one();
+    }
+
+    if (_lru.contains(node))
+    {
+        _lru.touch(node);
+        return true;
+    }
+    if (_maxmemory == 0 && _lru.full())
+    {
+        // LRU满了就先淘汰最久未访问的key, 跳表里也要相应删除
+        // LRU的淘汰顺序取决于读操作, 重放WAL时无法复现, 所以把淘汰也记为一次删除
+        K delKey = _lru.victim()->get_key();
+        erase_element(delKey);
+        log_delete(delKey);
+        _metrics.add(METRIC_LRU_EVICTED);
+        LOG_DEBUG("LRU缓存已满, 已自动清理key: " << delKey);
+    }
+    _lru.link(node);
+    return true;
+}
+
+// 清除key的过期时间, 只记录带过期时间的key的LRU链表也不再保留它, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::clear_expire(const K &key)
+{
+    Node<K, V> *node = find_node(key);
+    if (node == NULL || node->get_expire_at() == 0)
     {
-        cout << "该key不存在, 设置过期时间失败." << endl;
         return;
     }
+    _volatile_count--;
+    // 堆里的旧条目弹出时发现和节点记录的不一致就丢弃
+    node->set_expire_at(0);
+    if (!tracks_all_keys())
+    {
+        _lru.unlink(node);
+    }
+}
 
-    time_t timep;
-    time(&timep); // 获取从1970至今过了多少秒，存入time_t类型的timep
-    expire_key_mp[key] = make_pair(seconds, timep);
+// 判断key是否过期, 过期返回1, 否则返回0; 返回-1代表key是永久元素或不存在
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::isExpire(const K &key)
+{
+    Node<K, V> *node = find_node(key);
+    if (node == NULL || node->get_expire_at() == 0)
+        return -1;
+
+    return is_expired(node, now_ms()) ? 1 : 0;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::is_expired(const Node<K, V> *node, int64_t now)
+{
+    int64_t expire_at = node->get_expire_at();
+    return expire_at != 0 && expire_at <= now;
+}
 
-    K delKey;
-    if (lruCache->put(key, val, &delKey) == -1)
+// 被动清理: 访问到已过期的key时加锁删除它, 删除了返回true
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::expire_if_needed(const K &key)
+{
+    _mtx.lock();
+    bool erased = false;
+    Node<K, V> *node = find_node(key);
+    // 加锁前key可能已被后台线程清理, 或者又被重新写入
+    if (node != NULL && is_expired(node, now_ms()))
+    {
+        erased = erase_element(key);
+        log_delete(key);
+    }
+    _mtx.unlock();
+    if (erased)
     {
-        // 如果LRU里有删除元素,那跳表里也要相应删除元素
-        delete_element(delKey);
-        cout << "LRU缓存已满, 已自动清理key: " << delKey << endl;
+        _metrics.add(METRIC_EXPIRED_LAZY);
     }
-    cout << "成功设置key: " << key << "过期时间为: " << seconds << " 秒!" << endl;
+    return erased;
 }
 
-// 判断key是否过期, 过期返回1, 否则返回0; 返回-1代表key是永久元素
-template <typename K, typename V>
-int SkipList<K, V>::isExpire(const K key)
+// 返回key的剩余时间(毫秒), 若key为永久的, 返回-1; 若key已过期, 返回0; 若key不存在,返回-2
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int64_t SkipList<K, V, Compare, KeyCodec>::pttl_element(const K &key)
 {
-    if (expire_key_mp.count(key) == 0)
+    int64_t expire_at;
+    {
+        EpochGuard guard;
+        Node<K, V> *node = find_node(key);
+        if (node == NULL)
+            return -2;
+        expire_at = node->get_expire_at();
+    }
+    if (expire_at == 0)
         return -1;
 
-    time_t timep;
-    time(&timep); // 获取从1970至今过了多少秒，存入time_t类型的timep
-    if (timep - expire_key_mp[key].second > expire_key_mp[key].first)
+    int64_t left = expire_at - now_ms();
+    if (left <= 0)
     {
-        return 1;
+        expire_if_needed(key);
+        return 0;
+    }
+    return left;
+}
+
+// 返回key的剩余时间(秒, 四舍五入), 若key为永久的, 返回-1; 若key已过期, 返回0; 若key不存在,返回-2
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::ttl_element(const K &key)
+{
+    int64_t ms = pttl_element(key);
+    if (ms == 0)
+    {
+        LOG_DEBUG("key: " << key << " 已过期, 已清理");
+        return 0;
+    }
+    if (ms < 0)
+    {
+        return static_cast<int>(ms);
+    }
+
+    int sec = static_cast<int>((ms + 500) / 1000);
+    LOG_DEBUG("key : " << key << "还有 " << sec << " 秒过期.");
+    return sec;
+}
+
+// 清理最多budget个到期的堆条目, 返回处理的条目数(包括失效的条目), 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::expire_cycle(int64_t now, int budget)
+{
+    int handled = 0;
+    K key;
+    int64_t expire_at;
+    while (handled < budget && _expire_heap.pop_expired(now, &key, &expire_at))
+    {
+        handled++;
+        Node<K, V> *node = find_node(key);
+        // key已被删除或者过期时间已被修改, 这是一个失效条目
+        if (node == NULL || node->get_expire_at() != expire_at)
+        {
+            continue;
+        }
+        erase_element(key);
+        log_delete(key);
+        _metrics.add(METRIC_EXPIRED_ACTIVE);
+    }
+
+    // 反复修改过期时间或删除key会在堆里留下失效条目, 太多时整体重建
+    if (_expire_heap.size() > 2 * static_cast<size_t>(_volatile_count) + 1024)
+    {
+        _expire_heap.compact([this](const K &k, int64_t t)
+                             {
+                                 Node<K, V> *node = find_node(k);
+                                 return node != NULL && node->get_expire_at() == t; });
+    }
+    return handled;
+}
+
+// 后台清理线程, 第一次设置过期时间时启动
+// 每轮最多处理 TTL_SWEEP_BUDGET 个条目, 用完预算说明还有积压, 释放锁让写操作进来后马上继续,
+// 否则睡到下一个key到期或 TTL_SWEEP_INTERVAL_MS 之后
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::expire_loop()
+{
+    unique_lock<mutex> lock(_mtx.native());
+    while (!_expire_stop)
+    {
+        int64_t now = now_ms();
+        if (expire_cycle(now, TTL_SWEEP_BUDGET) == TTL_SWEEP_BUDGET)
+        {
+            lock.unlock();
+            this_thread::yield();
+            lock.lock();
+            continue;
+        }
+
+        int64_t wait_ms = TTL_SWEEP_INTERVAL_MS;
+        if (!_expire_heap.empty() && _expire_heap.next_expire_at() - now < wait_ms)
+        {
+            wait_ms = max<int64_t>(_expire_heap.next_expire_at() - now, 1);
+        }
+        _expire_cv.wait_for(lock, chrono::milliseconds(wait_ms));
+    }
+}
+
+// 显示跳表
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::display_list()
+{
+
+    cout << "-------------------------------SkipList--------------------------------" << endl;
+    for (int i = 0; i <= _skip_list_level; i++)
+    {
+        Node<K, V> *node = this->_header->next[i];
+        cout << "Level " << i << ": ";
+        while (node != NULL)
+        {
+            cout << node->get_key() << ":" << node->get_value() << ";";
+            node = node->next[i];
+        }
+        cout << endl;
+    }
+    cout << "-------------------------------SkipList---------------------------------" << endl;
+}
+
+// 将内存中的数据转储到文件中, 格式见 snapshot.h
+// 先写临时文件再rename, 转储过程中崩溃不会破坏上一次的快照
+// 快照落盘后WAL中的记录都已包含在快照里, 清空WAL
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::dump_file()
+{
+
+    _mtx.lock();
+    if (_bgsave_running)
+    {
+        _mtx.unlock();
+        LOG_WARN("后台快照进行中");
+        return false;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SnapshotWriter writer;
+    bool ok = write_snapshot(writer);
+    if (ok && _wal != NULL)
+    {
+        _wal->reset();
+    }
+    SnapshotStats stats;
+    stats.ok = ok;
+    stats.keys = writer.entry_count();
+    stats.bytes = writer.bytes_written();
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    _last_snapshot = stats;
+    _mtx.unlock();
+    LOG_INFO("dump " << stats.keys << " keys, " << stats.bytes << " bytes, " << stats.seconds << " s");
+    return ok;
+}
+
+// 在后台生成快照, 类似Redis的BGSAVE
+// 持有_mtx时fork, 子进程拿到的是fork那一刻跳表的一致副本(写时复制), 由它遍历并写出快照,
+// 父进程立即返回, 插入和查询不受影响; 由一个线程等待子进程结束并记录结果
+// fork之前把WAL rotate为旧日志, 快照落盘后删除旧日志, 之后的修改留在新的WAL里
+// 已有后台快照在进行或fork失败时返回false
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::bgsave()
+{
+    _mtx.lock();
+    if (_bgsave_running)
+    {
+        _mtx.unlock();
+        return false;
+    }
+    // 上一次的等待线程已经把 _bgsave_running 置为false, 很快就会结束
+    if (_bgsave_thread.joinable())
+    {
+        _bgsave_thread.join();
+    }
+
+    bool rotated = _wal != NULL && _wal->rotate();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        _mtx.unlock();
+        LOG_ERROR("创建管道失败, errno: " << errno);
+        return false;
+    }
+
+    // 日志对象在fork前就已构造好, 子进程中第一次用到时不会去创建线程
+    Logger::instance();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // 子进程里只有当前这一个线程, 不能再碰其他线程可能持有的锁, 结束时用_exit跳过析构
+        // 因此快照在本线程里同步写出, 不建io_uring也不起写线程
+        close(fds[0]);
+        SnapshotWriter writer(ASYNC_IO_SYNC);
+        SnapshotStats stats;
+        stats.ok = write_snapshot(writer);
+        stats.keys = writer.entry_count();
+        stats.bytes = writer.bytes_written();
+        stats.seconds = 0;
+        ssize_t n = write(fds[1], &stats, sizeof(stats));
+        _exit(stats.ok && n == sizeof(stats) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        _mtx.unlock();
+        LOG_ERROR("fork失败, errno: " << errno);
+        return false;
+    }
+    _bgsave_running = true;
+    _bgsave_thread = thread(&SkipList<K, V, Compare, KeyCodec>::finish_bgsave, this, pid, fds[0], start, rotated);
+    _mtx.unlock();
+    return true;
+}
+
+// 在等待线程中运行: 读取子进程写出的结果并回收子进程
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::finish_bgsave(pid_t pid, int fd, chrono::steady_clock::time_point start, bool rotated)
+{
+    SnapshotStats stats = SnapshotStats();
+    size_t got = 0;
+    while (got < sizeof(stats))
+    {
+        ssize_t n = read(fd, reinterpret_cast<char *>(&stats) + got, sizeof(stats) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    stats.ok = got == sizeof(stats) && stats.ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // 快照已包含旧日志中的全部修改; 失败时保留旧日志, 下次rotate会把新日志合并进去
+    if (stats.ok && rotated)
+    {
+        _wal->drop_rotated();
+    }
+
+    _mtx.lock();
+    _last_snapshot = stats;
+    _bgsave_running = false;
+    _mtx.unlock();
+
+    if (stats.ok)
+    {
+        LOG_INFO("bgsave " << stats.keys << " keys, " << stats.bytes << " bytes, " << stats.seconds << " s");
     }
     else
+    {
+        LOG_ERROR("后台快照失败");
+    }
+}
+
+// 阻塞到当前的后台快照结束
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::wait_bgsave()
+{
+    _mtx.lock();
+    thread t;
+    t.swap(_bgsave_thread);
+    _mtx.unlock();
+    if (t.joinable())
+    {
+        t.join();
+    }
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::bgsave_in_progress()
+{
+    lock_guard<PaddedMutex> lock(_mtx);
+    return _bgsave_running;
+}
+
+// 最近一次 dump_file() 或 bgsave() 的结果
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SnapshotStats SkipList<K, V, Compare, KeyCodec>::last_snapshot()
+{
+    lock_guard<PaddedMutex> lock(_mtx);
+    return _last_snapshot;
+}
+
+// 按第0层的顺序把所有键值对写入快照文件, 调用者需要持有_mtx(或在fork出的子进程中调用)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::write_snapshot(SnapshotWriter &writer)
+{
+    if (!writer.open(_store_file))
+    {
+        return false;
+    }
+
+    string key;
+    string value;
+    Node<K, V> *node = this->_header->next[0];
+    while (node != NULL)
+    {
+        key.clear();
+        value.clear();
+        KeyCodec::encode(node->get_key(), &key);
+        Codec<V>::encode(node->get_value(), &value);
+
+        writer.add(key, value, node->get_expire_at());
+        node = node->next[0];
+    }
+    return writer.finish();
+}
+
+// 从磁盘加载数据: 先加载快照, 再重放快照之后的WAL
+// 兼容旧版本 "key:value" 格式的文本文件
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::load_file()
+{
+
+    _mtx.lock();
+    _replaying = true;
+
+    SnapshotReader reader;
+    if (reader.open(_store_file))
+    {
+        load_snapshot(reader);
+    }
+    else if (!reader.is_snapshot())
+    {
+        load_text_file();
+    }
+
+    if (!reader.error().empty())
+    {
+        LOG_ERROR("加载快照失败: " << reader.error() << ", 已加载 " << reader.entry_count() << " 个key");
+    }
+
+    replay_wal();
+    _replaying = false;
+    _mtx.unlock();
+}
+
+// 加载二进制快照, 调用者需要持有_mtx
+// 快照中的key严格递增, 跳表为空时直接把新节点接到每一层的末尾, 整体O(n), 不需要逐个查找插入位置
+// 跳表非空或者发现key顺序不对时, 退回逐个插入
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::load_snapshot(SnapshotReader &reader)
+{
+    // tails[i] 为第i层当前的最后一个节点
+    Node<K, V> *tails[_max_level + 1];
+    for (int i = 0; i <= _max_level; i++)
+    {
+        tails[i] = _header;
+    }
+    bool append = (_element_count.load(memory_order_relaxed) == 0);
+
+    // 过期时间等跳表建好后再设置, 设置时LRU可能淘汰key, 不能在建表过程中删除节点
+    vector<pair<K, int64_t>> ttls;
+
+    SnapshotEntry entry;
+    while (reader.next(&entry))
+    {
+        K key;
+        V value;
+        // key/value为CowString时直接引用映射区域, 不拷贝数据
+        if (!decode_with<KeyCodec>(entry.key, entry.key_len, reader.mapping(), &key) ||
+            !decode_mapped(entry.value, entry.value_len, reader.mapping(), &value))
+        {
+            LOG_WARN("快照中的key/value无法解码, 已跳过");
+            continue;
+        }
+
+        if (append && tails[0] != _header && !_compare(tails[0]->key_ref(), key))
+        {
+            append = false;
+        }
+
+        if (append)
+        {
+            int random_level = get_random_level();
+            Node<K, V> *node = create_node(key, std::move(value), random_level);
+            for (int i = 0; i <= random_level; i++)
+            {
+                tails[i]->set_next(i, node);
+                tails[i] = node;
+            }
+            if (random_level > _skip_list_level)
+            {
+                set_level(random_level);
+            }
+            _element_count.fetch_add(1, memory_order_relaxed);
+        }
+        else
+        {
+            put_element(key, std::move(value));
+        }
+
+        if (entry.expire_at_ms != 0)
+        {
+            ttls.push_back(make_pair(key, entry.expire_at_ms));
+        }
+    }
+
+    for (size_t i = 0; i < ttls.size(); i++)
+    {
+        set_expire(ttls[i].first, ttls[i].second);
+    }
+    LOG_INFO("load " << reader.entry_count() << " keys from snapshot");
+}
+
+// 加载旧版本的文本格式文件, 每行一个"key:value", 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::load_text_file()
+{
+    _file_reader.open(_store_file.c_str());
+    string line;
+    string key;
+    string value;
+    while (getline(_file_reader, line))
+    {
+        key.clear();
+        value.clear();
+        get_key_value_from_string(line, &key, &value);
+        if (key.empty() || value.empty())
+        {
+            continue;
+        }
+        K k;
+        V v;
+        if (!parse_text(key, &k) || !parse_text(value, &v))
+        {
+            continue;
+        }
+        put_element(k, std::move(v));
+        LOG_DEBUG("key:" << key << "value:" << value);
+    }
+    _file_reader.close();
+}
+
+// 设置快照文件和WAL文件的路径, 需要在 load_file / enable_wal 之前调用
+// 同一进程中的多个跳表需要使用不同的文件
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::set_store_file(const string &store_file, const string &wal_file)
+{
+    lock_guard<PaddedMutex> lock(_mtx);
+    _store_file = store_file;
+    _wal_file = wal_file;
+}
+
+// 开启预写日志, 之后的每次修改都会先记录到WAL文件
+// 重启时应先调用load_file()恢复数据
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::enable_wal(WalSyncPolicy policy, int interval_ms)
+{
+    _mtx.lock();
+    if (_wal == NULL)
+    {
+        _wal = new WriteAheadLog(_wal_file, policy, interval_ms);
+        if (!_wal->is_open())
+        {
+            delete _wal;
+            _wal = NULL;
+        }
+    }
+    _mtx.unlock();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+WriteAheadLog *SkipList<K, V, Compare, KeyCodec>::get_wal()
+{
+    return _wal;
+}
+
+// WAL记录的payload格式:
+// WAL_INSERT: key长度(4) | key | value
+// WAL_DELETE: key
+// WAL_EXPIRE_AT: 到期时间(毫秒)(8) | key, 到期时间为0表示清除过期时间
+// WAL_BATCH: 操作个数(4) | 每个操作的 类型(1) | payload长度(4) | payload, 类型为 WAL_INSERT, WAL_DELETE 或 WAL_EXPIRE_AT
+// 以下log_*函数在调用者持有_mtx时调用, 保证日志顺序与修改顺序一致, 返回记录序号, 未开启WAL返回0
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::log_insert(const K &key, const V &value)
+{
+    if (_wal == NULL || _replaying)
+    {
+        return 0;
+    }
+    string payload;
+    encode_insert(key, value, &payload);
+    return _wal->append(WAL_INSERT, payload);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::encode_insert(const K &key, const V &value, string *dst)
+{
+    string k;
+    KeyCodec::encode(key, &k);
+    put_fixed32(dst, static_cast<uint32_t>(k.size()));
+    dst->append(k);
+    Codec<V>::encode(value, dst);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::log_delete(const K &key)
+{
+    if (_wal == NULL || _replaying)
+    {
+        return 0;
+    }
+    string payload;
+    KeyCodec::encode(key, &payload);
+    return _wal->append(WAL_DELETE, payload);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::log_expire(const K &key, int64_t expire_at)
+{
+    if (_wal == NULL || _replaying)
+    {
+        return 0;
+    }
+    string payload;
+    put_fixed64(&payload, static_cast<uint64_t>(expire_at));
+    KeyCodec::encode(key, &payload);
+    return _wal->append(WAL_EXPIRE_AT, payload);
+}
+
+// set_element: WAL_INSERT 和 WAL_EXPIRE_AT 两个操作组成的 WAL_BATCH
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::log_insert_expire(const K &key, const V &value, int64_t expire_at)
+{
+    if (_wal == NULL || _replaying)
+    {
+        return 0;
+    }
+    string payload;
+    string op_payload;
+    put_fixed32(&payload, 2);
+    encode_insert(key, value, &op_payload);
+    payload.push_back(static_cast<char>(WAL_INSERT));
+    put_fixed32(&payload, static_cast<uint32_t>(op_payload.size()));
+    payload.append(op_payload);
+    op_payload.clear();
+    put_fixed64(&op_payload, static_cast<uint64_t>(expire_at));
+    KeyCodec::encode(key, &op_payload);
+    payload.push_back(static_cast<char>(WAL_EXPIRE_AT));
+    put_fixed32(&payload, static_cast<uint32_t>(op_payload.size()));
+    payload.append(op_payload);
+    return _wal->append(WAL_BATCH, payload);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::log_batch(const WriteBatch<K, V> &batch)
+{
+    if (_wal == NULL || _replaying)
     {
         return 0;
     }
+    string payload;
+    string op_payload;
+    put_fixed32(&payload, static_cast<uint32_t>(batch.size()));
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        const typename WriteBatch<K, V>::Op &op = batch.ops()[i];
+        op_payload.clear();
+        if (op.is_delete)
+        {
+            KeyCodec::encode(op.key, &op_payload);
+        }
+        else
+        {
+            encode_insert(op.key, op.value, &op_payload);
+        }
+        payload.push_back(static_cast<char>(op.is_delete ? WAL_DELETE : WAL_INSERT));
+        put_fixed32(&payload, static_cast<uint32_t>(op_payload.size()));
+        payload.append(op_payload);
+    }
+    return _wal->append(WAL_BATCH, payload);
+}
+
+// 等待序号为seq的记录落盘, 不能在持有_mtx时调用
+// WAL写入失败时返回false, 内存中的修改已经生效, 但重启后可能丢失
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::wait_durable(uint64_t seq)
+{
+    return _wal == NULL || seq == 0 || _wal->wait_durable(seq);
+}
+
+// 重放WAL, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::replay_wal()
+{
+    // 先重放上一次后台快照没能删除的旧日志
+    function<void(WalRecordType, const char *, size_t)> fn = [this](WalRecordType type, const char *data, size_t len)
+    { apply_wal_record(type, data, len); };
+    uint64_t n = WriteAheadLog::replay(WriteAheadLog::rotated_path(_wal_file), fn);
+    n += WriteAheadLog::replay(_wal_file, fn);
+    LOG_INFO("replay wal: " << n << " records");
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::apply_wal_record(WalRecordType type, const char *data, size_t len)
+{
+    K key;
+    if (type == WAL_INSERT)
+    {
+        V value;
+        if (len < 4)
+            return;
+        uint32_t klen = decode_fixed32(data);
+        if (4 + klen > len ||
+            !KeyCodec::decode(data + 4, klen, &key) ||
+            !Codec<V>::decode(data + 4 + klen, len - 4 - klen, &value))
+            return;
+        put_element(key, std::move(value));
+    }
+    else if (type == WAL_DELETE)
+    {
+        if (!KeyCodec::decode(data, len, &key))
+            return;
+        erase_element(key);
+    }
+    else if (type == WAL_EXPIRE_AT)
+    {
+        if (len < 8)
+            return;
+        int64_t expire_at = static_cast<int64_t>(decode_fixed64(data));
+        if (!KeyCodec::decode(data + 8, len - 8, &key))
+            return;
+        if (expire_at != 0)
+            set_expire(key, expire_at);
+        else
+            clear_expire(key);
+    }
+    else if (type == WAL_BATCH)
+    {
+        if (len < 4)
+            return;
+        uint32_t count = decode_fixed32(data);
+        size_t pos = 4;
+        for (uint32_t i = 0; i < count && pos + 5 <= len; i++)
+        {
+            WalRecordType op_type = static_cast<WalRecordType>(data[pos]);
+            uint32_t op_len = decode_fixed32(data + pos + 1);
+            pos += 5;
+            if (pos + op_len > len)
+                return;
+            if (op_type == WAL_INSERT || op_type == WAL_DELETE || op_type == WAL_EXPIRE_AT)
+                apply_wal_record(op_type, data + pos, op_len);
+            pos += op_len;
+        }
+    }
+}
+
+// 获取当前的 SkipList 大小
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::size()
+{
+    return _element_count.load(memory_order_relaxed);
+}
+
+// 按从最近访问到最久未访问的顺序显示LRU链表中的键值对
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::display_lru()
+{
+    cout << "-------------LRUCache--------------------" << endl;
+    _mtx.lock();
+    _lru.flush();
+    for (Node<K, V> *node = _lru.head(); node != NULL; node = node->lru_next)
+    {
+        cout << "key: " << node->get_key() << ", value : " << node->get_value() << endl;
+    }
+    _mtx.unlock();
+    cout << "-------------LRUCache--------------------" << endl;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::lru_size()
+{
+    return _lru.size();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::lru_capacity()
+{
+    return _lru.capacity();
+}
+
+// 设置内存上限(字节)和淘汰策略, bytes为0表示不限制
+// 插入前如果已用内存超过上限, 按策略淘汰key直到低于上限, 无法淘汰时拒绝插入
+// 调用之后 VOLATILE_LRU_THRESHOLD 的个数限制不再生效
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::set_maxmemory(size_t bytes, MaxmemoryPolicy policy)
+{
+    _mtx.lock();
+    bool had_all = tracks_all_keys();
+    _maxmemory = bytes;
+    _maxmemory_policy.store(policy);
+    _lru.set_capacity(INT_MAX);
+
+    // 候选范围变了, 重新整理LRU链表: 之前不在链表中的key按最久未访问处理
+    if (tracks_all_keys() != had_all)
+    {
+        for (Node<K, V> *node = _header->next[0]; node != NULL; node = node->next[0])
+        {
+            if (tracks_all_keys() && !_lru.contains(node))
+            {
+                _lru.link(node);
+            }
+            else if (!tracks_all_keys() && node->get_expire_at() == 0)
+            {
+                _lru.unlink(node);
+            }
+        }
+    }
+    _mtx.unlock();
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+size_t SkipList<K, V, Compare, KeyCodec>::used_memory()
+{
+    lock_guard<PaddedMutex> lock(_mtx);
+    return _used_memory;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+uint64_t SkipList<K, V, Compare, KeyCodec>::evicted_keys()
+{
+    lock_guard<PaddedMutex> lock(_mtx);
+    return _evicted_keys;
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::enable_metrics_timing(bool on)
+{
+    _metrics.set_timing(on);
+    _mtx.set_timed(on);
 }
 
-// 返回key的剩余时间, 若key为永久的, 返回-1; 若key已过期, 返回0; 若key不存在,返回-2
-template <typename K, typename V>
-int SkipList<K, V>::ttl_element(const K key)
+// 合并各线程的计数, 并在锁内读取锁的统计, 内存和key数等当前值
+template <typename K, typename V, typename Compare, typename KeyCodec>
+MetricsSnapshot SkipList<K, V, Compare, KeyCodec>::metrics()
 {
-    if (expire_key_mp.count(key) == 0)
-        return -1;
+    MetricsSnapshot m;
+    _metrics.collect(&m);
+    lock_guard<PaddedMutex> lock(_mtx);
+    m.lock = _mtx.stats();
+    m.keys = _element_count.load(memory_order_relaxed);
+    m.volatile_keys = _volatile_count;
+    m.used_memory = _used_memory;
+    m.arena_memory = _arena.memory_usage();
+    m.maxmemory = _maxmemory;
+    m.evicted_keys = _evicted_keys;
+    m.lru_size = _lru.size();
+    m.lru_capacity = _lru.capacity();
+    m.level = _skip_list_level;
+    m.max_level = _max_level;
+    m.shards = 1;
+    return m;
+}
 
-    if (isExpire(key) == 1)
-    {
-        lruCache->del(key);
-        delete_element(key);
-        _element_count--;
-        cout << "key: " << key << " 已过期, 已清理" << endl;
-        return 0;
-    }
+template <typename K, typename V, typename Compare, typename KeyCodec>
+string SkipList<K, V, Compare, KeyCodec>::info()
+{
+    return format_info(metrics());
+}
 
-    time_t timep;
-    time(&timep); // 获取从1970至今过了多少秒，存入time_t类型的timep
-    int sec = expire_key_mp[key].first - (timep - expire_key_mp[key].second);
-    cout << "key : " << key << "还有 " << sec << " 秒过期." << endl;
-    return sec;
+// 以Prometheus文本格式写到path, 可以定期调用, 交给 node_exporter 的 textfile collector 采集
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::dump_metrics(const string &path)
+{
+    return write_metrics_file(path, format_prometheus(metrics()));
 }
 
-// 显示跳表
-template <typename K, typename V>
-void SkipList<K, V>::display_list()
+// 返回定位到第一个大于等于key的迭代器
+template <typename K, typename V, typename Compare, typename KeyCodec>
+typename SkipList<K, V, Compare, KeyCodec>::Iterator SkipList<K, V, Compare, KeyCodec>::seek(const K &key)
 {
+    Iterator it(this);
+    it.seek(key);
+    return it;
+}
 
-    cout << "-------------------------------SkipList--------------------------------" << endl;
-    for (int i = 0; i <= _skip_list_level; i++)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q, typename C, typename>
+typename SkipList<K, V, Compare, KeyCodec>::Iterator SkipList<K, V, Compare, KeyCodec>::seek(const Q &key)
+{
+    Iterator it(this);
+    it.seek(key);
+    return it;
+}
+
+// 按顺序访问 [start, end) 范围内的键值对, 最多limit个(limit <= 0 表示不限制)
+// callback 拿到的是节点中key和value的引用, 不拷贝; 返回false时停止遍历
+// 返回访问过的键值对个数
+// string类型的key查询前缀p可以用 [p, p + '\xff') 作为范围(前缀本身不含'\xff'时)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::scan(const K &start, const K &end, int limit, function<bool(const K &, const V &)> callback)
+{
+    int count = 0;
+    Iterator it(this);
+    for (it.seek(start); it.valid() && _compare(it.key(), end); it.next())
     {
-        Node<K, V> *node = this->_header->next[i];
-        cout << "Level " << i << ": ";
-        while (node != NULL)
+        if (limit > 0 && count >= limit)
         {
-            cout << node->get_key() << ":" << node->get_value() << ";";
-            node = node->next[i];
+            break;
+        }
+        count++;
+        if (!callback(it.key(), it.value()))
+        {
+            break;
         }
-        cout << endl;
     }
-    cout << "-------------------------------SkipList---------------------------------" << endl;
+    return count;
 }
 
-// 将内存中的数据转储到文件中
-template <typename K, typename V>
-void SkipList<K, V>::dump_file()
+// LRU链表是否包含所有key
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::tracks_all_keys() const
 {
+    MaxmemoryPolicy policy = _maxmemory_policy.load(memory_order_relaxed);
+    return policy == MAXMEMORY_ALLKEYS_LRU || policy == MAXMEMORY_ALLKEYS_LFU;
+}
 
-    cout << "dump_file-----------------" << endl;
-    _file_writer.open(STORE_FILE);
-    Node<K, V> *node = this->_header->next[0];
-
-    while (node != NULL)
+// 记录一次访问, 可以在不持有_mtx时调用; 访问记在LRU链表上时返回true
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::record_access(Node<K, V> *node)
+{
+    if (_maxmemory_policy.load(memory_order_relaxed) == MAXMEMORY_ALLKEYS_LFU)
     {
-        _file_writer << node->get_key() << ":" << node->get_value() << "\n";
-        cout << node->get_key() << ":" << node->get_value() << ";\n";
-        node = node->next[0];
+        // 并发访问可能丢失个别计数, 对近似的频率统计没有影响
+        node->lfu.store(lfu_access(node->lfu.load(memory_order_relaxed)), memory_order_relaxed);
     }
-
-    _file_writer.flush();
-    _file_writer.close();
-    return;
+    else if (tracks_all_keys() || node->get_expire_at() != 0)
+    {
+        _lru.touch(node);
+        return true;
+    }
+    return false;
 }
 
-// 从磁盘加载数据
-template <typename K, typename V>
-void SkipList<K, V>::load_file()
+// 插入前调用: 已用内存超过上限时按策略淘汰, 返回是否可以继续写入, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::reserve_memory()
 {
-
-    _file_reader.open(STORE_FILE);
-    cout << "load_file-----------------" << endl;
-    string line;
-    string *key = new string();
-    string *value = new string();
-    while (getline(_file_reader, line))
+    if (_maxmemory == 0)
+    {
+        return true;
+    }
+    while (_used_memory > _maxmemory)
     {
-        get_key_value_from_string(line, key, value);
-        if (key->empty() || value->empty())
+        if (!evict_one())
         {
-            continue;
+            return false;
         }
-        insert_element(*key, *value);
-        cout << "key:" << *key << "value:" << *value << endl;
     }
-    _file_reader.close();
+    return true;
 }
 
-// 获取当前的 SkipList 大小
-template <typename K, typename V>
-int SkipList<K, V>::size()
+// 按淘汰策略删除一个key, 没有可淘汰的key返回false, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::evict_one()
 {
-    return _element_count;
+    Node<K, V> *victim = NULL;
+    switch (_maxmemory_policy.load(memory_order_relaxed))
+    {
+    case MAXMEMORY_VOLATILE_LRU:
+    case MAXMEMORY_ALLKEYS_LRU:
+        victim = _lru.victim();
+        break;
+    case MAXMEMORY_ALLKEYS_LFU:
+        victim = _lru.sample(MAXMEMORY_SAMPLES, [](Node<K, V> *node)
+                             { return static_cast<uint64_t>(lfu_count(node->lfu.load(memory_order_relaxed))); });
+        break;
+    case MAXMEMORY_VOLATILE_TTL:
+    {
+        K key;
+        int64_t expire_at;
+        while (victim == NULL && _expire_heap.pop_expired(INT64_MAX, &key, &expire_at))
+        {
+            Node<K, V> *node = find_node(key);
+            if (node != NULL && node->get_expire_at() == expire_at)
+            {
+                victim = node;
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    if (victim == NULL || victim == _header)
+    {
+        return false;
+    }
+
+    // 和LRU淘汰一样记为一次删除, 重放WAL时结果一致
+    K key = victim->get_key();
+    erase_element(key);
+    log_delete(key);
+    _evicted_keys++;
+    return true;
 }
 
 // 从输入的"key:value"格式的键值对中提取出key和value
-template <typename K, typename V>
-void SkipList<K, V>::get_key_value_from_string(const string &str, string *key, string *value)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::get_key_value_from_string(const string &str, string *key, string *value)
 {
 
     if (!is_valid_string(str))
@@ -515,8 +2150,8 @@ void SkipList<K, V>::get_key_value_from_string(const string &str, string *key, s
 }
 
 // 判断输入的字符串格式是否合法
-template <typename K, typename V>
-bool SkipList<K, V>::is_valid_string(const string &str)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::is_valid_string(const string &str)
 {
 
     if (str.empty())
@@ -530,59 +2165,132 @@ bool SkipList<K, V>::is_valid_string(const string &str)
     return true;
 }
 
-// 从跳表中删除元素
-template <typename K, typename V>
-bool SkipList<K, V>::delete_element(K key)
+// 从跳表中删除元素, 删除成功返回true, key不存在返回false
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::delete_element(const K &key)
 {
-    mtx.lock();
+    uint64_t start = _metrics.start();
+    _mtx.lock();
+    bool deleted = erase_element(key);
+    uint64_t seq = deleted ? log_delete(key) : 0;
+    _mtx.unlock();
+    bool durable = wait_durable(seq);
+    _metrics.record_op(METRIC_DELETE, start);
+    return deleted && durable;
+}
 
-    // LRU里有就先删了
-    if (lruCache->m.find(key) != lruCache->m.end())
+// 应用一批写操作, 成功返回0; 超出内存上限且无法淘汰时整批拒绝, 或WAL落盘失败时返回-1
+// 整批在一次加锁内完成, 其他写操作不会穿插进来, 并作为一条WAL记录写入
+// 操作先按key排序, 每个key沿用上一个key的前驱查找(find_predecessors_from), 不必每次从头节点的最高层开始
+// 内存上限只在写入前检查一次, 批内不淘汰(淘汰会摘除节点, 使沿用的前驱失效), 所以可能超出上限一批的大小
+// 不加锁的读者可能看到一批写入的一部分
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::write_batch(const WriteBatch<K, V> &batch)
+{
+    const vector<typename WriteBatch<K, V>::Op> &ops = batch.ops();
+    if (ops.empty())
     {
-        lruCache->del(key);
-        expire_key_mp.erase(key);
+        return 0;
     }
 
-    Node<K, V> *current = this->_header;
-    Node<K, V> *update[_max_level + 1];
-    memset(update, 0, sizeof(Node<K, V> *) * (_max_level + 1));
+    // 在锁外排序, 同一个key的操作保持加入顺序, 后面的覆盖前面的
+    vector<size_t> order(ops.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [this, &ops](size_t a, size_t b)
+                { return _compare(ops[a].key, ops[b].key); });
+    // 和 multi_get 一样每个操作计一次insert或delete, 不计入单次操作的延迟
+    size_t deletes = 0;
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        deletes += ops[i].is_delete ? 1 : 0;
+    }
+    _metrics.add_ops(METRIC_INSERT, ops.size() - deletes);
+    _metrics.add_ops(METRIC_DELETE, deletes);
 
-    // 从跳表最高层开始遍历
-    for (int i = _skip_list_level; i >= 0; i--)
+    _mtx.lock();
+    if (!reserve_memory())
     {
-        while (current->next[i] != NULL && current->next[i]->get_key() < key)
+        _mtx.unlock();
+        _metrics.add(METRIC_REJECTED_WRITES);
+        LOG_WARN("超出内存上限, 拒绝写入 " << ops.size() << " 个操作");
+        return -1;
+    }
+
+    Node<K, V> *update[_max_level + 1];
+    for (int i = 0; i <= _max_level; i++)
+    {
+        update[i] = _header;
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const typename WriteBatch<K, V>::Op &op = ops[order[i]];
+        find_predecessors_from(op.key, update);
+        if (op.is_delete)
         {
-            current = current->next[i];
+            erase_element_at(op.key, update);
+        }
+        else
+        {
+            put_element_at(op.key, op.value, update);
         }
-        update[i] = current;
     }
+    uint64_t seq = log_batch(batch);
+    _mtx.unlock();
+
+    return wait_durable(seq) ? 0 : -1;
+}
+
+// 从跳表中摘除key对应的节点并回收其内存, 调用者需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::erase_element(const K &key)
+{
+    Node<K, V> *update[_max_level + 1];
+    // 从跳表最高层开始遍历
+    find_predecessors(key, update);
+    return erase_element_at(key, update);
+}
 
+// 按已经查好的前驱摘除key对应的节点, 调用者需要持有_mtx
+// 摘除后update仍是key在每一层的前驱
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::erase_element_at(const K &key, Node<K, V> **update)
+{
     // current现在指向要删除的节点
-    current = current->next[0];
-    if (current != NULL && current->get_key() == key)
+    Node<K, V> *current = update[0]->next[0];
+    if (!key_matches(current, key))
     {
+        return false;
+    }
 
-        // 从最底层开始,删除每一层要删除的current节点
-        for (int i = 0; i <= _skip_list_level; i++)
-        {
+    // 从最底层开始,删除每一层要删除的current节点
+    for (int i = 0; i <= _skip_list_level; i++)
+    {
 
-            // 如果下个节点不是目标节点了,退出循环
-            if (update[i]->next[i] != current)
-                break;
+        // 如果下个节点不是目标节点了,退出循环
+        if (update[i]->next[i] != current)
+            break;
 
-            update[i]->next[i] = current->next[i];
-        }
+        // 被摘除的节点保留自己的next指针, 停在它上面的读者仍能继续向后走
+        update[i]->set_next(i, current->next[i]);
+    }
 
-        // 删除没有元素的索引层
-        while (_skip_list_level > 0 && _header->next[_skip_list_level] == 0)
-        {
-            _skip_list_level--;
-        }
+    // 删除没有元素的索引层
+    while (_skip_list_level > 0 && _header->next[_skip_list_level] == 0)
+    {
+        set_level(_skip_list_level - 1);
+    }
 
-        // cout << "Successfully deleted key " << key << endl;
-        _element_count--;
+    // cout << "Successfully deleted key " << key << endl;
+    // 堆里的条目不用删除, 清理时发现节点不存在会丢弃它
+    if (current->get_expire_at() != 0)
+    {
+        _volatile_count--;
     }
-    mtx.unlock();
+    _element_count.fetch_sub(1, memory_order_relaxed);
+    free_node(current);
     return true;
 }
 
@@ -605,76 +2313,457 @@ level 1         1    4     10         30         50|           70       100
                                                    |
 level 0         1    4   9 10         30   40    50+-->60      70       100
 */
-template <typename K, typename V>
-bool SkipList<K, V>::search_element(K key, V *valptr)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::search_element(const K &key, V *valptr)
+{
+    return find_value(key, [valptr](const V &value)
+                      { if (valptr != nullptr) *valptr = value; });
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+bool SkipList<K, V, Compare, KeyCodec>::search_element(const K &key, function<void(const V &)> callback)
+{
+    return find_value(key, callback);
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q, typename C, typename>
+bool SkipList<K, V, Compare, KeyCodec>::search_element(const Q &key, V *valptr)
+{
+    return find_value(key, [valptr](const V &value)
+                      { if (valptr != nullptr) *valptr = value; });
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q, typename C, typename>
+bool SkipList<K, V, Compare, KeyCodec>::search_element(const Q &key, function<void(const V &)> callback)
+{
+    return find_value(key, callback);
+}
+
+// search_element 的实现, key可以是K以外的类型, 找到时在临界区内调用 on_found(value)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q, typename F>
+bool SkipList<K, V, Compare, KeyCodec>::find_value(const Q &key, F on_found)
 {
 
     // cout << "search_element-----------------" << endl;
 
-    // 先在LRU里找
-    V val;
-    if (lruCache->get(key, &val) == true)
+    uint64_t start = _metrics.start();
+    bool expired = false;
+    // 被动清理需要K类型的key, 从节点中拷贝, 不从查找用的key构造
+    K expired_key = K();
     {
-        *valptr = val;
-        return true;
+        // 防止正在访问的节点被并发的删除操作回收
+        EpochGuard guard;
+
+        Node<K, V> *current = find_node(key);
+
+        // 如果当前节点的key等于要查找的key, 则返回其值
+        if (current != NULL)
+        {
+            // 过期的key即使后台线程还没清理也不能返回
+            int64_t expire_at = current->get_expire_at();
+            expired = expire_at != 0 && expire_at <= now_ms();
+            if (expired)
+            {
+                expired_key = current->key_ref();
+            }
+            else
+            {
+                // cout << "Found key: " << key << ", value: " << current->get_value() << endl;
+                if (record_access(current))
+                {
+                    _metrics.add(METRIC_LRU_HITS);
+                }
+                on_found(current->get_value());
+                _metrics.add(METRIC_KEYSPACE_HITS);
+                _metrics.record_op(METRIC_SEARCH, start);
+                return true;
+            }
+        }
+    }
+
+    if (expired)
+    {
+        expire_if_needed(expired_key);
+    }
+
+    // cout << "Not Found Key:" << key << endl;
+    _metrics.add(METRIC_KEYSPACE_MISSES);
+    _metrics.record_op(METRIC_SEARCH, start);
+    return false;
+}
+
+// 批量查询, 结果按keys中的顺序放入values和found(不需要时可以传NULL), 返回找到的key的个数
+// 与 search_element 一样不加锁, 先定位所有key的节点, 再逐个读取value
+// key按顺序查找, 每个key沿用上一个key的前驱, 不必每次从头节点的最高层开始;
+// 前几个key平均要重新查找的层数较多时, 说明key在跳表中很稀疏, 沿用前驱省不了几步,
+// 剩下的key改为同时查找多个, 见 find_nodes_interleaved
+// 各个key分别读取, 不是同一时刻的快照, 并发写入的key可能被读到, 也可能读不到
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::multi_get(const vector<K> &keys, vector<V> *values, vector<bool> *found)
+{
+    if (values != NULL)
+    {
+        values->assign(keys.size(), V());
+    }
+    if (found != NULL)
+    {
+        found->assign(keys.size(), false);
+    }
+
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [this, &keys](size_t a, size_t b)
+         { return _compare(keys[a], keys[b]); });
+
+    int count = 0;
+    int lru_hits = 0;
+    vector<K> expired;
+    {
+        EpochGuard guard;
+
+        // nodes[i] 是第一个key不小于keys[i]的节点
+        vector<Node<K, V> *> nodes(keys.size());
+        Node<K, V> *update[_max_level + 1];
+        for (int i = 0; i <= _max_level; i++)
+        {
+            update[i] = _header;
+        }
+        // 第一个key从头节点出发, 不计入; 之后平均每个key重新查找的层数超过总层数的1/3时改为同时查找
+        int level = get_level();
+        int climbed = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            if (i == MULTI_GET_SAMPLE + 1 && climbed * 3 > level * (int)MULTI_GET_SAMPLE)
+            {
+                find_nodes_interleaved(keys, &order[i], order.size() - i, &nodes[0]);
+                break;
+            }
+            int h = find_predecessors_from(keys[order[i]], update);
+            climbed += i > 0 ? h : 0;
+            // 查完前驱后可能又有小于这个key的节点插在update[0]后面, 继续向后走过它们
+            Node<K, V> *next = update[0]->get_next(0);
+            while (next != NULL && _compare(next->key_ref(), keys[order[i]]))
+            {
+                update[0] = next;
+                next = next->get_next(0);
+            }
+            nodes[order[i]] = next;
+        }
+
+        int64_t now = 0;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            const K &key = keys[i];
+            Node<K, V> *node = nodes[i];
+            if (!key_matches(node, key))
+            {
+                continue;
+            }
+            if (node->get_expire_at() != 0)
+            {
+                if (now == 0)
+                {
+                    now = now_ms();
+                }
+                if (is_expired(node, now))
+                {
+                    expired.push_back(key);
+                    continue;
+                }
+            }
+            lru_hits += record_access(node) ? 1 : 0;
+            if (values != NULL)
+            {
+                (*values)[i] = node->get_value();
+            }
+            if (found != NULL)
+            {
+                (*found)[i] = true;
+            }
+            count++;
+        }
+    }
+
+    // 和 search_element 一样在临界区外被动清理过期的key
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        expire_if_needed(expired[i]);
+    }
+    // 批量查询只计次数, 不计入单次查询的延迟
+    _metrics.add_ops(METRIC_SEARCH, keys.size());
+    _metrics.add(METRIC_KEYSPACE_HITS, count);
+    _metrics.add(METRIC_KEYSPACE_MISSES, keys.size() - count);
+    _metrics.add(METRIC_LRU_HITS, lru_hits);
+    return count;
+}
+
+// 同时查找 keys[order[0..n)] 这n个key, nodes[order[j]] 为第一个key不小于 keys[order[j]] 的节点; 需要在epoch临界区内调用
+// 单独查找一个key时, 每向前走一步都要等上一个节点从内存读进来才知道下一个节点在哪, 无法预取;
+// 这里轮流让 MULTI_GET_LANES 个查找各走一步, 每走一步就预取这个查找下一步要访问的节点,
+// 轮到它时节点多半已经在cache里, 多个查找的内存访问重叠进行
+template <typename K, typename V, typename Compare, typename KeyCodec>
+void SkipList<K, V, Compare, KeyCodec>::find_nodes_interleaved(const vector<K> &keys, const size_t *order, size_t n,
+                                                               Node<K, V> **nodes) const
+{
+    Node<K, V> *current[MULTI_GET_LANES];
+    int level[MULTI_GET_LANES];
+    size_t index[MULTI_GET_LANES];
+    Prefix prefix[MULTI_GET_LANES];
+    int top = get_level();
+    int active = 0;
+    size_t taken = 0;
+    for (; active < MULTI_GET_LANES && taken < n; active++, taken++)
+    {
+        current[active] = _header;
+        level[active] = top;
+        index[active] = order[taken];
+        prefix[active] = prefix_of(keys[order[taken]]);
+    }
+
+    int g = 0;
+    while (active > 0)
+    {
+        Node<K, V> *next = current[g]->get_next(level[g]);
+        if (next != NULL && node_less(next, keys[index[g]], prefix[g]))
+        {
+            current[g] = next;
+        }
+        else if (level[g] > 0)
+        {
+            level[g]--;
+        }
+        else
+        {
+            // 这个key查完了, 换下一个key从头节点开始; 没有剩下的key时用最后一个查找填补空位
+            nodes[index[g]] = next;
+            if (taken < n)
+            {
+                current[g] = _header;
+                level[g] = top;
+                index[g] = order[taken];
+                prefix[g] = prefix_of(keys[order[taken]]);
+                taken++;
+            }
+            else
+            {
+                active--;
+                current[g] = current[active];
+                level[g] = level[active];
+                index[g] = index[active];
+                prefix[g] = prefix[active];
+                if (g == active)
+                {
+                    g = 0;
+                }
+                continue;
+            }
+        }
+        __builtin_prefetch(current[g]->get_next(level[g]));
+        g = g + 1 < active ? g + 1 : 0;
+    }
+}
+
+// 在跳表中定位key所在的节点, 不存在返回NULL
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+Node<K, V> *SkipList<K, V, Compare, KeyCodec>::find_node(const Q &key) const
+{
+    // 当前指针current指向第一个大于等于key的节点
+    Node<K, V> *current = find_greater_or_equal(key);
+    if (key_matches(current, key))
+    {
+        return current;
+    }
+    return NULL;
+}
+
+// 节点的key是否小于key, prefix为 prefix_of(key)
+// 按字节比较的字符串key前缀不同时直接得出结果, 不用访问key在堆上的数据; 前缀相同时才完整比较
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+bool SkipList<K, V, Compare, KeyCodec>::node_less(const Node<K, V> *node, const Q &key, const Prefix &prefix) const
+{
+    if (BytewiseCompare<K, Compare>::value && node->prefix != prefix)
+    {
+        return node->prefix < prefix;
+    }
+    return _compare(node->key_ref(), key);
+}
+
+// current的第1..level层中, 下一个节点可能小于key的最高层, 都不可能时返回0
+// 各层的下一个key随层数升高不减小, 小于key的层是从第0层开始的连续几层, 数出它们的个数即可, int和long long的key用SIMD一次比较多层
+// 缓存的key可能是旧值, 只能作为提示: 跳过的层只是少走几步; 选中的一层向右走之前还会比较节点本身的key
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+int SkipList<K, V, Compare, KeyCodec>::tower_level(const Node<K, V> *current, int level, const Q &key) const
+{
+    return tower_level(current, level, key, integral_constant<bool, TowerKeys<K>::enabled>());
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+int SkipList<K, V, Compare, KeyCodec>::tower_level(const Node<K, V> *current, int level, const Q &key, true_type) const
+{
+    if (level == 0)
+    {
+        return 0;
     }
+    int m = tower_count_less(current->next_keys(), level + 1, key, _compare) - 1;
+    return m < 0 ? 0 : (m > level ? level : m);
+}
 
+// 第level层的下一个节点是否可能小于key, 第0层不能跳过, 总是返回true
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+bool SkipList<K, V, Compare, KeyCodec>::tower_may_less(const Node<K, V> *current, int level, const Q &key) const
+{
+    return tower_may_less(current, level, key, integral_constant<bool, TowerKeys<K>::enabled>());
+}
+
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+bool SkipList<K, V, Compare, KeyCodec>::tower_may_less(const Node<K, V> *current, int level, const Q &key, true_type) const
+{
+    return level == 0 || tower_count_less(current->next_keys() + level, 1, key, _compare) == 1;
+}
+
+// 第一个key大于等于key的节点, 没有返回NULL; 不需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+Node<K, V> *SkipList<K, V, Compare, KeyCodec>::find_greater_or_equal(const Q &key) const
+{
     Node<K, V> *current = _header;
+    Node<K, V> *next = NULL;
+    Prefix prefix = prefix_of(key);
 
     // 从跳表左上角开始查找
-    for (int i = _skip_list_level; i >= 0; i--)
+    for (int i = get_level(); i >= 0; i--)
     {
-        while (current->next[i] && current->next[i]->get_key() < key)
+        // 缓存的key表明更高几层的下一个节点都不小于key, 直接降到可能要向右走的一层
+        i = tower_level(current, i, key);
+        next = current->get_next(i);
+        while (next != NULL && node_less(next, key, prefix))
         {
-            current = current->next[i];
+            current = next;
+            next = tower_may_less(current, i, key) ? current->get_next(i) : NULL;
         }
     }
+    // 最后一轮在第0层, 返回比较过的next; 重新读 current->get_next(0) 可能读到刚插在current后面, 仍小于key的节点
+    return next;
+}
 
-    // 遍历至第0层, 当前指针current指向第一个大于等于待插入节点值的节点
-    current = current->next[0];
-
-    // 如果当前节点的key等于要查找的key, 则返回其值
-    if (current and current->get_key() == key)
+// 最后一个key小于key的节点, 没有返回_header; 不需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+template <typename Q>
+Node<K, V> *SkipList<K, V, Compare, KeyCodec>::find_less_than(const Q &key) const
+{
+    Node<K, V> *current = _header;
+    Prefix prefix = prefix_of(key);
+    for (int i = get_level(); i >= 0; i--)
     {
-        // cout << "Found key: " << key << ", value: " << current->get_value() << endl;
-        *valptr = current->get_value();
-        return true;
+        // 缓存的key表明更高几层的下一个节点都不小于key, 直接降到可能要向右走的一层
+        i = tower_level(current, i, key);
+        Node<K, V> *next = current->get_next(i);
+        while (next != NULL && node_less(next, key, prefix))
+        {
+            current = next;
+            next = tower_may_less(current, i, key) ? current->get_next(i) : NULL;
+        }
     }
+    return current;
+}
 
-    // cout << "Not Found Key:" << key << endl;
-    return false;
+// 最后一个节点, 跳表为空返回_header; 不需要持有_mtx
+template <typename K, typename V, typename Compare, typename KeyCodec>
+Node<K, V> *SkipList<K, V, Compare, KeyCodec>::find_last() const
+{
+    Node<K, V> *current = _header;
+    for (int i = get_level(); i >= 0; i--)
+    {
+        Node<K, V> *next = current->get_next(i);
+        while (next != NULL)
+        {
+            current = next;
+            next = current->get_next(i);
+        }
+    }
+    return current;
 }
 
 // 跳表构造函数
-template <typename K, typename V>
-SkipList<K, V>::SkipList(int max_level)
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SkipList<K, V, Compare, KeyCodec>::SkipList(int max_level, ReclaimMode mode, LruPolicy lru, const Compare &compare)
+    : _compare(compare), _store_file(STORE_FILE), _wal_file(WAL_FILE), _lru(VOLATILE_LRU_THRESHOLD, lru)
 {
 
     this->_max_level = max_level;
+    this->_branching = BRANCHING_HALF;
     this->_skip_list_level = 0;
-    this->_element_count = 0;
+    this->_element_count.store(0, memory_order_relaxed);
+    this->_reclaim_mode = mode;
+    this->_wal = NULL;
+    this->_replaying = false;
+    this->_bgsave_running = false;
+    this->_volatile_count = 0;
+    this->_maxmemory = 0;
+    this->_maxmemory_policy.store(MAXMEMORY_NOEVICTION);
+    this->_used_memory = 0;
+    this->_evicted_keys = 0;
+    this->_expire_stop = false;
+    this->_last_snapshot = SnapshotStats();
+    this->_free_lists.assign(max_level + 1, NULL);
 
     // create header node and initialize key and value to null
-    K k;
-    V v;
-    this->_header = new Node<K, V>(k, v, _max_level);
-    this->lruCache = new LRU<K, V>(VOLATILE_LRU_THRESHOLD);
+    K k = K();
+    V v = V();
+    this->_header = create_node(k, std::move(v), _max_level);
 };
 
 // 跳表析构函数
-template <typename K, typename V>
-SkipList<K, V>::~SkipList()
+template <typename K, typename V, typename Compare, typename KeyCodec>
+SkipList<K, V, Compare, KeyCodec>::~SkipList()
 {
 
-    if (_file_writer.is_open())
+    _mtx.lock();
+    _expire_stop = true;
+    _expire_cv.notify_one();
+    _mtx.unlock();
+    if (_expire_thread.joinable())
     {
-        _file_writer.close();
+        _expire_thread.join();
     }
+
     if (_file_reader.is_open())
     {
         _file_reader.close();
     }
-    delete _header;
+    // 等后台快照结束, 它完成后还要访问 _wal
+    wait_bgsave();
+    delete _wal;
+
+    // 节点内存由 _arena 统一释放, 这里只需调用析构函数释放key和value持有的资源
+    Node<K, V> *node = _header->next[0];
+    while (node != NULL)
+    {
+        Node<K, V> *next = node->next[0];
+        node->~Node<K, V>();
+        node = next;
+    }
+    for (size_t i = 0; i < _retired_nodes.size(); i++)
+    {
+        _retired_nodes[i].first->~Node<K, V>();
+    }
+    for (size_t i = 0; i < _retired_values.size(); i++)
+    {
+        delete _retired_values[i].first;
+    }
+    _header->~Node<K, V>();
 }
 
 // 一直向跳表中添加数据,但是不更新索引.就可能出现两个节点中数据过多的情况,跳表会退化为单链表
@@ -693,18 +2782,14 @@ SkipList<K, V>::~SkipList()
 // 返回值大于1就会建立一级索引,概率为 1 - 1/2 = 1/2
 // 返回值大于2就会建立二级索引,概率为 1 - 1/2 - 1/4 = 1/4
 // 返回值大于3就会建立三级索引,概率为 1 - 1/2 - 1/4 - 1/8 = 1/8
-template <typename K, typename V>
-int SkipList<K, V>::get_random_level()
+// 以上是 BRANCHING_HALF 的情况, set_branching() 可以把1/2换成1/4或1/e
+// 随机数来自每个线程自己的生成器(见 random_level.h), 不像 rand() 那样在全局锁上排队
+template <typename K, typename V, typename Compare, typename KeyCodec>
+int SkipList<K, V, Compare, KeyCodec>::get_random_level()
 {
-
-    int k = 1;
-    // k变成2的概率是1/2,变成2以后再变成3的概率是1/2 * 1/2 = 1/4...
-    while (rand() % 2)
-    {
-        k++;
-    }
-    k = (k < _max_level) ? k : _max_level;
-    return k;
+    int level = random_level(_branching, _max_level);
+    _metrics.record_level(level);
+    return level;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,365 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "coding.h"
+#include "mmap_file.h"
+#include "async_io.h"
+#include "logger.h"
+using namespace std;
+
+// 二进制快照文件格式
+// +--------------------------------------------------------------+
+// | magic "SKIPSNAP"(8) | version(4) | crc32c(4)                  |  文件头
+// +--------------------------------------------------------------+
+// | crc32c(4) | length(4) | count(4) | entry * count              |  数据块
+// | ...                                                          |
+// | crc32c(4) | 0(4) | 0(4)                                       |  结束块
+// | total_count(8) | crc32c(4)                                   |  文件尾
+// +--------------------------------------------------------------+
+// 每个数据块的crc32c覆盖 count 和块内所有 entry, 块的大小约为 SNAPSHOT_BLOCK_SIZE
+// entry格式:
+// | flags(1) | [到期时间(8)] | key长度(4) | key | value长度(4) | value |
+// flags 的最低位表示是否带有过期时间, 带有时才有中括号中的字段, 为毫秒级的unix时间戳
+// 写入时按跳表第0层的顺序输出, 所以快照中的key严格递增, 加载时可以直接自底向上建表
+
+#define SNAPSHOT_MAGIC "SKIPSNAP"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 16
+#define SNAPSHOT_BLOCK_HEADER_SIZE 12
+#define SNAPSHOT_FOOTER_SIZE 12
+#define SNAPSHOT_BLOCK_SIZE (64 * 1024)
+
+#define SNAPSHOT_FLAG_TTL 1
+
+// 快照中的一条记录, key和value指向快照文件的映射区域
+struct SnapshotEntry
+{
+    const char *key;
+    uint32_t key_len;
+    const char *value;
+    uint32_t value_len;
+    // 到期时间(毫秒), 没有设置过期时间为0
+    int64_t expire_at_ms;
+};
+
+// 一次快照的结果
+struct SnapshotStats
+{
+    bool ok;
+    uint64_t keys;
+    uint64_t bytes;
+    double seconds;
+};
+
+// 快照写入器: 先写到临时文件, finish() 时fsync并rename为目标文件
+// 写入交给 AsyncWriter 在后台进行(见 async_io.h), 编码下一块时上一块还在写
+class SnapshotWriter
+{
+public:
+    // io_mode为写文件用的后端, 见 async_io.h
+    explicit SnapshotWriter(AsyncIoMode io_mode = async_io_mode());
+    ~SnapshotWriter();
+
+    bool open(const string &path);
+
+    // key和value为编码后的字节, expire_at_ms为0表示没有过期时间
+    void add(const string &key, const string &value, int64_t expire_at_ms = 0);
+
+    bool finish();
+
+    uint64_t entry_count() const { return _count; }
+    uint64_t bytes_written() const { return _out.size(); }
+    const char *io_backend() const { return _out.backend(); }
+
+private:
+    bool flush_block();
+
+private:
+    AsyncWriter _out;
+    AsyncIoMode _io_mode;
+    string _path;
+    string _tmp_path;
+    string _block;
+    uint32_t _block_entries;
+    uint64_t _count;
+};
+
+// 快照读取器: 通过mmap映射整个文件, 逐条读出记录, 每进入一个数据块先校验crc
+// 读出的key和value直接指向映射区域, 不经过额外的读缓冲; 打开时让内核在后台预读整个文件
+class SnapshotReader
+{
+public:
+    SnapshotReader();
+
+    // 文件不存在或不是二进制快照返回false, 可通过 is_snapshot() 区分
+    bool open(const string &path);
+
+    // 读出下一条记录, 读完或出错返回false, 出错时 error() 不为空
+    bool next(SnapshotEntry *entry);
+
+    bool is_snapshot() const { return _is_snapshot; }
+
+    // 文件的映射, 解码出的值如果引用映射区域, 需要持有它
+    const shared_ptr<MappedFile> &mapping() const { return _file; }
+    const string &error() const { return _error; }
+    uint64_t entry_count() const { return _count; }
+
+private:
+    bool fail(const string &msg);
+    bool next_block();
+
+private:
+    shared_ptr<MappedFile> _file;
+    const char *_data;
+    size_t _size;
+    uint32_t _version;
+    size_t _pos;
+    size_t _block_end;
+    uint32_t _block_left;
+    uint64_t _count;
+    bool _is_snapshot;
+    bool _done;
+    string _error;
+};
+
+/*---------------------------------------------------------------------------------*/
+
+inline SnapshotWriter::SnapshotWriter(AsyncIoMode io_mode)
+    : _io_mode(io_mode), _block_entries(0), _count(0) {}
+
+inline SnapshotWriter::~SnapshotWriter()
+{
+    if (_out.is_open())
+    {
+        _out.abort();
+        unlink(_tmp_path.c_str());
+    }
+}
+
+// 快照只在写完后读一次, 用O_DIRECT写出, 不占用页缓存
+inline bool SnapshotWriter::open(const string &path)
+{
+    _path = path;
+    _tmp_path = path + ".tmp";
+    if (!_out.open(_tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644, true, _io_mode))
+    {
+        LOG_ERROR("创建快照文件 " << _tmp_path << " 失败, errno: " << _out.error());
+        return false;
+    }
+
+    string header(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    put_fixed32(&header, SNAPSHOT_VERSION);
+    put_fixed32(&header, crc32c(header.data(), header.size()));
+    return _out.append(header.data(), header.size());
+}
+
+inline void SnapshotWriter::add(const string &key, const string &value, int64_t expire_at_ms)
+{
+    _block.push_back(expire_at_ms != 0 ? SNAPSHOT_FLAG_TTL : 0);
+    if (expire_at_ms != 0)
+    {
+        put_fixed64(&_block, static_cast<uint64_t>(expire_at_ms));
+    }
+    put_fixed32(&_block, static_cast<uint32_t>(key.size()));
+    _block.append(key);
+    put_fixed32(&_block, static_cast<uint32_t>(value.size()));
+    _block.append(value);
+
+    _block_entries++;
+    _count++;
+    if (_block.size() >= SNAPSHOT_BLOCK_SIZE)
+    {
+        flush_block();
+    }
+}
+
+inline bool SnapshotWriter::flush_block()
+{
+    string header;
+    string count;
+    put_fixed32(&count, _block_entries);
+    uint32_t crc = crc32c_extend(crc32c(count.data(), count.size()), _block.data(), _block.size());
+    put_fixed32(&header, crc);
+    put_fixed32(&header, static_cast<uint32_t>(_block.size()));
+    header.append(count);
+
+    bool ok = _out.append(header.data(), header.size()) && _out.append(_block.data(), _block.size());
+    _block.clear();
+    _block_entries = 0;
+    return ok;
+}
+
+inline bool SnapshotWriter::finish()
+{
+    if (!_out.is_open())
+    {
+        return false;
+    }
+    if (_block_entries > 0)
+    {
+        flush_block();
+    }
+    // 长度为0的块标志数据结束
+    flush_block();
+
+    string footer;
+    put_fixed64(&footer, _count);
+    put_fixed32(&footer, crc32c(footer.data(), footer.size()));
+    _out.append(footer.data(), footer.size());
+
+    // 等后台的写入全部完成后fsync
+    if (!_out.finish(true) || rename(_tmp_path.c_str(), _path.c_str()) != 0)
+    {
+        LOG_ERROR("写入快照文件 " << _path << " 失败, errno: " << errno);
+        unlink(_tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------------*/
+
+inline SnapshotReader::SnapshotReader()
+    : _data(NULL), _size(0), _version(0), _pos(0), _block_end(0), _block_left(0), _count(0), _is_snapshot(false), _done(false) {}
+
+inline bool SnapshotReader::open(const string &path)
+{
+    _file = MappedFile::open(path);
+    if (!_file)
+    {
+        return false;
+    }
+    _data = _file->data();
+    _size = _file->size();
+    // 快照可能是O_DIRECT写出的, 不在页缓存里; 预读和解码建表同时进行
+    _file->will_need();
+
+    if (_size < SNAPSHOT_HEADER_SIZE || memcmp(_data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+    {
+        return false;
+    }
+    _is_snapshot = true;
+
+    if (crc32c(_data, 12) != decode_fixed32(_data + 12))
+    {
+        return fail("文件头校验失败");
+    }
+    _version = decode_fixed32(_data + SNAPSHOT_MAGIC_SIZE);
+    if (_version != SNAPSHOT_VERSION)
+    {
+        return fail("不支持的快照版本");
+    }
+    _pos = SNAPSHOT_HEADER_SIZE;
+    return true;
+}
+
+inline bool SnapshotReader::fail(const string &msg)
+{
+    _error = msg;
+    _done = true;
+    return false;
+}
+
+// 进入下一个数据块, 校验其crc
+inline bool SnapshotReader::next_block()
+{
+    if (_pos + SNAPSHOT_BLOCK_HEADER_SIZE > _size)
+    {
+        return fail("快照文件不完整");
+    }
+    const char *p = _data + _pos;
+    uint32_t crc = decode_fixed32(p);
+    uint32_t length = decode_fixed32(p + 4);
+    uint32_t count = decode_fixed32(p + 8);
+    if (_pos + SNAPSHOT_BLOCK_HEADER_SIZE + length > _size)
+    {
+        return fail("快照文件不完整");
+    }
+    if (crc32c_extend(crc32c(p + 8, 4), p + SNAPSHOT_BLOCK_HEADER_SIZE, length) != crc)
+    {
+        return fail("数据块校验失败");
+    }
+
+    _pos += SNAPSHOT_BLOCK_HEADER_SIZE;
+    if (length == 0)
+    {
+        // 结束块, 校验文件尾记录的总条数
+        if (_pos + SNAPSHOT_FOOTER_SIZE > _size ||
+            crc32c(_data + _pos, 8) != decode_fixed32(_data + _pos + 8) ||
+            decode_fixed64(_data + _pos) != _count)
+        {
+            return fail("文件尾校验失败");
+        }
+        _done = true;
+        return false;
+    }
+    _block_end = _pos + length;
+    _block_left = count;
+    return true;
+}
+
+inline bool SnapshotReader::next(SnapshotEntry *entry)
+{
+    if (_done)
+    {
+        return false;
+    }
+    while (_block_left == 0)
+    {
+        if (_pos != _block_end && _block_end != 0)
+        {
+            return fail("数据块长度与条数不符");
+        }
+        if (!next_block())
+        {
+            return false;
+        }
+    }
+
+    const char *p = _data + _pos;
+    const char *limit = _data + _block_end;
+    if (p + 1 > limit)
+    {
+        return fail("数据块格式错误");
+    }
+    bool has_ttl = (*p & SNAPSHOT_FLAG_TTL) != 0;
+    p++;
+    entry->expire_at_ms = 0;
+    if (has_ttl)
+    {
+        if (p + 8 > limit)
+        {
+            return fail("数据块格式错误");
+        }
+        entry->expire_at_ms = static_cast<int64_t>(decode_fixed64(p));
+        p += 8;
+    }
+    if (p + 4 > limit || p + 4 + decode_fixed32(p) > limit)
+    {
+        return fail("数据块格式错误");
+    }
+    entry->key_len = decode_fixed32(p);
+    entry->key = p + 4;
+    p += 4 + entry->key_len;
+    if (p + 4 > limit || p + 4 + decode_fixed32(p) > limit)
+    {
+        return fail("数据块格式错误");
+    }
+    entry->value_len = decode_fixed32(p);
+    entry->value = p + 4;
+    p += 4 + entry->value_len;
+
+    _pos = p - _data;
+    _block_left--;
+    _count++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+
+// 压力测试用到的随机数, key分布和延迟直方图
+
+// splitmix64, 也用作可逆的整数打散函数: 不同的i得到不同的结果
+inline uint64_t mix64(uint64_t z)
+{
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// 每个线程一个, 不加锁
+class BenchRandom
+{
+public:
+    explicit BenchRandom(uint64_t seed) : _state(mix64(seed) | 1) {}
+
+    uint64_t next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // [0, n)
+    uint64_t uniform(uint64_t n) { return n == 0 ? 0 : next() % n; }
+
+    // [0, 1)
+    double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    uint64_t _state;
+};
+
+// YCSB 的 Zipfian 分布(Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+// 返回 [0, n), 0最热; 构造时计算zeta(n), O(n), 之后每次取值 O(1), 多个线程可以共用
+class Zipfian
+{
+public:
+    Zipfian(uint64_t n, double theta = 0.99) : _n(n < 1 ? 1 : n), _theta(theta)
+    {
+        double zeta2 = 0;
+        _zetan = 0;
+        for (uint64_t i = 1; i <= _n; i++)
+        {
+            _zetan += 1.0 / pow((double)i, _theta);
+            if (i == 2)
+            {
+                zeta2 = _zetan;
+            }
+        }
+        _alpha = 1.0 / (1.0 - _theta);
+        _eta = (1 - pow(2.0 / _n, 1 - _theta)) / (1 - zeta2 / _zetan);
+    }
+
+    uint64_t next(BenchRandom &rng) const
+    {
+        double u = rng.real();
+        double uz = u * _zetan;
+        if (uz < 1.0)
+        {
+            return 0;
+        }
+        if (uz < 1.0 + pow(0.5, _theta))
+        {
+            return 1;
+        }
+        uint64_t v = (uint64_t)(_n * pow(_eta * u - _eta + 1, _alpha));
+        return v < _n ? v : _n - 1;
+    }
+
+private:
+    uint64_t _n;
+    double _theta;
+    double _zetan;
+    double _alpha;
+    double _eta;
+};
+
+// 延迟直方图, 单位纳秒
+// 对数线性分桶: 小于64ns每纳秒一个桶, 之后每个2的幂区间分32个桶, 相对误差不超过约3%
+// 每个线程记录自己的直方图, 结束后合并
+class Histogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB = 1 << SUB_BITS;
+    static const int BUCKETS = 2 * SUB + (64 - SUB_BITS - 1) * SUB;
+
+    Histogram() : _counts(BUCKETS, 0), _count(0), _sum(0), _max(0) {}
+
+    void record(uint64_t ns)
+    {
+        _counts[bucket(ns)]++;
+        _count++;
+        _sum += ns;
+        _max = ns > _max ? ns : _max;
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            _counts[i] += other._counts[i];
+        }
+        _count += other._count;
+        _sum += other._sum;
+        _max = other._max > _max ? other._max : _max;
+    }
+
+    uint64_t count() const { return _count; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _count == 0 ? 0 : (double)_sum / _count; }
+
+    // 第q分位(0 < q <= 1)所在桶的上界
+    uint64_t percentile(double q) const
+    {
+        if (_count == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)ceil(q * _count);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += _counts[i];
+            if (seen >= rank)
+            {
+                uint64_t upper = bucket_upper(i);
+                return upper < _max ? upper : _max;
+            }
+        }
+        return _max;
+    }
+
+private:
+    static int bucket(uint64_t v)
+    {
+        if (v < 2 * SUB)
+        {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return 2 * SUB + (shift - 1) * SUB + (int)((v >> shift) - SUB);
+    }
+
+    static uint64_t bucket_upper(int i)
+    {
+        if (i < 2 * SUB)
+        {
+            return i;
+        }
+        int shift = (i - 2 * SUB) / SUB + 1;
+        uint64_t sub = (i - 2 * SUB) % SUB + SUB;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> _counts;
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _max;
+};
+
+inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "../skiplist.h"
+#include "bench_util.h"
+
+// 并发正确性测试: 在每种maxmemory策略下, 写线程不断插入, 覆盖, 删除和设置过期时间, 读线程同时不加锁地查找, 批量查找,
+// 用迭代器顺序扫描并读取 size(), 后台还有过期清理线程和淘汰. 检查读到的value属于对应的key, 扫描出的key严格递增.
+// 主要用来配合ThreadSanitizer找数据竞争:
+//
+//   g++ stress-test/concurrent_test.cpp -o ./bin/concurrent_test -O1 -g -fsanitize=thread --std=c++11 -pthread
+//   ./bin/concurrent_test --ops=20000
+//
+// 发现错误时输出出错的位置并返回1
+
+struct TestOptions
+{
+    int writers = 2;
+    int readers = 3;
+    int keys = 2000;
+    int ops = 20000;
+    int value_size = 64;
+    uint64_t seed = 1;
+};
+
+TestOptions topt;
+std::atomic<int> failures(0);
+
+std::string test_key(uint64_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%06llu", (unsigned long long)i);
+    return buf;
+}
+
+// value以 "key:" 开头, 读者据此检查读到的value是否属于这个key
+std::string test_value(const std::string &key, uint64_t n)
+{
+    std::string value = key + ":" + std::to_string((unsigned long long)n);
+    if ((int)value.size() < topt.value_size)
+    {
+        value.append(topt.value_size - value.size(), 'v');
+    }
+    return value;
+}
+
+bool value_matches(const std::string &key, const std::string &value)
+{
+    return value.size() > key.size() && value.compare(0, key.size(), key) == 0 && value[key.size()] == ':';
+}
+
+void fail(const char *what, const std::string &key)
+{
+    if (failures.fetch_add(1) < 10)
+    {
+        fprintf(stderr, "FAIL: %s, key %s\n", what, key.c_str());
+    }
+}
+
+typedef SkipList<std::string, std::string> TestList;
+
+void writer(TestList *list, int tid)
+{
+    BenchRandom rng(topt.seed * 1000003 + tid);
+    for (int i = 0; i < topt.ops; i++)
+    {
+        std::string key = test_key(rng.uniform(topt.keys));
+        uint64_t r = rng.uniform(100);
+        if (r < 45)
+        {
+            list->insert_element(key, test_value(key, i));
+        }
+        else if (r < 60)
+        {
+            // 一半带过期时间, 一半清除原来的过期时间
+            list->set_element(key, test_value(key, i), rng.uniform(2) ? 1 + rng.uniform(20) : 0);
+        }
+        else if (r < 80)
+        {
+            list->delete_element(key);
+        }
+        else
+        {
+            // 到期时间很短, 过期清理线程和读者跳过已到期key的路径都会被执行到
+            list->pexpire_element(key, 1 + rng.uniform(20));
+        }
+    }
+}
+
+void reader(TestList *list, int tid)
+{
+    BenchRandom rng(topt.seed * 2000003 + tid);
+    std::string value;
+    for (int i = 0; i < topt.ops; i++)
+    {
+        std::string key = test_key(rng.uniform(topt.keys));
+        uint64_t r = rng.uniform(100);
+        if (r < 70)
+        {
+            if (list->search_element(key, &value) && !value_matches(key, value))
+            {
+                fail("search_element returned a value of another key", key);
+            }
+        }
+        else if (r < 90)
+        {
+            std::string last;
+            int n = 0;
+            for (TestList::Iterator it = list->seek(key); it.valid() && n < 32; it.next(), n++)
+            {
+                if (n > 0 && !(last < it.key()))
+                {
+                    fail("iterator keys are not increasing", it.key());
+                }
+                if (!value_matches(it.key(), it.value()))
+                {
+                    fail("iterator returned a value of another key", it.key());
+                }
+                last = it.key();
+            }
+        }
+        else if (r < 95)
+        {
+            std::vector<std::string> keys;
+            for (int k = 0; k < 8; k++)
+            {
+                keys.push_back(test_key(rng.uniform(topt.keys)));
+            }
+            std::vector<std::string> values;
+            std::vector<bool> found;
+            list->multi_get(keys, &values, &found);
+            for (size_t k = 0; k < keys.size(); k++)
+            {
+                if (found[k] && !value_matches(keys[k], values[k]))
+                {
+                    fail("multi_get returned a value of another key", keys[k]);
+                }
+            }
+        }
+        else
+        {
+            if (list->size() < 0)
+            {
+                fail("size() is negative", key);
+            }
+            list->pttl_element(key);
+        }
+    }
+}
+
+bool run(MaxmemoryPolicy policy, const char *name)
+{
+    TestList list(max_level_for(topt.keys, BRANCHING_HALF));
+    // 上限约为全部key所需内存的一半, 写入过程中会不断触发淘汰
+    list.set_maxmemory(topt.keys * (topt.value_size + 96) / 2, policy);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < topt.writers; t++)
+    {
+        threads.push_back(std::thread(writer, &list, t));
+    }
+    for (int t = 0; t < topt.readers; t++)
+    {
+        threads.push_back(std::thread(reader, &list, t));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+
+    int scanned = 0;
+    for (TestList::Iterator it = list.seek(test_key(0)); it.valid(); it.next())
+    {
+        scanned++;
+    }
+    // 已到期但还未清理的key计入size(), 但迭代器会跳过
+    if (scanned > list.size())
+    {
+        fail("iterator returned more keys than size()", name);
+    }
+    printf("%-14s size %d, scanned %d, evicted %llu, used_memory %zu\n", name, list.size(), scanned,
+           (unsigned long long)list.evicted_keys(), list.used_memory());
+    return failures.load() == 0;
+}
+
+bool parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (name == "writers")
+            topt.writers = atoi(value.c_str());
+        else if (name == "readers")
+            topt.readers = atoi(value.c_str());
+        else if (name == "keys")
+            topt.keys = atoi(value.c_str());
+        else if (name == "ops")
+            topt.ops = atoi(value.c_str());
+        else if (name == "value-size")
+            topt.value_size = atoi(value.c_str());
+        else if (name == "seed")
+            topt.seed = strtoull(value.c_str(), NULL, 10);
+        else
+            return false;
+    }
+    return topt.writers >= 1 && topt.readers >= 1 && topt.keys >= 1 && topt.ops >= 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse(argc, argv))
+    {
+        fprintf(stderr, "usage: concurrent_test [--writers=2] [--readers=3] [--keys=2000] [--ops=20000] "
+                        "[--value-size=64] [--seed=1]\n");
+        return 1;
+    }
+    // 超出上限拒绝插入时每次都有一条WARN日志
+    Logger::instance().set_level(LOG_LEVEL_ERROR);
+    const MaxmemoryPolicy policies[] = {MAXMEMORY_NOEVICTION, MAXMEMORY_VOLATILE_LRU, MAXMEMORY_ALLKEYS_LRU,
+                                        MAXMEMORY_ALLKEYS_LFU, MAXMEMORY_VOLATILE_TTL};
+    const char *names[] = {"noeviction", "volatile-lru", "allkeys-lru", "allkeys-lfu", "volatile-ttl"};
+    for (int i = 0; i < 5; i++)
+    {
+        if (!run(policies[i], names[i]))
+        {
+            return 1;
+        }
+    }
+    printf("ok\n");
+    return 0;
+}
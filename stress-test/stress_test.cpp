@@ -1,112 +1,604 @@
 #include <iostream>
-#include <chrono>
+#include <cstdio>
 #include <cstdlib>
-#include <pthread.h>
-#include <time.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <unistd.h>
 #include "../skiplist.h"
+#include "../concurrent_skiplist.h"
+#include "../sharded_skiplist.h"
+#include "bench_util.h"
 
-#define NUM_THREADS 1
-#define TEST_COUNT 100000
-SkipList<int, std::string> skipList(18);
+// 压力测试: 先装载 records 个key, 再按YCSB风格的负载执行 ops 次操作,
+// 输出每个阶段的吞吐量和各类操作的 p50/p99/p999 延迟; --format=json 时每个阶段输出一行JSON, 便于脚本比较回归
+//
+//   ./bin/stress --workload=a --threads=8 --records=1000000 --ops=1000000
+//   ./bin/stress --workload=custom --read=0.9 --update=0.1 --distribution=uniform --impl=lockfree
+//   ./bin/stress --workload=churn --records=100000 --rounds=20
+//
+// 结果用printf输出; 跳表的日志默认级别为INFO, 每个key一条的DEBUG日志不会编译进来
 
-// 插入元素的线程工作函数
-void *insertElement(void *threadid)
+enum OpType
 {
-    long tid;
-    tid = (long)threadid;
-    std::cout << tid << std::endl;
-    int tmp = TEST_COUNT / NUM_THREADS;
-    for (int i = tid * tmp, count = 0; count < tmp; i++)
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_RMW,
+    OP_COUNT
+};
+
+const char *OP_NAMES[OP_COUNT] = {"read", "update", "insert", "scan", "rmw"};
+
+enum Distribution
+{
+    DIST_UNIFORM,
+    DIST_ZIPFIAN,
+    DIST_SEQUENTIAL,
+    DIST_LATEST
+};
+
+struct Options
+{
+    int threads = 1;
+    uint64_t records = 100000;
+    uint64_t ops = 100000;
+    int key_size = 16;
+    int value_size = 100;
+    std::string workload = "a";
+    // 各类操作的比例, 由 workload 决定, workload=custom 时用命令行给出的值
+    double mix[OP_COUNT] = {0.5, 0.5, 0, 0, 0};
+    std::string distribution;
+    int scan_length = 100;
+    bool ordered = false;
+    std::string impl = "skiplist";
+    int shards = 8;
+    std::string wal = "none";
+    std::string branching = "half";
+    int max_level = 0;
+    int rounds = 20;
+    uint64_t seed = 1;
+    std::string format = "text";
+};
+
+Options opt;
+Distribution dist = DIST_ZIPFIAN;
+Zipfian *zipf = NULL;
+// 下一个要插入的key的序号, 装载阶段之后从 records 开始递增
+std::atomic<uint64_t> insert_cursor(0);
+
+// 第i个key: 默认 "user" + 打散后的16位十六进制数, 插入顺序与key的顺序无关;
+// --order=ordered 时为 "user" + 补0的十进制序号, 按序号顺序就是key的顺序. 不足 key_size 时在末尾补'x'
+std::string key_of(uint64_t i)
+{
+    char buf[32];
+    if (opt.ordered)
+    {
+        snprintf(buf, sizeof(buf), "user%012llu", (unsigned long long)i);
+    }
+    else
     {
-        count++;
-        skipList.insert_element(rand() % TEST_COUNT, "a");
+        snprintf(buf, sizeof(buf), "user%016llx", (unsigned long long)mix64(i));
     }
-    pthread_exit(NULL);
+    std::string key(buf);
+    if ((int)key.size() < opt.key_size)
+    {
+        key.append(opt.key_size - key.size(), 'x');
+    }
+    return key;
 }
 
-// 读取元素的线程工作函数
-void *getElement(void *threadid)
+// 比所有key都大, 用作范围查询的上界
+const std::string KEY_END = "~";
+
+// 三种实现的统一接口
+struct LockedStore
 {
-    long tid;
-    tid = (long)threadid;
-    std::cout << tid << std::endl;
-    int tmp = TEST_COUNT / NUM_THREADS;
-    for (int i = tid * tmp, count = 0; count < tmp; i++)
+    SkipList<std::string, std::string> list;
+
+    explicit LockedStore(int max_level) : list(max_level) {}
+    bool read(const std::string &key, std::string *value) { return list.search_element(key, value); }
+    void write(const std::string &key, const std::string &value) { list.insert_element(key, value); }
+    bool remove(const std::string &key) { return list.delete_element(key); }
+    int scan(const std::string &key, int n)
     {
-        count++;
-        skipList.search_element(rand() % TEST_COUNT);
+        return list.scan(key, KEY_END, n, [](const std::string &, const std::string &) { return true; });
     }
-    pthread_exit(NULL);
-}
+    size_t memory() { return list.used_memory(); }
+};
 
-int main()
+struct LockFreeStore
 {
-    srand(time(NULL));
+    ConcurrentSkipList<std::string, std::string> list;
+
+    explicit LockFreeStore(int max_level) : list(max_level) {}
+    bool read(const std::string &key, std::string *value) { return list.search_element(key, value); }
+    void write(const std::string &key, const std::string &value) { list.insert_element(key, value); }
+    bool remove(const std::string &key) { return list.delete_element(key); }
+    // 无锁跳表不支持范围查询
+    int scan(const std::string &, int) { return -1; }
+    size_t memory() { return 0; }
+};
+
+struct ShardedStore
+{
+    ShardedSkipList<std::string, std::string> list;
+
+    ShardedStore(int shards, int max_level) : list(shards, max_level) {}
+    bool read(const std::string &key, std::string *value) { return list.search_element(key, value); }
+    void write(const std::string &key, const std::string &value) { list.insert_element(key, value); }
+    bool remove(const std::string &key) { return list.delete_element(key); }
+    int scan(const std::string &key, int n)
     {
+        return list.scan(key, KEY_END, n, [](const std::string &, const std::string &) { return true; });
+    }
+    size_t memory() { return list.used_memory(); }
+};
 
-        pthread_t threads[NUM_THREADS];
-        int rc;
-        long i; // 避免转为void*时大小不一致的转换
+// 一个阶段的统计结果
+struct PhaseResult
+{
+    std::string name;
+    double seconds = 0;
+    uint64_t misses = 0;
+    Histogram hist[OP_COUNT];
+};
 
-        auto start = std::chrono::high_resolution_clock::now(); // 计时开始
+struct ThreadResult
+{
+    uint64_t misses = 0;
+    Histogram hist[OP_COUNT];
+};
+
+// 按分布选出一个已存在的key的序号
+uint64_t choose_key(BenchRandom &rng, uint64_t &sequence)
+{
+    uint64_t count = insert_cursor.load(std::memory_order_relaxed);
+    count = count < 1 ? 1 : count;
+    switch (dist)
+    {
+    case DIST_UNIFORM:
+        return rng.uniform(count);
+    case DIST_SEQUENTIAL:
+        return sequence++ % count;
+    case DIST_LATEST:
+    {
+        // 越新插入的key越热
+        uint64_t back = zipf->next(rng);
+        return back < count ? count - 1 - back : 0;
+    }
+    default:
+        // 打散的Zipfian: 热点分散在整个key空间, 而不是集中在最早插入的几个key
+        return mix64(zipf->next(rng)) % opt.records;
+    }
+}
 
-        for (i = 0; i < NUM_THREADS; i++)
+// 按 mix 中的比例选一种操作
+OpType choose_op(BenchRandom &rng)
+{
+    double r = rng.real();
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        if (r < opt.mix[i])
         {
-            std::cout << "main() : creating thread, " << i << std::endl;
-            rc = pthread_create(&threads[i], NULL, insertElement, (void *)i);
+            return (OpType)i;
+        }
+        r -= opt.mix[i];
+    }
+    return OP_READ;
+}
 
-            if (rc)
-            {
-                std::cout << "Error:unable to create thread," << rc << std::endl;
-                exit(-1);
-            }
+template <typename Store>
+void load_worker(Store *store, int tid, ThreadResult *result)
+{
+    std::string value(opt.value_size, 'a' + tid % 26);
+    uint64_t begin = opt.records * tid / opt.threads, end = opt.records * (tid + 1) / opt.threads;
+    for (uint64_t i = begin; i < end; i++)
+    {
+        std::string key = key_of(i);
+        uint64_t start = now_ns();
+        store->write(key, value);
+        result->hist[OP_INSERT].record(now_ns() - start);
+    }
+}
+
+template <typename Store>
+void run_worker(Store *store, int tid, ThreadResult *result)
+{
+    BenchRandom rng(opt.seed * 1000003 + tid);
+    std::string value(opt.value_size, 'A' + tid % 26);
+    std::string out;
+    uint64_t ops = opt.ops * (tid + 1) / opt.threads - opt.ops * tid / opt.threads;
+    uint64_t sequence = opt.records * tid / opt.threads;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        OpType op = choose_op(rng);
+        std::string key = key_of(op == OP_INSERT ? insert_cursor.fetch_add(1) : choose_key(rng, sequence));
+        uint64_t start = now_ns();
+        switch (op)
+        {
+        case OP_READ:
+            result->misses += !store->read(key, &out);
+            break;
+        case OP_UPDATE:
+        case OP_INSERT:
+            store->write(key, value);
+            break;
+        case OP_SCAN:
+            result->misses += store->scan(key, 1 + rng.uniform(opt.scan_length)) <= 0;
+            break;
+        default:
+            result->misses += !store->read(key, &out);
+            store->write(key, value);
+            break;
         }
+        result->hist[op].record(now_ns() - start);
+    }
+}
 
-        void *ret;
-        for (i = 0; i < NUM_THREADS; i++)
+template <typename Store, typename Worker>
+PhaseResult run_phase(const std::string &name, Store *store, Worker worker)
+{
+    std::vector<ThreadResult> results(opt.threads);
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns();
+    for (int t = 0; t < opt.threads; t++)
+    {
+        threads.push_back(std::thread(worker, store, t, &results[t]));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+
+    PhaseResult phase;
+    phase.name = name;
+    phase.seconds = (now_ns() - start) / 1e9;
+    for (int t = 0; t < opt.threads; t++)
+    {
+        phase.misses += results[t].misses;
+        for (int i = 0; i < OP_COUNT; i++)
         {
-            if (pthread_join(threads[i], &ret) != 0)
+            phase.hist[i].merge(results[t].hist[i]);
+        }
+    }
+    return phase;
+}
+
+void report(const PhaseResult &phase, size_t memory)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        total += phase.hist[i].count();
+    }
+    double throughput = phase.seconds > 0 ? total / phase.seconds : 0;
+
+    if (opt.format == "json")
+    {
+        printf("{\"phase\":\"%s\",\"workload\":\"%s\",\"impl\":\"%s\",\"distribution\":\"%s\",\"threads\":%d,"
+               "\"records\":%llu,\"key_size\":%d,\"value_size\":%d,\"ops\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+               "\"misses\":%llu,\"memory_bytes\":%zu,\"latency_ns\":{",
+               phase.name.c_str(), opt.workload.c_str(), opt.impl.c_str(), opt.distribution.c_str(), opt.threads,
+               (unsigned long long)opt.records, opt.key_size, opt.value_size, (unsigned long long)total, phase.seconds,
+               throughput, (unsigned long long)phase.misses, memory);
+        bool first = true;
+        for (int i = 0; i < OP_COUNT; i++)
+        {
+            const Histogram &h = phase.hist[i];
+            if (h.count() == 0)
             {
-                perror("pthread_create() error");
-                exit(3);
+                continue;
             }
+            printf("%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                   first ? "" : ",", OP_NAMES[i], (unsigned long long)h.count(), h.mean(),
+                   (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.99),
+                   (unsigned long long)h.percentile(0.999), (unsigned long long)h.max());
+            first = false;
         }
-        auto finish = std::chrono::high_resolution_clock::now(); // 计时结束
-        std::chrono::duration<double> elapsed = finish - start;
-        std::cout << "insert elapsed:" << elapsed.count() << std::endl; // 打印所花时间
+        printf("}}\n");
+        return;
     }
-    
-    skipList.display_list();
 
+    printf("[%s] %llu ops in %.3fs, %.0f ops/s, misses %llu", phase.name.c_str(), (unsigned long long)total,
+           phase.seconds, throughput, (unsigned long long)phase.misses);
+    if (memory > 0)
+    {
+        printf(", memory %zu KB", memory / 1024);
+    }
+    printf("\n  %-7s %10s %10s %10s %10s %10s %10s\n", "op", "count", "mean(us)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (int i = 0; i < OP_COUNT; i++)
     {
-        pthread_t threads[NUM_THREADS];
-        int rc;
-        long i;
-        auto start = std::chrono::high_resolution_clock::now();
+        const Histogram &h = phase.hist[i];
+        if (h.count() == 0)
+        {
+            continue;
+        }
+        printf("  %-7s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", OP_NAMES[i], (unsigned long long)h.count(),
+               h.mean() / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3,
+               h.max() / 1e3);
+    }
+}
 
-        for( i = 0; i < NUM_THREADS; i++ ) {
-            std::cout << "main() : creating thread, " << i << std::endl;
-            rc = pthread_create(&threads[i], NULL, getElement, (void *)i);
+// 当前进程的常驻内存(RSS), 单位KB
+long rss_kb()
+{
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
 
-            if (rc) {
-                std::cout << "Error:unable to create thread," << rc << std::endl;
-                exit(-1);
-            }
+// 反复插入再删除同一批key, 被删除节点的内存被回收复用时RSS应保持平稳
+template <typename Store>
+void churn(Store *store)
+{
+    std::string value(opt.value_size, 'a');
+    for (int round = 0; round < opt.rounds; round++)
+    {
+        uint64_t start = now_ns();
+        for (uint64_t i = 0; i < opt.records; i++)
+        {
+            store->write(key_of(i), value);
         }
+        for (uint64_t i = 0; i < opt.records; i++)
+        {
+            store->remove(key_of(i));
+        }
+        double seconds = (now_ns() - start) / 1e9;
+        if (opt.format == "json")
+        {
+            printf("{\"phase\":\"churn\",\"impl\":\"%s\",\"round\":%d,\"seconds\":%.6f,\"size\":%d,\"rss_kb\":%ld}\n",
+                   opt.impl.c_str(), round, seconds, store->list.size(), rss_kb());
+        }
+        else
+        {
+            printf("round %d: %.3fs, size %d, rss %ld KB\n", round, seconds, store->list.size(), rss_kb());
+        }
+    }
+}
+
+template <typename Store>
+void benchmark(Store *store)
+{
+    if (opt.workload == "churn")
+    {
+        churn(store);
+        return;
+    }
+    insert_cursor.store(0);
+    PhaseResult load = run_phase("load", store, load_worker<Store>);
+    report(load, store->memory());
+    insert_cursor.store(opt.records);
+    PhaseResult run = run_phase("run", store, run_worker<Store>);
+    report(run, store->memory());
+}
+
+// 开启WAL前删除上次留下的日志文件, 不重放旧的记录
+WalSyncPolicy reset_wal(const std::string &path)
+{
+    unlink(path.c_str());
+    unlink(WriteAheadLog::rotated_path(path).c_str());
+    return opt.wal == "always" ? WAL_SYNC_ALWAYS : WAL_SYNC_EVERY_MS;
+}
+
+void report_wal(uint64_t records, uint64_t syncs)
+{
+    if (opt.format == "json")
+    {
+        printf("{\"phase\":\"wal\",\"impl\":\"%s\",\"wal\":\"%s\",\"records\":%llu,\"fsyncs\":%llu}\n", opt.impl.c_str(),
+               opt.wal.c_str(), (unsigned long long)records, (unsigned long long)syncs);
+    }
+    else
+    {
+        printf("wal records: %llu, fsyncs: %llu\n", (unsigned long long)records, (unsigned long long)syncs);
+    }
+}
 
-        void *ret;
-        for( i = 0; i < NUM_THREADS; i++ ) {
-            if (pthread_join(threads[i], &ret) !=0 )  {
-                perror("pthread_create() error");
-                exit(3);
+// YCSB的核心负载
+// a: 50%读 50%更新; b: 95%读 5%更新; c: 只读; d: 95%读 5%插入, 读最近插入的key;
+// e: 95%范围查询 5%插入; f: 50%读 50%读改写
+bool set_workload(const std::string &name)
+{
+    double mixes[6][OP_COUNT] = {
+        {0.5, 0.5, 0, 0, 0},
+        {0.95, 0.05, 0, 0, 0},
+        {1, 0, 0, 0, 0},
+        {0.95, 0, 0.05, 0, 0},
+        {0, 0, 0.05, 0.95, 0},
+        {0.5, 0, 0, 0, 0.5},
+    };
+    if (name.size() != 1 || name[0] < 'a' || name[0] > 'f')
+    {
+        return name == "custom" || name == "churn";
+    }
+    int w = name[0] - 'a';
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        opt.mix[i] = mixes[w][i];
+    }
+    if (opt.distribution.empty())
+    {
+        opt.distribution = name == "d" ? "latest" : "zipfian";
+    }
+    return true;
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: stress [--option=value ...]\n"
+            "  --threads=N         worker threads (1)\n"
+            "  --records=N         keys loaded before the run phase (100000)\n"
+            "  --ops=N             operations in the run phase, split across threads (100000)\n"
+            "  --key-size=N        key length in bytes, at least 16 (16)\n"
+            "  --value-size=N      value length in bytes (100)\n"
+            "  --workload=W        a|b|c|d|e|f (YCSB core workloads), custom, or churn (a)\n"
+            "  --read= --update= --insert= --scan= --rmw=   operation mix for --workload=custom\n"
+            "  --distribution=D    uniform|zipfian|sequential|latest (zipfian; latest for d)\n"
+            "  --scan-length=N     max keys per scan, uniform in [1, N] (100)\n"
+            "  --order=O           hashed|ordered key order for inserts (hashed)\n"
+            "  --impl=I            skiplist|lockfree|sharded; lockfree has no scan, scans count as misses (skiplist)\n"
+            "  --shards=N          shards for --impl=sharded (8)\n"
+            "  --wal=M             none|always|everyms, skiplist and sharded only (none)\n"
+            "  --branching=B       half|quarter|e (half)\n"
+            "  --max-level=N       max level, 0 derives it from --records (0)\n"
+            "  --rounds=N          rounds for --workload=churn (20)\n"
+            "  --seed=N            random seed (1)\n"
+            "  --format=F          text|json (text)\n");
+}
+
+bool parse(int argc, char *argv[])
+{
+    std::string workload = opt.workload;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (name == "threads")
+            opt.threads = atoi(value.c_str());
+        else if (name == "records")
+            opt.records = strtoull(value.c_str(), NULL, 10);
+        else if (name == "ops")
+            opt.ops = strtoull(value.c_str(), NULL, 10);
+        else if (name == "key-size")
+            opt.key_size = atoi(value.c_str());
+        else if (name == "value-size")
+            opt.value_size = atoi(value.c_str());
+        else if (name == "workload")
+            workload = value;
+        else if (name == "distribution")
+            opt.distribution = value;
+        else if (name == "scan-length")
+            opt.scan_length = atoi(value.c_str());
+        else if (name == "order")
+            opt.ordered = value == "ordered";
+        else if (name == "impl")
+            opt.impl = value;
+        else if (name == "shards")
+            opt.shards = atoi(value.c_str());
+        else if (name == "wal")
+            opt.wal = value;
+        else if (name == "branching")
+            opt.branching = value;
+        else if (name == "max-level")
+            opt.max_level = atoi(value.c_str());
+        else if (name == "rounds")
+            opt.rounds = atoi(value.c_str());
+        else if (name == "seed")
+            opt.seed = strtoull(value.c_str(), NULL, 10);
+        else if (name == "format")
+            opt.format = value;
+        else
+        {
+            bool found = false;
+            for (int op = 0; op < OP_COUNT; op++)
+            {
+                if (name == OP_NAMES[op])
+                {
+                    opt.mix[op] = atof(value.c_str());
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                return false;
             }
         }
+    }
+    opt.workload = workload;
+    if (opt.threads < 1 || opt.records < 1 || !set_workload(workload))
+    {
+        return false;
+    }
+    // 不认识的取值和不支持的组合直接报错, 免得结果里记录的配置与实际测的不一致
+    if ((opt.impl != "skiplist" && opt.impl != "lockfree" && opt.impl != "sharded") ||
+        (opt.wal != "none" && opt.wal != "always" && opt.wal != "everyms") ||
+        (opt.wal != "none" && opt.impl == "lockfree") ||
+        (opt.branching != "half" && opt.branching != "quarter" && opt.branching != "e") ||
+        (opt.format != "text" && opt.format != "json") || opt.shards < 1)
+    {
+        return false;
+    }
+    if (opt.distribution.empty())
+    {
+        opt.distribution = "zipfian";
+    }
+    const char *dists[] = {"uniform", "zipfian", "sequential", "latest"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (opt.distribution == dists[i])
+        {
+            dist = (Distribution)i;
+            return true;
+        }
+    }
+    return false;
+}
 
-        auto finish = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed = finish - start;
-        std::cout << "get elapsed:" << elapsed.count() << std::endl;
+int main(int argc, char *argv[])
+{
+    if (!parse(argc, argv))
+    {
+        usage();
+        return 1;
     }
+    Branching branching = opt.branching == "quarter" ? BRANCHING_QUARTER : (opt.branching == "e" ? BRANCHING_E : BRANCHING_HALF);
+    int max_level = opt.max_level > 0 ? opt.max_level : max_level_for(opt.records + opt.ops, branching);
+    zipf = new Zipfian(opt.records);
 
-    pthread_exit(NULL);
+    if (opt.impl == "lockfree")
+    {
+        LockFreeStore store(max_level);
+        store.list.set_branching(branching);
+        benchmark(&store);
+    }
+    else if (opt.impl == "sharded")
+    {
+        ShardedStore store(opt.shards, max_level);
+        store.list.set_branching(branching);
+        if (opt.wal != "none")
+        {
+            for (int i = 0; i < opt.shards; i++)
+            {
+                store.list.shard(i)->enable_wal(reset_wal(std::string(WAL_FILE) + "." + std::to_string(i)));
+            }
+        }
+        benchmark(&store);
+        if (opt.wal != "none")
+        {
+            uint64_t records = 0, syncs = 0;
+            for (int i = 0; i < opt.shards; i++)
+            {
+                records += store.list.shard(i)->get_wal()->record_count();
+                syncs += store.list.shard(i)->get_wal()->sync_count();
+            }
+            report_wal(records, syncs);
+        }
+    }
+    else
+    {
+        LockedStore store(max_level);
+        store.list.set_branching(branching);
+        if (opt.wal != "none")
+        {
+            store.list.enable_wal(reset_wal(WAL_FILE));
+        }
+        benchmark(&store);
+        if (opt.wal != "none")
+        {
+            report_wal(store.list.get_wal()->record_count(), store.list.get_wal()->sync_count());
+        }
+    }
+    delete zipf;
     return 0;
 }
@@ -1,3 +1,3 @@
 #!/bin/bash
-g++ stress-test/stress_test.cpp -o ./bin/stress  --std=c++11 -pthread  
-./bin/stress
+g++ stress-test/stress_test.cpp -o ./bin/stress -O2 --std=c++11 -pthread
+./bin/stress "$@"
@@ -0,0 +1,68 @@
+#ifndef STRING_REF_H
+#define STRING_REF_H
+
+#include <string>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+// 不持有数据的字符串引用, 只记录地址和长度, 相当于C++17的 std::string_view
+// 配合透明比较器 StringLess 在string为key的跳表中查找, 不用为每次查找构造临时的string
+// 引用的数据需要在使用期间保持有效
+class StringRef
+{
+public:
+    StringRef() : _data(""), _size(0) {}
+    StringRef(const char *data, size_t size) : _data(data), _size(size) {}
+    StringRef(const char *s) : _data(s), _size(strlen(s)) {}
+    StringRef(const string &s) : _data(s.data()), _size(s.size()) {}
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    string str() const { return string(_data, _size); }
+
+    // 按字节比较, 与 string::compare 的顺序一致
+    int compare(const StringRef &other) const;
+
+private:
+    const char *_data;
+    size_t _size;
+};
+
+inline int StringRef::compare(const StringRef &other) const
+{
+    size_t n = _size < other._size ? _size : other._size;
+    int r = n == 0 ? 0 : memcmp(_data, other._data, n);
+    if (r != 0)
+    {
+        return r;
+    }
+    return _size < other._size ? -1 : (_size > other._size ? 1 : 0);
+}
+
+inline bool operator<(const StringRef &a, const StringRef &b) { return a.compare(b) < 0; }
+inline bool operator==(const StringRef &a, const StringRef &b) { return a.compare(b) == 0; }
+inline bool operator!=(const StringRef &a, const StringRef &b) { return a.compare(b) != 0; }
+
+inline ostream &operator<<(ostream &os, const StringRef &s)
+{
+    return os.write(s.data(), s.size());
+}
+
+// 字符串的透明比较器: string, CowString, StringRef 和 const char* 之间可以直接比较, 不构造临时对象
+// 顺序与 less<string> 相同, 可以作为 SkipList 的 Compare 参数, 不影响快照和WAL的格式
+//
+//   SkipList<string, string, StringLess> list(18);
+//   list.search_element(StringRef(buf, len), &value);
+//
+// 直接传 const char* 也可以, 但每次比较都要转成StringRef重新strlen, 已知长度时传StringRef更快
+struct StringLess
+{
+    typedef void is_transparent;
+
+    bool operator()(const StringRef &a, const StringRef &b) const { return a.compare(b) < 0; }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TOWER_KEYS_H
+#define TOWER_KEYS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#if defined(__AVX2__) || defined(__SSE4_2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// 节点next数组各层所指节点的key, 紧跟在next数组后面, 与next数组一起分配
+// 查找时在当前节点里就能知道每一层的下一个key, 不小于目标key的那几层直接跳过, 不用为了比较而访问后继节点
+// 一个节点各层的下一个key随层数升高而不减小, 本身就是一个有序的小数组, 用SIMD一次比较多层
+// 只适用于不超过8字节的算术类型的key: 拷贝和比较都只需要一条指令, 写者更新时可以原子地写入
+//
+// 默认不启用: 被跳过的后继节点多半马上会在下一层被访问, 本来就在cache里, 实测省下的比较抵不过节点变大的开销
+// 编译时定义 SKIPLIST_TOWER_KEYS 对所有算术类型启用, 或者只为某个类型特化:
+//
+//   template <> struct TowerKeys<int> : ArithmeticTowerKeys<int> {};
+template <typename K>
+struct ArithmeticTowerKeys
+{
+    static const bool enabled = true;
+
+    // level层节点需要的字节数
+    static size_t size(int level) { return sizeof(K) * (level + 1); }
+
+    // 写者在发布next指针之前更新缓存的key, 不加锁的读者可能读到旧值, 只把它当作提示:
+    // 按缓存跳过的层只是少走几步, 真正向右走之前还会比较节点本身的key
+    static void store(K *keys, int level, const K &key)
+    {
+        __atomic_store(&keys[level], const_cast<K *>(&key), __ATOMIC_RELAXED);
+    }
+
+    // next为NULL的层存放最大值, 它不小于任何key, 查找时总是跳过
+    static void clear(K *keys, int level)
+    {
+        K max = numeric_limits<K>::max();
+        store(keys, level, max);
+    }
+};
+
+template <typename K, typename Enable = void>
+struct TowerKeys
+{
+    static const bool enabled = false;
+
+    static size_t size(int) { return 0; }
+    static void store(K *, int, const K &) {}
+    static void clear(K *, int) {}
+};
+
+#if defined(SKIPLIST_TOWER_KEYS)
+template <typename K>
+struct TowerKeys<K, typename enable_if<is_arithmetic<K>::value && sizeof(K) <= 8>::type> : ArithmeticTowerKeys<K>
+{
+};
+#endif
+
+// keys[0, n)开头连续小于key的元素个数, keys有序时就是key在数组中的插入位置
+// 默认逐个比较; int32/int64 配合 less 时用SIMD一次比较多个
+template <typename K, typename Q, typename Compare>
+int tower_count_less(const K *keys, int n, const Q &key, const Compare &compare)
+{
+    int i = 0;
+    while (i < n)
+    {
+        K k;
+        __atomic_load(&keys[i], &k, __ATOMIC_RELAXED);
+        if (!compare(k, key))
+        {
+            break;
+        }
+        i++;
+    }
+    return i;
+}
+
+// TSan不认识SIMD读取, 用它检查时走上面的逐个比较
+#if !defined(__SANITIZE_THREAD__)
+
+inline int tower_count_less(const int32_t *keys, int n, const int32_t &key, const less<int32_t> &)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, v)));
+        if (mask != 0xff)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i target = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, target)));
+        if (mask != 0xf)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+    while (i < n && keys[i] < key)
+    {
+        i++;
+    }
+    return i;
+}
+
+inline int tower_count_less(const int64_t *keys, int n, const int64_t &key, const less<int64_t> &)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi64x(key);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, v)));
+        if (mask != 0xf)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#elif defined(__SSE4_2__)
+    __m128i target = _mm_set1_epi64x(key);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        unsigned mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, v)));
+        if (mask != 0x3)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+    while (i < n && keys[i] < key)
+    {
+        i++;
+    }
+    return i;
+}
+
+#endif
+
+#endif
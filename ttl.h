@@ -0,0 +1,95 @@
+#ifndef TTL_H
+#define TTL_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <time.h>
+#include <stdint.h>
+using namespace std;
+
+// 后台清理过期key的间隔(毫秒), 有更早到期的key时会提前醒来
+#define TTL_SWEEP_INTERVAL_MS 100
+
+// 后台每轮最多处理的到期条目数, 用完后先释放锁让写操作进来, 再继续下一轮
+#define TTL_SWEEP_BUDGET 256
+
+// 当前时间, 单位毫秒
+// 过期时间会写入快照和WAL, 重启后仍要有效, 所以用墙上时间而不是单调时钟
+inline int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 按到期时间排序的最小堆, 堆顶是最早到期的key
+// 修改或删除key的过期时间时不在堆里查找旧条目, 而是留着它, 弹出时由调用者核对是否仍然有效,
+// 这样设置过期时间和清理到期key都是O(log n), 清理只访问真正到期的条目, 不需要扫描全部key
+template <typename K>
+class ExpireHeap
+{
+public:
+    void push(int64_t expire_at, const K &key);
+
+    bool empty() const { return _heap.empty(); }
+    size_t size() const { return _heap.size(); }
+
+    // 最早的到期时间, 堆为空时不能调用
+    int64_t next_expire_at() const { return _heap.front().first; }
+
+    // 弹出一个到期时间不晚于now的条目, 没有返回false
+    bool pop_expired(int64_t now, K *key, int64_t *expire_at);
+
+    // 只保留valid返回true的条目, 失效条目过多时调用
+    void compact(function<bool(const K &, int64_t)> valid);
+
+private:
+    typedef pair<int64_t, K> Entry;
+
+    // 到期时间早的排在堆顶
+    struct Later
+    {
+        bool operator()(const Entry &a, const Entry &b) const { return a.first > b.first; }
+    };
+
+    vector<Entry> _heap;
+};
+
+template <typename K>
+void ExpireHeap<K>::push(int64_t expire_at, const K &key)
+{
+    _heap.push_back(Entry(expire_at, key));
+    push_heap(_heap.begin(), _heap.end(), Later());
+}
+
+template <typename K>
+bool ExpireHeap<K>::pop_expired(int64_t now, K *key, int64_t *expire_at)
+{
+    if (_heap.empty() || _heap.front().first > now)
+    {
+        return false;
+    }
+    pop_heap(_heap.begin(), _heap.end(), Later());
+    *expire_at = _heap.back().first;
+    *key = _heap.back().second;
+    _heap.pop_back();
+    return true;
+}
+
+template <typename K>
+void ExpireHeap<K>::compact(function<bool(const K &, int64_t)> valid)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < _heap.size(); i++)
+    {
+        if (valid(_heap[i].second, _heap[i].first))
+        {
+            _heap[n++] = _heap[i];
+        }
+    }
+    _heap.resize(n);
+    make_heap(_heap.begin(), _heap.end(), Later());
+}
+
+#endif
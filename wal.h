@@ -0,0 +1,501 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "coding.h"
+#include "async_io.h"
+#include "logger.h"
+using namespace std;
+
+#define WAL_FILE "store/wal"
+
+// 预写日志(WAL)
+// 每次修改跳表都先追加一条二进制记录, 重启时在快照的基础上重放日志即可恢复到崩溃前的状态
+// 追加只是把记录拷贝进内存缓冲区, 由后台线程批量写入文件并fsync(group commit),
+// 同一批次的所有写操作共享一次fsync; io_uring可用时一批的write和fdatasync链在一起, 只需一次系统调用
+//
+// 记录格式:
+// +-----------+-----------+---------+-------------+
+// | crc32c(4) | length(4) | type(1) | payload     |
+// +-----------+-----------+---------+-------------+
+// crc32c 覆盖 type 和 payload, length 为 payload 的字节数
+// 重放时遇到不完整或校验失败的记录就停止, 并把文件截断到最后一条完整记录处
+//
+// 后台快照开始前调用rotate()把当前日志改名为 path.old, 快照只包含 path.old 中的修改,
+// 快照落盘后再删除 path.old; 恢复时先重放 path.old 再重放 path
+
+// 刷盘策略
+enum WalSyncPolicy
+{
+    WAL_SYNC_ALWAYS,   // 写操作返回前等待所在批次fsync完成
+    WAL_SYNC_EVERY_MS, // 每隔固定毫秒数fsync一次, 崩溃最多丢失这段时间内的写入
+    WAL_SYNC_NEVER     // 只写入文件, 何时落盘由操作系统决定
+};
+
+// 记录类型
+enum WalRecordType
+{
+    WAL_INSERT = 1,
+    WAL_DELETE = 2,
+    WAL_EXPIRE_AT = 4,
+    WAL_BATCH = 5     // 一批写操作, 整条记录完整时才会重放, 保证一批要么全部恢复要么全部丢弃
+};
+
+#define WAL_HEADER_SIZE 9
+
+class WriteAheadLog
+{
+public:
+    WriteAheadLog(const string &path, WalSyncPolicy policy, int interval_ms);
+    ~WriteAheadLog();
+
+    bool is_open() const;
+
+    // 追加一条记录, 返回记录的序号
+    uint64_t append(WalRecordType type, const string &payload);
+
+    // WAL_SYNC_ALWAYS 策略下阻塞到序号为seq的记录落盘, 其他策略直接返回true
+    // 写入或fsync失败后不会再有记录被当作已落盘, 返回false
+    bool wait_durable(uint64_t seq);
+
+    // 第一次写入或fsync失败时的errno, 没有失败过为0
+    // 失败后日志里可能缺少记录, 之后的记录都不算落盘, 直到reset()由新的快照覆盖全部修改
+    int error();
+
+    // 清空日志(包括rotate出的旧日志)并清除错误, 在快照落盘后调用, 调用者需保证期间没有并发的append
+    void reset();
+
+    // 把缓冲区里的记录写入当前文件后, 将当前文件改名为 rotated_path(), 之后的记录写入新文件
+    // 旧日志已经存在时(上一次后台快照失败), 把当前文件的内容追加到旧日志后面
+    // 调用者需保证期间没有并发的append
+    bool rotate();
+
+    // 删除rotate出的旧日志, 在后台快照落盘后调用
+    void drop_rotated();
+
+    static string rotated_path(const string &path) { return path + ".old"; }
+
+    // 追加过的记录数和执行过的fsync次数
+    uint64_t record_count();
+    uint64_t sync_count();
+
+    // 按顺序读出日志中的每条记录交给fn处理, 返回读出的记录数
+    static uint64_t replay(const string &path, function<void(WalRecordType, const char *, size_t)> fn);
+
+private:
+    void flush_loop();
+    bool write_batch(const string &batch, bool sync);
+    static bool write_all(int fd, const char *data, size_t n);
+    static bool append_file(const string &from, const string &to);
+
+private:
+    int _fd;
+    string _path;
+    WalSyncPolicy _policy;
+    int _interval_ms;
+
+    // 保护 _buffer 和各个序号
+    mutex _mtx;
+    condition_variable _work_cv; // 有新记录时通知后台线程
+    condition_variable _done_cv; // 一批记录落盘后通知等待的写操作
+
+    // 保护 _fd 和文件内容, 后台线程取出一批记录到写完为止都持有它,
+    // 所以reset/rotate拿到它时不会有已经取出但还未写入的批次
+    // 加锁顺序: 先 _io_mtx 后 _mtx
+    mutex _io_mtx;
+
+    string _buffer;
+    uint64_t _next_seq;
+    uint64_t _durable_seq;
+    uint64_t _sync_count;
+    int _error;
+
+    bool _stop;
+    thread _flusher;
+
+#if SKIPLIST_IO_URING
+    // 只在持有 _io_mtx 时使用
+    IoUring _ring;
+    bool _use_ring;
+#endif
+};
+
+inline WriteAheadLog::WriteAheadLog(const string &path, WalSyncPolicy policy, int interval_ms)
+    : _path(path), _policy(policy), _interval_ms(interval_ms > 0 ? interval_ms : 1),
+      _next_seq(1), _durable_seq(0), _sync_count(0), _error(0), _stop(false)
+{
+#if SKIPLIST_IO_URING
+    // 文件以O_APPEND打开, 写入位置由内核决定, 需要支持以-1为偏移写到当前位置(5.6)
+    _use_ring = async_io_mode() == ASYNC_IO_AUTO && _ring.init(2) && (_ring.features() & IORING_FEAT_RW_CUR_POS);
+#endif
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+    {
+        LOG_ERROR("打开WAL文件 " << path << " 失败, errno: " << errno);
+        return;
+    }
+    _flusher = thread(&WriteAheadLog::flush_loop, this);
+}
+
+// 析构时把缓冲区里剩余的记录写完再退出
+inline WriteAheadLog::~WriteAheadLog()
+{
+    {
+        lock_guard<mutex> lock(_mtx);
+        _stop = true;
+    }
+    _work_cv.notify_one();
+    if (_flusher.joinable())
+    {
+        _flusher.join();
+    }
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+inline bool WriteAheadLog::is_open() const
+{
+    return _fd >= 0;
+}
+
+inline uint64_t WriteAheadLog::append(WalRecordType type, const string &payload)
+{
+    string record;
+    record.reserve(WAL_HEADER_SIZE + payload.size());
+    record.push_back(static_cast<char>(type));
+    record.append(payload);
+    uint32_t crc = crc32c(record.data(), record.size());
+
+    lock_guard<mutex> lock(_mtx);
+    put_fixed32(&_buffer, crc);
+    put_fixed32(&_buffer, static_cast<uint32_t>(payload.size()));
+    _buffer.append(record);
+    uint64_t seq = _next_seq++;
+    if (_policy == WAL_SYNC_ALWAYS)
+    {
+        _work_cv.notify_one();
+    }
+    return seq;
+}
+
+inline bool WriteAheadLog::wait_durable(uint64_t seq)
+{
+    if (_policy != WAL_SYNC_ALWAYS || _fd < 0)
+    {
+        return true;
+    }
+    unique_lock<mutex> lock(_mtx);
+    while (_durable_seq < seq && _error == 0)
+    {
+        _done_cv.wait(lock);
+    }
+    return _durable_seq >= seq;
+}
+
+inline int WriteAheadLog::error()
+{
+    lock_guard<mutex> lock(_mtx);
+    return _error;
+}
+
+inline void WriteAheadLog::reset()
+{
+    lock_guard<mutex> io_lock(_io_mtx);
+    lock_guard<mutex> lock(_mtx);
+    _buffer.clear();
+    if (ftruncate(_fd, 0) != 0 || fsync(_fd) != 0)
+    {
+        LOG_ERROR("清空WAL文件失败, errno: " << errno);
+        _error = errno;
+    }
+    else
+    {
+        // 之前没能写入的记录也都包含在快照里了, 日志从头开始是完整的
+        _error = 0;
+    }
+    unlink(rotated_path(_path).c_str());
+    // 被丢弃的记录已经包含在快照里了
+    _durable_seq = _next_seq - 1;
+    _done_cv.notify_all();
+}
+
+inline bool WriteAheadLog::rotate()
+{
+    lock_guard<mutex> io_lock(_io_mtx);
+    lock_guard<mutex> lock(_mtx);
+    if (_fd < 0)
+    {
+        return false;
+    }
+
+    // rotate之前的记录都要留在旧日志里
+    bool ok = write_all(_fd, _buffer.data(), _buffer.size());
+    _buffer.clear();
+    if (ok && _policy != WAL_SYNC_NEVER)
+    {
+        ok = fdatasync(_fd) == 0;
+        _sync_count++;
+    }
+    if (!ok)
+    {
+        LOG_ERROR("写入WAL失败, errno: " << errno);
+        if (_error == 0)
+        {
+            _error = errno;
+        }
+        _done_cv.notify_all();
+        return false;
+    }
+    if (_error == 0)
+    {
+        _durable_seq = _next_seq - 1;
+    }
+    _done_cv.notify_all();
+
+    string rotated = rotated_path(_path);
+    if (access(rotated.c_str(), F_OK) == 0)
+    {
+        if (!append_file(_path, rotated) || ftruncate(_fd, 0) != 0)
+        {
+            LOG_ERROR("合并WAL到 " << rotated << " 失败, errno: " << errno);
+            return false;
+        }
+        return true;
+    }
+
+    if (rename(_path.c_str(), rotated.c_str()) != 0)
+    {
+        LOG_ERROR("WAL改名为 " << rotated << " 失败, errno: " << errno);
+        return false;
+    }
+    int fd = open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        // 新文件打不开就继续写旧文件, 等价于没有rotate
+        LOG_ERROR("打开WAL文件 " << _path << " 失败, errno: " << errno);
+        rename(rotated.c_str(), _path.c_str());
+        return false;
+    }
+    close(_fd);
+    _fd = fd;
+    return true;
+}
+
+inline void WriteAheadLog::drop_rotated()
+{
+    lock_guard<mutex> io_lock(_io_mtx);
+    unlink(rotated_path(_path).c_str());
+}
+
+inline uint64_t WriteAheadLog::record_count()
+{
+    lock_guard<mutex> lock(_mtx);
+    return _next_seq - 1;
+}
+
+inline uint64_t WriteAheadLog::sync_count()
+{
+    lock_guard<mutex> lock(_mtx);
+    return _sync_count;
+}
+
+// 后台线程: 取走缓冲区里积攒的一批记录, 一次write一次fsync
+// fsync期间新到的记录留给下一批, 写得越密集每批记录越多
+inline void WriteAheadLog::flush_loop()
+{
+    unique_lock<mutex> lock(_mtx);
+    while (true)
+    {
+        if (_policy == WAL_SYNC_ALWAYS)
+        {
+            while (_buffer.empty() && !_stop)
+            {
+                _work_cv.wait(lock);
+            }
+        }
+        else if (!_stop)
+        {
+            _work_cv.wait_for(lock, chrono::milliseconds(_interval_ms));
+        }
+
+        if (_buffer.empty())
+        {
+            if (_stop)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // 按 _io_mtx -> _mtx 的顺序重新加锁, 期间缓冲区可能已被reset/rotate取走
+        lock.unlock();
+        unique_lock<mutex> io_lock(_io_mtx);
+        lock.lock();
+        if (_buffer.empty())
+        {
+            continue;
+        }
+        string batch;
+        batch.swap(_buffer);
+        uint64_t last_seq = _next_seq - 1;
+        lock.unlock();
+
+        bool synced = _policy != WAL_SYNC_NEVER;
+        bool ok = write_batch(batch, synced);
+        int err = errno;
+
+        // 仍持有 _io_mtx 时更新状态, 中间不会插进来reset
+        lock.lock();
+        if (synced)
+        {
+            _sync_count++;
+        }
+        if (!ok)
+        {
+            // 这一批没有完整落盘, 不推进 _durable_seq, 等待它的写操作返回失败
+            LOG_ERROR("写入WAL失败, errno: " << err);
+            if (_error == 0)
+            {
+                _error = err;
+            }
+        }
+        else if (_error == 0 && last_seq > _durable_seq)
+        {
+            _durable_seq = last_seq;
+        }
+        _done_cv.notify_all();
+        lock.unlock();
+        io_lock.unlock();
+        lock.lock();
+    }
+}
+
+// 在后台线程中调用, 调用者持有 _io_mtx; sync为true时写入后fdatasync
+inline bool WriteAheadLog::write_batch(const string &batch, bool sync)
+{
+#if SKIPLIST_IO_URING
+    if (_use_ring)
+    {
+        return _ring.write_and_sync(_fd, batch.data(), batch.size(), sync);
+    }
+#endif
+    bool ok = write_all(_fd, batch.data(), batch.size());
+    int err = errno;
+    if (sync && fdatasync(_fd) != 0 && ok)
+    {
+        return false;
+    }
+    // 写入失败时报告写入的errno
+    errno = err;
+    return ok;
+}
+
+inline bool WriteAheadLog::write_all(int fd, const char *data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = write(fd, data, n);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += w;
+        n -= w;
+    }
+    return true;
+}
+
+// 把from的全部内容追加到to末尾并fsync
+inline bool WriteAheadLog::append_file(const string &from, const string &to)
+{
+    int in = open(from.c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_APPEND);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+    bool ok = true;
+    char buf[64 * 1024];
+    while (ok)
+    {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        ok = write_all(out, buf, n);
+    }
+    ok = ok && fsync(out) == 0;
+    close(in);
+    close(out);
+    return ok;
+}
+
+inline uint64_t WriteAheadLog::replay(const string &path, function<void(WalRecordType, const char *, size_t)> fn)
+{
+    ifstream reader(path.c_str(), ios::binary);
+    if (!reader.is_open())
+    {
+        return 0;
+    }
+    stringstream ss;
+    ss << reader.rdbuf();
+    reader.close();
+    string data = ss.str();
+
+    uint64_t count = 0;
+    size_t pos = 0;
+    while (pos + WAL_HEADER_SIZE <= data.size())
+    {
+        uint32_t crc = decode_fixed32(data.data() + pos);
+        uint32_t length = decode_fixed32(data.data() + pos + 4);
+        if (pos + WAL_HEADER_SIZE + length > data.size())
+        {
+            break;
+        }
+        const char *record = data.data() + pos + 8;
+        if (crc32c(record, length + 1) != crc)
+        {
+            break;
+        }
+        fn(static_cast<WalRecordType>(record[0]), record + 1, length);
+        pos += WAL_HEADER_SIZE + length;
+        count++;
+    }
+
+    // 崩溃时最后一条记录可能只写了一半, 截断后新的记录才能接在完整记录后面
+    if (pos < data.size())
+    {
+        LOG_WARN("WAL在偏移 " << pos << " 处不完整, 已截断");
+        if (truncate(path.c_str(), pos) != 0)
+        {
+            LOG_ERROR("截断WAL失败, errno: " << errno);
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef WRITE_BATCH_H
+#define WRITE_BATCH_H
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+using namespace std;
+
+// 一批写操作, 通过 SkipList::write_batch() 在一次加锁内全部应用, 并作为一条WAL记录写入
+// 同一批中对同一个key的多次操作按加入的顺序生效, 最后一次为准
+//
+//   WriteBatch<int, string> batch;
+//   batch.put(1, "a");
+//   batch.del(2);
+//   list.write_batch(batch);
+template <typename K, typename V>
+class WriteBatch
+{
+public:
+    struct Op
+    {
+        K key;
+        V value;
+        bool is_delete;
+    };
+
+    void put(const K &key, const V &value);
+    void put(const K &key, V &&value);
+    void del(const K &key);
+
+    void clear() { _ops.clear(); }
+    size_t size() const { return _ops.size(); }
+    bool empty() const { return _ops.empty(); }
+
+    // 按加入顺序排列的操作
+    const vector<Op> &ops() const { return _ops; }
+
+private:
+    vector<Op> _ops;
+};
+
+template <typename K, typename V>
+void WriteBatch<K, V>::put(const K &key, const V &value)
+{
+    Op op = {key, value, false};
+    _ops.push_back(std::move(op));
+}
+
+template <typename K, typename V>
+void WriteBatch<K, V>::put(const K &key, V &&value)
+{
+    Op op = {key, std::move(value), false};
+    _ops.push_back(std::move(op));
+}
+
+template <typename K, typename V>
+void WriteBatch<K, V>::del(const K &key)
+{
+    Op op = {key, V(), true};
+    _ops.push_back(std::move(op));
+}
+
+#endif